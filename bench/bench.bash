@@ -0,0 +1,271 @@
+#!/bin/bash
+
+# mariebuild benchmark suite.
+# Generates synthetic projects and measures how a mariebuild binary scales
+# with them. Every element runs through a chain of singular c_rules and
+# each target links its elements with a unify c_rule. The "compiler" of
+# every rule is a stub made of shell builtins, so that the measured work
+# only depends on the project's shape.
+#
+# For every element count this measures a cold build, a no-op build, a
+# rebuild after touching a single source, the time spent parsing the
+# build file with and without its cache, and mariebuild's peak RSS. The
+# results are written as JSON.
+
+set -o pipefail
+export LC_ALL=C
+
+ELEMENTS="1000 10000 100000"
+DEPTH=2
+FANOUT=4
+JOBS=""
+OUTPUT="bench_results.json"
+KEEP=""
+
+function usage() {
+	echo "usage: $0 [-e \"COUNT ...\"] [-d DEPTH] [-f FANOUT] [-j JOBS]"
+	echo "       [-o FILE] [-k] MB_BINARY"
+	echo
+	echo "	-e	element counts to benchmark (default: $ELEMENTS)"
+	echo "	-d	c_rules every element runs through (default: $DEPTH)"
+	echo "	-f	targets the elements are spread over (default: $FANOUT)"
+	echo "	-j	jobs passed to mariebuild (default: its own default)"
+	echo "	-o	file to write the results to (default: $OUTPUT)"
+	echo "	-k	keep the generated projects"
+	exit 1
+}
+
+function now() {
+	if [ -n "$EPOCHREALTIME" ]; then
+		echo "$EPOCHREALTIME"
+	else
+		date +%s.%N
+	fi
+}
+
+function elapsed() {
+	awk -v start="$1" -v end="$2" 'BEGIN { printf "%.6f", end - start }'
+}
+
+# the value of a top-level field of the summary JSON
+function summary_field() {
+	sed -n "s/^  \"$2\": \\([0-9.]*\\),\$/\\1/p" "$1"
+}
+
+# the duration of the parse span of a trace in seconds
+function trace_parse() {
+	grep -o '"name":"parse"[^}]*"dur":[0-9.]*' "$1" |
+		sed 's/.*"dur"://' |
+		awk '{ printf "%.6f", $1 / 1000000 }'
+}
+
+function generate() {
+	local dir=$1
+	local elements=$2
+
+	mkdir -p "$dir/src"
+	echo "int common;" > "$dir/src/common.h"
+
+	local per_target=$(( (elements + FANOUT - 1) / FANOUT ))
+	local lists=""
+	local targets=""
+	local rules=""
+
+	for (( target = 0; target < FANOUT; target++ )); do
+		local first=$(( target * per_target ))
+		local last=$(( first + per_target ))
+		if (( last > elements )); then
+			last=$elements
+		fi
+
+		mkdir -p "$dir/src/t$target" "$dir/out/t$target"
+
+		local list=""
+		for (( element = first; element < last; element++ )); do
+			printf '#include "common.h"\nint e%d;\n' $element \
+				> "$dir/src/t$target/e$element.c"
+			list+="${list:+, }'e$element'"
+		done
+		lists+="		list str t$target $list"$'\n'
+
+		local chain=""
+		for (( stage = 0; stage < DEPTH; stage++ )); do
+			local input="out/t$target/\$(%element%).s$(( stage - 1 ))"
+			local depfile=""
+			if (( stage == 0 )); then
+				input="src/t$target/\$(%element%).c"
+				depfile="		str depfile '\$(%output%).d'"$'\n'
+			fi
+
+			rules+="	section t${target}_s$stage
+		bool parallel true
+		str input_src '/config/files/t$target'
+		str input_format '$input'
+		str output_format 'out/t$target/\$(%element%).s$stage'
+$depfile		str exec '#!/bin/sh
+		printf \"%s\\\\n\" \$(%input%) > \$(%output%)
+		printf \"%s: %s src/common.h\\\\n\" \$(%output%) \$(%input%) > \$(%output%).d
+		'
+	end
+
+"
+			chain+="'t${target}_s$stage', "
+		done
+
+		rules+="	section t${target}_link
+		str exec_mode 'unify'
+		str input_src '/config/files/t$target'
+		str input_format 'out/t$target/\$(%element%).s$(( DEPTH - 1 ))'
+		str output_format 'out/t$target.a'
+		str exec '#!/bin/sh
+		printf \"%s\\\\n\" \$(%input%) > \$(%output%)
+		'
+	end
+
+"
+		targets+="	section t$target
+		list str c_rules ${chain}'t${target}_link'
+	end
+
+"
+	done
+
+	local required=""
+	for (( target = 0; target < FANOUT; target++ )); do
+		required+="${required:+, }'t$target'"
+	done
+
+	cat > "$dir/build.mb" <<EOF
+sector config
+	section files
+$lists	end
+
+	section mariebuild
+		str build_type 'incremental'
+		list str targets 'all'
+		str default 'all'
+	end
+end
+
+sector targets
+	section all
+		list str required_targets $required
+	end
+
+$targets
+end
+
+sector c_rules
+$rules
+end
+EOF
+}
+
+# runs mariebuild in the project and prints a JSON object of the run
+function run() {
+	local dir=$1
+	local name=$2
+
+	local start
+	start=$(now)
+	(
+		cd "$dir" &&
+			"$MB" -n -v 3 ${JOBS:+-j "$JOBS"} --trace=trace.json \
+				--summary-json=summary.json > /dev/null
+	)
+	local status=$?
+	local end
+	end=$(now)
+
+	if (( status != 0 )); then
+		echo "==> $name build failed with status $status" >&2
+		exit 1
+	fi
+
+	local wall
+	wall=$(elapsed "$start" "$end")
+	echo "==> $name: ${wall}s" >&2
+
+	printf '{"wall": %s, "parse": %s, "jobs": %s, "max_rss": %s}' \
+		"$wall" "$(trace_parse "$dir/trace.json")" \
+		"$(summary_field "$dir/summary.json" jobs)" \
+		"$(summary_field "$dir/summary.json" self_max_rss)"
+}
+
+function bench() {
+	local elements=$1
+	local dir="$WORKDIR/e$elements"
+
+	echo "==> generating $elements elements, depth $DEPTH, fanout $FANOUT" >&2
+	generate "$dir" "$elements"
+
+	local cold noop touch
+	cold=$(run "$dir" cold) || exit
+	noop=$(run "$dir" no-op) || exit
+
+	# keeps the mtime ahead of the outputs on coarse filesystems
+	sleep 1
+	touch "$dir/src/t0/e0.c"
+	touch=$(run "$dir" touch) || exit
+
+	printf '    {"elements": %d, "depth": %d, "fanout": %d,\n' \
+		"$elements" "$DEPTH" "$FANOUT"
+	printf '     "cold": %s,\n     "noop": %s,\n     "touch": %s}' \
+		"$cold" "$noop" "$touch"
+
+	if [ -z "$KEEP" ]; then
+		rm -rf "$dir"
+	fi
+}
+
+while getopts "e:d:f:j:o:k" opt; do
+	case $opt in
+		e) ELEMENTS=$OPTARG;;
+		d) DEPTH=$OPTARG;;
+		f) FANOUT=$OPTARG;;
+		j) JOBS=$OPTARG;;
+		o) OUTPUT=$OPTARG;;
+		k) KEEP=1;;
+		*) usage;;
+	esac
+done
+shift $(( OPTIND - 1 ))
+
+if [ -z "$1" ] || (( DEPTH < 1 || FANOUT < 1 )); then
+	usage
+fi
+
+MB=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+if [ ! -x "$MB" ]; then
+	echo "==> \"$1\" is not executable" >&2
+	exit 1
+fi
+
+WORKDIR=$(mktemp -d "${TMPDIR:-/tmp}/mb_bench.XXXXXX") || exit
+if [ -n "$KEEP" ]; then
+	echo "==> keeping the projects in $WORKDIR" >&2
+fi
+
+RUNS=""
+for elements in $ELEMENTS; do
+	RESULT=$(bench "$elements") || exit
+	RUNS+="${RUNS:+,$'\n'}$RESULT"
+done
+
+if [ -z "$KEEP" ]; then
+	rm -rf "$WORKDIR"
+fi
+
+cat > "$OUTPUT" <<EOF
+{
+  "version": "$("$MB" --version | head -n 1)",
+  "system": "$(uname -sm)",
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "jobs": ${JOBS:-null},
+  "runs": [
+$RUNS
+  ]
+}
+EOF
+
+echo "==> wrote $OUTPUT" >&2
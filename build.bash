@@ -11,9 +11,9 @@ OBJ_DIR="obj/"
 
 CC="clang"
 BASE_CFLAGS="-std=c17 -pedantic-errors -Wall -Wextra -Werror -Wno-gnu-statement-expression -Iinclude/ -Isrc/"
-DEBUG_CFLAGS="-ggdb -DDEFAULT_LOG_LEVEL=LOG_DEBUG"
+DEBUG_CFLAGS="-ggdb -DDEFAULT_LOG_LEVEL=LOG_DEBUG -DMB_STATS"
 RELEASE_CFLAGS="-Oz"
-LDFLAGS="-lm -Llib/ -lmcfg_2"
+LDFLAGS="-lm -lpthread -Llib/ -lmcfg_2"
 
 BIN_NAME="mb"
 
@@ -49,7 +49,7 @@ function build_objs() {
 }
 
 function build() {
-	OBJECTS=("stringutil cptrlist signals logging types executor c_rule target build main")
+	OBJECTS=("xmem stringutil ioutil timeutil cptrlist signals logging trace types executor jobs summary stats flight workers hash filecache fileindex inputglob buildlog depfile artifacts template c_rule target graph build main")
 
 	echo "==> Compiling Sources for \"$BIN_DEST\""
 	build_objs "${OBJECTS[@]}"
@@ -0,0 +1,578 @@
+/* artifacts.c ; mariebuild local artifact cache impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "artifacts.h"
+#include "depfile.h"
+#include "hash.h"
+#include "ioutil.h"
+#include "logging.h"
+#include "xmem.h"
+
+/* prerequisite sets remembered per manifest */
+#define MANIFEST_MAX_ENTRIES 8
+#define MANIFEST_ENTRY "entry"
+
+/* trim the cache to this percentage of its size to not evict on every run */
+#define EVICT_TARGET_PERCENT 90
+
+static char *cache_dir = NULL;
+static uint64_t cache_max_size = 0;
+
+static size_t hits = 0;
+static size_t misses = 0;
+static size_t stored = 0;
+
+bool mb_artifacts_open(const char *dir, uint64_t max_size) {
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		mb_logf(
+			LOG_WARNING, "could not create artifact cache \"%s\": %s\n", dir,
+			strerror(errno));
+		return false;
+	}
+
+	cache_dir = strdup(dir);
+	cache_max_size = max_size;
+	return true;
+}
+
+bool mb_artifacts_is_open(void) {
+	return cache_dir != NULL;
+}
+
+uint64_t mb_artifacts_key(uint64_t command_hash, uint64_t input_hash) {
+	uint64_t parts[2] = {command_hash, input_hash};
+	return mb_hash64(parts, sizeof(parts), 0);
+}
+
+/**
+ * @brief Path of the file of a key within the cache, the first byte of the
+ * key names its subdirectory.
+ */
+char *_artifact_path(uint64_t key, const char *extension) {
+	size_t size = strlen(cache_dir) + strlen(extension) + 20;
+	char *path = XMALLOC(size);
+	snprintf(
+		path, size, "%s/%02x/%014" PRIx64 "%s", cache_dir,
+		(unsigned int)(key >> 56), (uint64_t)(key & 0x00FFFFFFFFFFFFFFULL),
+		extension);
+
+	return path;
+}
+
+void _make_subdir(uint64_t key) {
+	size_t size = strlen(cache_dir) + 4;
+	char *path = XMALLOC(size);
+	snprintf(path, size, "%s/%02x", cache_dir, (unsigned int)(key >> 56));
+
+	mkdir(path, 0755);
+	XFREE(path);
+}
+
+bool _copy_contents(int in, int out) {
+	char buffer[65536];
+
+	for (;;) {
+		ssize_t res = read(in, buffer, sizeof(buffer));
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res < 0) {
+			return false;
+		}
+		if (res == 0) {
+			return true;
+		}
+
+		if (!mb_write_all(out, buffer, res)) {
+			return false;
+		}
+	}
+}
+
+/**
+ * @brief Replace dst with a copy of src, sharing its blocks if the file
+ * system supports reflinks. Hard links are not used since a job rewriting
+ * its output in place would modify the cached artifact as well.
+ */
+bool _copy_file(const char *src, const char *dst) {
+	int in = open(src, O_RDONLY | O_CLOEXEC);
+	if (in < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(in, &st) != 0) {
+		close(in);
+		return false;
+	}
+
+	size_t tmp_size = strlen(dst) + 32;
+	char *tmp = XMALLOC(tmp_size);
+	snprintf(tmp, tmp_size, "%s.%ld.tmp", dst, (long)getpid());
+
+	int out =
+		open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+	bool ok = out >= 0;
+
+	if (ok) {
+		bool cloned = false;
+#ifdef FICLONE
+		cloned = ioctl(out, FICLONE, in) == 0;
+#endif
+		if (!cloned) {
+			ok = _copy_contents(in, out);
+		}
+
+		ok = close(out) == 0 && ok;
+	}
+
+	close(in);
+
+	ok = ok && rename(tmp, dst) == 0;
+	if (!ok) {
+		unlink(tmp);
+	}
+
+	XFREE(tmp);
+	return ok;
+}
+
+/**
+ * @brief Read a whole file, terminated.
+ * @return NULL if the file can not be read.
+ */
+char *_read_whole(const char *path) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t size = st.st_size;
+	char *content = XMALLOC(size + 1);
+	size_t read_total = 0;
+
+	while (read_total < size) {
+		ssize_t res = read(fd, content + read_total, size - read_total);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			break;
+		}
+
+		read_total += res;
+	}
+
+	close(fd);
+
+	if (read_total != size) {
+		XFREE(content);
+		return NULL;
+	}
+
+	content[size] = '\0';
+	return content;
+}
+
+/**
+ * @brief Mix a prerequisite and the hash of its contents into a key.
+ */
+uint64_t _fold_prerequisite(uint64_t key, const char *path, uint64_t hash) {
+	uint64_t parts[3] = {key, mb_hash_str(path), hash};
+	return mb_hash64(parts, sizeof(parts), 0);
+}
+
+/**
+ * @brief Find the start of the next manifest entry at or after pos.
+ */
+char *_next_entry(char *pos) {
+	while (pos != NULL && *pos != '\0') {
+		if (strncmp(pos, MANIFEST_ENTRY "\n", strlen(MANIFEST_ENTRY) + 1) ==
+			0) {
+			return pos;
+		}
+
+		pos = strchr(pos, '\n');
+		if (pos != NULL) {
+			pos++;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Compute the key of the artifact a manifest entry describes from
+ * the current contents of its prerequisites.
+ * @param end Set to the start of the next entry or NULL.
+ * @return Whether all prerequisites could be hashed.
+ */
+bool _entry_key(uint64_t key, char *entry, char **end, uint64_t *result) {
+	char *pos = entry + strlen(MANIFEST_ENTRY) + 1;
+	*end = _next_entry(pos);
+	*result = key;
+
+	while (pos != NULL && *pos != '\0' && pos != *end) {
+		char *newline = strchr(pos, '\n');
+		if (newline == NULL) {
+			return false;
+		}
+
+		*newline = '\0';
+		uint64_t hash;
+		bool ok = mb_hash_file(pos, &hash);
+		if (ok) {
+			*result = _fold_prerequisite(*result, pos, hash);
+		}
+		*newline = '\n';
+
+		if (!ok) {
+			return false;
+		}
+
+		pos = newline + 1;
+	}
+
+	return true;
+}
+
+void _touch(const char *path) {
+	utimensat(AT_FDCWD, path, NULL, 0);
+}
+
+bool _restore_result(uint64_t result, const char *output, char *depfile) {
+	char *object = _artifact_path(result, ".o");
+	char *object_depfile = _artifact_path(result, ".d");
+	bool ok = access(object, F_OK) == 0 &&
+			  (depfile == NULL || access(object_depfile, F_OK) == 0);
+
+	ok = ok && _copy_file(object, output) &&
+		 (depfile == NULL || _copy_file(object_depfile, depfile));
+
+	if (ok) {
+		_touch(object);
+		if (depfile != NULL) {
+			_touch(object_depfile);
+		}
+	}
+
+	XFREE(object);
+	XFREE(object_depfile);
+	return ok;
+}
+
+bool mb_artifacts_restore(uint64_t key, const char *output, char *depfile) {
+	if (cache_dir == NULL) {
+		return false;
+	}
+
+	char *manifest_path = _artifact_path(key, ".m");
+	char *manifest = _read_whole(manifest_path);
+	bool restored = false;
+
+	char *entry = _next_entry(manifest);
+	while (entry != NULL && !restored) {
+		char *end;
+		uint64_t result;
+		restored = _entry_key(key, entry, &end, &result) &&
+				   _restore_result(result, output, depfile);
+
+		entry = end;
+	}
+
+	if (restored) {
+		_touch(manifest_path);
+		hits++;
+	} else {
+		misses++;
+	}
+
+	if (manifest != NULL) {
+		XFREE(manifest);
+	}
+	XFREE(manifest_path);
+	return restored;
+}
+
+struct prerequisites {
+	char *entry;
+	size_t length;
+	size_t capacity;
+	uint64_t result;
+	bool ok;
+};
+
+bool _add_prerequisite(char *prerequisite, void *ctx) {
+	struct prerequisites *prerequisites = ctx;
+
+	/* paths which can not be told apart from the manifest's syntax */
+	uint64_t hash;
+	if (strchr(prerequisite, '\n') != NULL ||
+		strcmp(prerequisite, MANIFEST_ENTRY) == 0 ||
+		!mb_hash_file(prerequisite, &hash)) {
+		prerequisites->ok = false;
+		return false;
+	}
+
+	prerequisites->result =
+		_fold_prerequisite(prerequisites->result, prerequisite, hash);
+
+	size_t length = strlen(prerequisite);
+	while (prerequisites->length + length + 2 > prerequisites->capacity) {
+		prerequisites->capacity *= 2;
+		prerequisites->entry =
+			XREALLOC(prerequisites->entry, prerequisites->capacity);
+	}
+
+	memcpy(prerequisites->entry + prerequisites->length, prerequisite, length);
+	prerequisites->length += length;
+	prerequisites->entry[prerequisites->length++] = '\n';
+	prerequisites->entry[prerequisites->length] = '\0';
+
+	return true;
+}
+
+/**
+ * @brief Put an entry in front of a manifest, dropping the oldest entries
+ * if there are too many.
+ */
+void _update_manifest(uint64_t key, const char *new_entry) {
+	char *manifest_path = _artifact_path(key, ".m");
+	char *manifest = _read_whole(manifest_path);
+
+	size_t tmp_size = strlen(manifest_path) + 32;
+	char *tmp = XMALLOC(tmp_size);
+	snprintf(tmp, tmp_size, "%s.%ld.tmp", manifest_path, (long)getpid());
+
+	FILE *file = fopen(tmp, "w");
+	bool ok = file != NULL && fputs(new_entry, file) >= 0;
+
+	size_t entries = 1;
+	char *entry = _next_entry(manifest);
+	while (ok && entry != NULL && entries < MANIFEST_MAX_ENTRIES) {
+		char *end = _next_entry(entry + strlen(MANIFEST_ENTRY) + 1);
+		size_t length = end != NULL ? (size_t)(end - entry) : strlen(entry);
+
+		if (length != strlen(new_entry) ||
+			strncmp(entry, new_entry, length) != 0) {
+			ok = fwrite(entry, 1, length, file) == length;
+			entries++;
+		}
+
+		entry = end;
+	}
+
+	if (file != NULL) {
+		ok = fclose(file) == 0 && ok;
+	}
+
+	if (!ok || rename(tmp, manifest_path) != 0) {
+		unlink(tmp);
+	}
+
+	if (manifest != NULL) {
+		XFREE(manifest);
+	}
+	XFREE(tmp);
+	XFREE(manifest_path);
+}
+
+void mb_artifacts_store(uint64_t key, const char *output, char *depfile) {
+	if (cache_dir == NULL) {
+		return;
+	}
+
+	struct prerequisites prerequisites = {
+		.capacity = 256,
+		.result = key,
+		.ok = true,
+	};
+	prerequisites.entry = XMALLOC(prerequisites.capacity);
+	strcpy(prerequisites.entry, MANIFEST_ENTRY "\n");
+	prerequisites.length = strlen(prerequisites.entry);
+
+	if (depfile != NULL &&
+		!mb_depfile_read(depfile, _add_prerequisite, &prerequisites)) {
+		prerequisites.ok = false;
+	}
+
+	if (!prerequisites.ok) {
+		mb_logf(LOG_DEBUG, "not caching \"%s\"\n", output);
+		goto exit;
+	}
+
+	_make_subdir(prerequisites.result);
+
+	char *object = _artifact_path(prerequisites.result, ".o");
+	char *object_depfile = _artifact_path(prerequisites.result, ".d");
+
+	/* the objects have to exist before the manifest refers to them */
+	bool ok = _copy_file(output, object) &&
+			  (depfile == NULL || _copy_file(depfile, object_depfile));
+
+	XFREE(object);
+	XFREE(object_depfile);
+
+	if (ok) {
+		_make_subdir(key);
+		_update_manifest(key, prerequisites.entry);
+		stored++;
+	}
+
+exit:
+	XFREE(prerequisites.entry);
+}
+
+struct cached_file {
+	char *path;
+	uint64_t size;
+	struct timespec mtime;
+};
+
+int _compare_cached_files(const void *a, const void *b) {
+	const struct cached_file *file_a = a;
+	const struct cached_file *file_b = b;
+
+	if (file_a->mtime.tv_sec != file_b->mtime.tv_sec) {
+		return file_a->mtime.tv_sec < file_b->mtime.tv_sec ? -1 : 1;
+	}
+	if (file_a->mtime.tv_nsec != file_b->mtime.tv_nsec) {
+		return file_a->mtime.tv_nsec < file_b->mtime.tv_nsec ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Delete the least recently used files until the cache is smaller
+ * than EVICT_TARGET_PERCENT of its maximum size.
+ */
+void _evict(void) {
+	struct cached_file *files = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	uint64_t total = 0;
+
+	for (unsigned int sub = 0; sub < 256; sub++) {
+		size_t dir_size = strlen(cache_dir) + 4;
+		char *dir_path = XMALLOC(dir_size);
+		snprintf(dir_path, dir_size, "%s/%02x", cache_dir, sub);
+
+		DIR *dir = opendir(dir_path);
+		struct dirent *dirent;
+		while (dir != NULL && (dirent = readdir(dir)) != NULL) {
+			if (dirent->d_name[0] == '.') {
+				continue;
+			}
+
+			size_t path_size = dir_size + strlen(dirent->d_name) + 1;
+			char *path = XMALLOC(path_size);
+			snprintf(path, path_size, "%s/%s", dir_path, dirent->d_name);
+
+			struct stat st;
+			if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+				XFREE(path);
+				continue;
+			}
+
+			if (count == capacity) {
+				capacity = capacity == 0 ? 256 : capacity * 2;
+				files = XREALLOC(files, capacity * sizeof(*files));
+			}
+
+			files[count] = (struct cached_file){
+				.path = path,
+				.size = st.st_size,
+#ifdef __APPLE__
+				.mtime = st.st_mtimespec,
+#else
+				.mtime = st.st_mtim,
+#endif
+			};
+			total += files[count].size;
+			count++;
+		}
+
+		if (dir != NULL) {
+			closedir(dir);
+		}
+		XFREE(dir_path);
+	}
+
+	if (total > cache_max_size) {
+		uint64_t target = cache_max_size / 100 * EVICT_TARGET_PERCENT;
+		size_t evicted = 0;
+
+		qsort(files, count, sizeof(*files), _compare_cached_files);
+		for (size_t ix = 0; ix < count && total > target; ix++) {
+			if (unlink(files[ix].path) == 0) {
+				total -= files[ix].size;
+				evicted++;
+			}
+		}
+
+		mb_logf(
+			LOG_DEBUG, "evicted %zu files from the artifact cache\n", evicted);
+	}
+
+	for (size_t ix = 0; ix < count; ix++) {
+		XFREE(files[ix].path);
+	}
+	if (files != NULL) {
+		XFREE(files);
+	}
+}
+
+void mb_artifacts_close(void) {
+	if (cache_dir == NULL) {
+		return;
+	}
+
+	if (hits + misses > 0) {
+		mb_logf(
+			LOG_INFO, "artifact cache: %zu hits, %zu misses, %zu stored\n",
+			hits, misses, stored);
+	}
+
+	if (stored > 0) {
+		_evict();
+	}
+
+	XFREE(cache_dir);
+	cache_dir = NULL;
+	hits = 0;
+	misses = 0;
+	stored = 0;
+}
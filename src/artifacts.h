@@ -0,0 +1,55 @@
+/* artifacts.h ; mariebuild local artifact cache header
+ *
+ * The artifact cache keeps the outputs of singular c_rule elements, keyed by
+ * the hash of their command, the contents of their input and the contents
+ * of the prerequisites listed in their depfile. Since the prerequisites are
+ * only known after an element was built, every key of command and input
+ * has a manifest listing the sets of prerequisites it was stored with.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef ARTIFACTS_H
+#define ARTIFACTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ARTIFACTS_DEFAULT_SIZE_MIB 1024
+
+/**
+ * @brief Use the cache within the given directory, creating it if needed.
+ * @param max_size Size in bytes the cache is trimmed to when it is closed.
+ * @return Whether the cache can be used.
+ */
+bool mb_artifacts_open(const char *dir, uint64_t max_size);
+
+/**
+ * @brief Report the hits and misses of this run and evict the least recently
+ * used artifacts if the cache grew beyond its size.
+ */
+void mb_artifacts_close(void);
+
+bool mb_artifacts_is_open(void);
+
+/**
+ * @brief The key of an element before its prerequisites are known.
+ */
+uint64_t mb_artifacts_key(uint64_t command_hash, uint64_t input_hash);
+
+/**
+ * @brief Restore the output and depfile of an element from the cache if
+ * they were stored with prerequisites whose contents are unchanged. Counts
+ * as a hit or a miss.
+ * @param depfile NULL if the element has no depfile.
+ * @return Whether the output was restored.
+ */
+bool mb_artifacts_restore(uint64_t key, const char *output, char *depfile);
+
+/**
+ * @brief Store the output and depfile of an element which was just built.
+ */
+void mb_artifacts_store(uint64_t key, const char *output, char *depfile);
+
+#endif /* #ifndef ARTIFACTS_H */
@@ -6,14 +6,25 @@
 
 #include <stdlib.h>
 
+#include "artifacts.h"
 #include "build.h"
+#include "buildlog.h"
 #include "cptrlist.h"
+#include "filecache.h"
+#include "flight.h"
+#include "fileindex.h"
+#include "inputglob.h"
+#include "stats.h"
+#include "summary.h"
+#include "trace.h"
+#include "graph.h"
+#include "jobs.h"
 #include "logging.h"
 #include "mcfg.h"
 #include "mcfg_util.h"
 #include "stringutil.h"
-#include "target.h"
 #include "types.h"
+#include "workers.h"
 #include "xmem.h"
 
 config_t default_config = {
@@ -23,6 +34,12 @@ config_t default_config = {
 	.public_targets = {.capacity = 0},
 	.always_force = false,
 	.ignore_failures = false,
+	.build_log = BUILD_LOG_DEFAULT_PATH,
+	.cache_dir = NULL,
+	.cache_size = (uint64_t)ARTIFACTS_DEFAULT_SIZE_MIB << 20,
+	.glob_cache = GLOB_CACHE_DEFAULT_PATH,
+	.flight_log = FLIGHT_DEFAULT_PATH,
+	.file_cache = true,
 };
 
 bool check_file_validity(mcfg_file_t file) {
@@ -31,7 +48,7 @@ bool check_file_validity(mcfg_file_t file) {
 		return false;
 	}
 
-	if (mcfg_get_sector(&file, "targets") == NULL) {
+	if (mb_get_sector(&file, "targets") == NULL) {
 		mb_log(LOG_ERROR, "no targets defined!\n");
 		return false;
 	}
@@ -43,17 +60,17 @@ config_t mb_load_configuration(mcfg_file_t file, args_t args) {
 	config_t fallback = default_config;
 	config_t ret;
 
-	mcfg_sector_t *sector = mcfg_get_sector(&file, "config");
+	mcfg_sector_t *sector = mb_get_sector(&file, "config");
 	if (sector == NULL) {
 		return fallback;
 	}
 
-	mcfg_section_t *config = mcfg_get_section(sector, "mariebuild");
+	mcfg_section_t *config = mb_get_section(sector, "mariebuild");
 	if (config == NULL) {
 		return fallback;
 	}
 
-	mcfg_field_t *field_targets = mcfg_get_field(config, "targets");
+	mcfg_field_t *field_targets = mb_get_field(config, "targets");
 	if (field_targets != NULL) {
 		mcfg_list_t targets = *mcfg_data_as_list(*field_targets);
 		cptrlist_init(&ret.public_targets, 8, 8);
@@ -78,14 +95,14 @@ config_t mb_load_configuration(mcfg_file_t file, args_t args) {
 		ret.public_targets = fallback.public_targets;
 	}
 
-	mcfg_field_t *field_default_target = mcfg_get_field(config, "default");
+	mcfg_field_t *field_default_target = mb_get_field(config, "default");
 	if (field_default_target != NULL) {
 		ret.default_target = mcfg_data_as_string(*field_default_target);
 	} else {
 		ret.default_target = fallback.default_target;
 	}
 
-	mcfg_field_t *field_build_type = mcfg_get_field(config, "build_type");
+	mcfg_field_t *field_build_type = mb_get_field(config, "build_type");
 	if (field_build_type != NULL) {
 		ret.build_type = str_to_build_type(
 			mcfg_data_as_string(*field_build_type), fallback.build_type);
@@ -93,8 +110,63 @@ config_t mb_load_configuration(mcfg_file_t file, args_t args) {
 		ret.build_type = fallback.build_type;
 	}
 
+	mcfg_field_t *field_build_log = mb_get_field(config, "build_log");
+	if (field_build_log != NULL) {
+		ret.build_log = mcfg_data_as_string(*field_build_log);
+		if (ret.build_log != NULL && ret.build_log[0] == '\0') {
+			ret.build_log = NULL;
+		}
+	} else {
+		ret.build_log = fallback.build_log;
+	}
+
+	mcfg_field_t *field_cache_dir = mb_get_field(config, "cache_dir");
+	if (field_cache_dir != NULL) {
+		ret.cache_dir = mcfg_data_as_string(*field_cache_dir);
+		if (ret.cache_dir != NULL && ret.cache_dir[0] == '\0') {
+			ret.cache_dir = NULL;
+		}
+	} else {
+		ret.cache_dir = fallback.cache_dir;
+	}
+
+	mcfg_field_t *field_cache_size = mb_get_field(config, "cache_size");
+	if (field_cache_size != NULL) {
+		/* given in MiB */
+		ret.cache_size = (uint64_t)mcfg_data_as_int(*field_cache_size) << 20;
+	} else {
+		ret.cache_size = fallback.cache_size;
+	}
+
+	mcfg_field_t *field_glob_cache = mb_get_field(config, "glob_cache");
+	if (field_glob_cache != NULL) {
+		ret.glob_cache = mcfg_data_as_string(*field_glob_cache);
+		if (ret.glob_cache != NULL && ret.glob_cache[0] == '\0') {
+			ret.glob_cache = NULL;
+		}
+	} else {
+		ret.glob_cache = fallback.glob_cache;
+	}
+
+	mcfg_field_t *field_flight_log = mb_get_field(config, "flight_log");
+	if (field_flight_log != NULL) {
+		ret.flight_log = mcfg_data_as_string(*field_flight_log);
+		if (ret.flight_log != NULL && ret.flight_log[0] == '\0') {
+			ret.flight_log = NULL;
+		}
+	} else {
+		ret.flight_log = fallback.flight_log;
+	}
+
+	mcfg_field_t *field_file_cache = mb_get_field(config, "file_cache");
+	if (field_file_cache != NULL) {
+		ret.file_cache = mcfg_data_as_bool(*field_file_cache);
+	} else {
+		ret.file_cache = fallback.file_cache;
+	}
+
 	mcfg_field_t *field_default_log_level =
-		mcfg_get_field(config, "default_log_level");
+		mb_get_field(config, "default_log_level");
 	if (field_default_log_level != NULL && !args.verbosity_overriden) {
 		log_level_t wanted_log_level =
 			mcfg_data_as_int(*field_default_log_level);
@@ -118,8 +190,18 @@ int mb_start(args_t args) {
 	cptrlist_append(&default_config.public_targets, strdup("debug"));
 
 	mb_log(LOG_DEBUG, "using MCFG/2 " MCFG_2_VERSION "\n");
-
-	mcfg_parse_result_t parse_result = mcfg_parse_from_file(args.buildfile);
+	mb_summary_init(args.summary, args.summary_json, args.summary_slowest);
+
+	bool cached;
+	uint64_t parse_start = mb_trace_now();
+	mcfg_parse_result_t parse_result =
+		mb_file_cache_load(args.buildfile, &cached);
+
+	trace_arg_t trace_args[] = {
+		TRACE_STR("file", args.buildfile),
+		TRACE_NUM("cached", cached),
+	};
+	mb_trace_span("build", "parse", parse_start, trace_args, 2);
 	if (parse_result.err != MCFG_OK) {
 		mb_logf(
 			LOG_ERROR, "buildfile parsing failed: %s (%d)\n",
@@ -137,31 +219,75 @@ int mb_start(args_t args) {
 		return 1;
 	}
 
+	uint64_t configure_start = mb_trace_now();
+	mb_index_build(&file);
+
 	config_t cfg = mb_load_configuration(file, args);
+	if (!cfg.file_cache) {
+		mb_file_cache_remove(args.buildfile);
+	} else if (!cached) {
+		mb_file_cache_store(args.buildfile, &file);
+	}
+
 	cfg.target = args.target == NULL ? cfg.default_target : args.target;
 	cfg.ignore_failures = args.keep_going;
 	cfg.always_force = args.force;
 
+	mb_flight_open(cfg.flight_log);
+	mb_jobs_init(
+		args.jobs, args.quiet ? JOB_OUTPUT_QUIET : JOB_OUTPUT_BUFFERED);
+	mb_workers_init(mb_workers_default_count());
+	if (cfg.build_log != NULL) {
+		mb_build_log_open(cfg.build_log);
+	}
+	if (cfg.cache_dir != NULL) {
+		mb_artifacts_open(cfg.cache_dir, cfg.cache_size);
+	}
+	if (cfg.glob_cache != NULL) {
+		mb_glob_open(cfg.glob_cache);
+	}
+	mb_trace_span("build", "configure", configure_start, NULL, 0);
+
 	int return_code = mb_begin_build(&file, cfg);
 	if (return_code != 0) {
 		mb_log(LOG_ERROR, "build failed!\n");
+		if (mb_flight_dump("build failed")) {
+			mb_logf(
+				LOG_INFO, "wrote the last scheduler events to \"%s\"\n",
+				mb_flight_path());
+		}
 	} else {
 		mb_log(LOG_INFO, "build succeeded!\n");
 	}
 
+	/* node names point into the file */
+	mb_summary_finish(return_code);
+	if (args.stats) {
+		mb_stats_print();
+	}
+
+	uint64_t finish_start = mb_trace_now();
+	mb_glob_close();
+	mb_artifacts_close();
+	mb_build_log_close();
+	mb_workers_destroy();
+	mb_jobs_destroy();
+	mb_flight_close();
 	cptrlist_destroy(&cfg.public_targets);
-	mcfg_free_file(file);
+	mb_index_destroy();
+	mb_file_cache_free(file);
+	mb_trace_span("build", "finish", finish_start, NULL, 0);
 	return return_code;
 }
 
 int mb_begin_build(mcfg_file_t *file, config_t cfg) {
-	mcfg_sector_t *targets = mcfg_get_sector(file, "targets");
+	mcfg_sector_t *targets = mb_get_sector(file, "targets");
 	if (targets == NULL || targets->section_count == 0) {
 		mb_log(LOG_ERROR, "build file is missing target definitions!\n");
 		return 1;
 	}
 
-	mcfg_section_t *target = mcfg_get_section(targets, cfg.target);
+	mcfg_section_t *target = mb_get_section(targets, cfg.target);
 
 	if (target == NULL) {
 		mb_logf(
@@ -170,10 +296,20 @@ int mb_begin_build(mcfg_file_t *file, config_t cfg) {
 		return 1;
 	}
 
-	CPtrList history;
-	cptrlist_init(&history, 1, 4);
-	int ret = mb_run_target(file, target, &history, cfg);
-	cptrlist_destroy(&history);
+	build_graph_t graph;
+	uint64_t graph_start = mb_trace_now();
+	int ret = mb_graph_build(&graph, file, target, cfg);
+	mb_trace_span("build", "build graph", graph_start, NULL, 0);
+	if (ret < 0) {
+		mb_graph_destroy(&graph);
+		return 1;
+	}
+
+	uint64_t run_start = mb_trace_now();
+	int run_ret = mb_graph_run(&graph);
+	mb_trace_span("build", "run graph", run_start, NULL, 0);
+	ret = ret > run_ret ? ret : run_ret;
 
+	mb_graph_destroy(&graph);
 	return ret;
 }
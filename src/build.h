@@ -17,8 +17,15 @@ typedef struct args {
 	bool force;
 	bool no_splash;
 	bool keep_going; /* they're hot on your heels! */
+	size_t jobs; /* 0 = amount of online CPUs */
 	log_level_t verbosity;
 	bool verbosity_overriden; /* helper flag for verbosity */
+	char *trace; /* NULL = no trace */
+	bool summary;
+	size_t summary_slowest;
+	char *summary_json; /* NULL = no JSON summary */
+	bool stats;
+	bool quiet;
 } args_t;
 
 int mb_start(args_t args);
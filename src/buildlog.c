@@ -0,0 +1,739 @@
+/* buildlog.c ; mariebuild persistent build log impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "buildlog.h"
+#include "hash.h"
+#include "ioutil.h"
+#include "logging.h"
+#include "stats.h"
+#include "stringutil.h"
+#include "xmem.h"
+
+#define BUILD_LOG_MAGIC "MBLOG\0\0"
+#define BUILD_LOG_VERSION 3
+
+/* rewrite the log once superseded records make up most of it */
+#define BUILD_LOG_COMPACT_MIN_RECORDS 1024
+#define BUILD_LOG_COMPACT_RATIO 3
+
+/* 10ms, longer than a timer tick */
+#define MTIME_CLOCK_SLACK_NS 10000000LL
+
+#define PAD8(x) (((x) + 7) & ~(size_t)7)
+
+typedef struct build_log_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+} build_log_header_t;
+
+static char *log_path = NULL;
+static int log_fd = -1;
+
+static uint8_t *map = NULL;
+static size_t map_size = 0;
+
+/* records written by this run, the map only covers what was read */
+static build_log_record_t **appended = NULL;
+static size_t appended_count = 0;
+static size_t appended_capacity = 0;
+
+/* Guards the records appended and the index while the log is open, since
+ * elements are checked and recorded by worker threads as well. Records
+ * themselves are never changed once written.
+ */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* open addressing table of the latest record of each output */
+static const build_log_record_t **index_table = NULL;
+static size_t index_capacity = 0;
+static size_t index_count = 0;
+
+/* records in the file including superseded ones */
+static size_t record_count = 0;
+
+/* A hash of the contents of a file taken during this run, only used while
+ * the file's metadata is the same. A header listed in the depfiles of many
+ * elements is read once instead of once per element.
+ */
+typedef struct hash_memo {
+	char *path;
+	struct timespec mtime;
+	uint64_t size;
+	uint64_t inode;
+	uint64_t hash;
+} hash_memo_t;
+
+/* open addressing table of hash_memo_t by path, guarded by log_lock */
+static hash_memo_t *memo_table = NULL;
+static size_t memo_capacity = 0;
+static size_t memo_count = 0;
+
+bool mb_file_mtime(const char *path, struct timespec *mtime) {
+	MB_STAT_INC(STAT_STAT_CALLS);
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return false;
+	}
+
+#ifdef __APPLE__
+	*mtime = st.st_mtimespec;
+#else
+	*mtime = st.st_mtim;
+#endif
+	return true;
+}
+
+size_t _memo_slot(const char *path) {
+	size_t mask = memo_capacity - 1;
+	size_t pos = mb_hash_str(path) & mask;
+
+	while (memo_table[pos].path != NULL &&
+		   strcmp(memo_table[pos].path, path) != 0) {
+		pos = (pos + 1) & mask;
+	}
+
+	return pos;
+}
+
+void _memo_grow(void) {
+	hash_memo_t *old = memo_table;
+	size_t old_capacity = memo_capacity;
+
+	memo_capacity = memo_capacity == 0 ? 64 : memo_capacity * 2;
+	memo_table = XCALLOC(memo_capacity, sizeof(*memo_table));
+
+	for (size_t ix = 0; ix < old_capacity; ix++) {
+		if (old[ix].path != NULL) {
+			memo_table[_memo_slot(old[ix].path)] = old[ix];
+		}
+	}
+
+	if (old != NULL) {
+		XFREE(old);
+	}
+}
+
+/**
+ * @brief Hash the contents of a file whose metadata was just stat'ed into
+ * input. A hash taken earlier in this run is reused if the metadata did not
+ * change since.
+ * @return Whether the file could be read.
+ */
+bool _hash_input(
+	const char *path,
+	const build_log_input_t *input,
+	uint64_t *hash) {
+	bool found = false;
+
+	pthread_mutex_lock(&log_lock);
+	if (memo_capacity > 0) {
+		hash_memo_t *memo = &memo_table[_memo_slot(path)];
+		found = memo->path != NULL &&
+				memo->mtime.tv_sec == input->mtime.tv_sec &&
+				memo->mtime.tv_nsec == input->mtime.tv_nsec &&
+				memo->size == input->size && memo->inode == input->inode;
+		if (found) {
+			*hash = memo->hash;
+		}
+	}
+	pthread_mutex_unlock(&log_lock);
+
+	if (found) {
+		return true;
+	}
+
+	/* not under the lock, other threads keep checking their inputs */
+	if (!mb_hash_file(path, hash)) {
+		return false;
+	}
+
+	pthread_mutex_lock(&log_lock);
+	/* keep the table at most half full */
+	if ((memo_count + 1) * 2 > memo_capacity) {
+		_memo_grow();
+	}
+
+	hash_memo_t *memo = &memo_table[_memo_slot(path)];
+	if (memo->path == NULL) {
+		memo->path = strdup(path);
+		memo_count++;
+	}
+
+	memo->mtime = input->mtime;
+	memo->size = input->size;
+	memo->inode = input->inode;
+	memo->hash = *hash;
+	pthread_mutex_unlock(&log_lock);
+
+	return true;
+}
+
+bool mb_mtime_racy(struct timespec mtime, struct timespec time) {
+	/* filesystems with coarse timestamps truncate them */
+	if (mtime.tv_nsec == 0) {
+		return mtime.tv_sec >= time.tv_sec;
+	}
+
+	/* file times are taken from a clock which can lag behind by a tick */
+	int64_t mtime_ns = (int64_t)mtime.tv_sec * 1000000000LL + mtime.tv_nsec;
+	int64_t time_ns = (int64_t)time.tv_sec * 1000000000LL + time.tv_nsec;
+	return mtime_ns >= time_ns - MTIME_CLOCK_SLACK_NS;
+}
+
+bool mb_build_log_stat(
+	const char *path,
+	bool hashed,
+	build_log_input_t *input) {
+	char *input_path = input->path;
+	*input = (build_log_input_t){.path = input_path};
+
+	MB_STAT_INC(STAT_STAT_CALLS);
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return false;
+	}
+
+#ifdef __APPLE__
+	input->mtime = st.st_mtimespec;
+#else
+	input->mtime = st.st_mtim;
+#endif
+	input->size = st.st_size;
+	input->inode = st.st_ino;
+
+	if (hashed) {
+		input->hashed = _hash_input(path, input, &input->hash);
+	}
+
+	return true;
+}
+
+bool _mtime_equal(struct timespec mtime, int64_t sec, int64_t nsec) {
+	return mtime.tv_sec == sec && mtime.tv_nsec == nsec;
+}
+
+/**
+ * @brief Whether the metadata of an input is exactly what was recorded. The
+ * inode is only compared for hashed checks, which can fall back to the
+ * contents; outputs rewritten by restat rules keep their mtime but not
+ * necessarily their inode.
+ */
+bool _input_unchanged(
+	const build_log_input_t *input,
+	const build_log_input_record_t *recorded,
+	bool hashed) {
+	return _mtime_equal(
+			   input->mtime, recorded->mtime_sec, recorded->mtime_nsec) &&
+		   input->size == recorded->size &&
+		   (!hashed || input->inode == recorded->inode);
+}
+
+const char *mb_build_log_output(const build_log_record_t *record) {
+	return (const char *)(record + 1);
+}
+
+bool mb_build_log_next_input(
+	const build_log_record_t *record,
+	const uint8_t **pos,
+	const build_log_input_record_t **input,
+	const char **path) {
+	const uint8_t *end = (const uint8_t *)record + record->size;
+
+	if (*pos == NULL) {
+		*pos = (const uint8_t *)(record + 1) +
+			   PAD8(record->output_length + 1);
+	}
+
+	if (*pos + sizeof(build_log_input_record_t) > end) {
+		return false;
+	}
+
+	*input = (const build_log_input_record_t *)*pos;
+	*path = (const char *)(*input + 1);
+
+	*pos += sizeof(**input) + PAD8((*input)->path_length + 1);
+	return true;
+}
+
+/**
+ * @brief Check that a record read from disk lies within avail bytes and
+ * that all of its strings are terminated.
+ */
+bool _record_valid(const build_log_record_t *record, size_t avail) {
+	if (avail < sizeof(*record) || record->size < sizeof(*record) ||
+		record->size > avail || record->size % 8 != 0) {
+		return false;
+	}
+
+	const uint8_t *pos = (const uint8_t *)(record + 1);
+	const uint8_t *end = (const uint8_t *)record + record->size;
+
+	if ((size_t)(end - pos) < PAD8((size_t)record->output_length + 1) ||
+		pos[record->output_length] != '\0') {
+		return false;
+	}
+
+	pos += PAD8((size_t)record->output_length + 1);
+
+	for (uint32_t ix = 0; ix < record->input_count; ix++) {
+		if ((size_t)(end - pos) < sizeof(build_log_input_record_t)) {
+			return false;
+		}
+
+		const build_log_input_record_t *input =
+			(const build_log_input_record_t *)pos;
+		pos += sizeof(*input);
+
+		if ((size_t)(end - pos) < PAD8((size_t)input->path_length + 1) ||
+			pos[input->path_length] != '\0') {
+			return false;
+		}
+
+		pos += PAD8((size_t)input->path_length + 1);
+	}
+
+	return pos == end;
+}
+
+void _index_insert(const build_log_record_t *record);
+
+void _index_grow(void) {
+	const build_log_record_t **old = index_table;
+	size_t old_capacity = index_capacity;
+
+	index_capacity = index_capacity == 0 ? 64 : index_capacity * 2;
+	index_table = XCALLOC(index_capacity, sizeof(*index_table));
+	index_count = 0;
+
+	for (size_t ix = 0; ix < old_capacity; ix++) {
+		if (old[ix] != NULL) {
+			_index_insert(old[ix]);
+		}
+	}
+
+	if (old != NULL) {
+		XFREE(old);
+	}
+}
+
+size_t _index_slot(const char *output) {
+	size_t mask = index_capacity - 1;
+	size_t pos = mb_hash_str(output) & mask;
+
+	while (index_table[pos] != NULL &&
+		   strcmp(mb_build_log_output(index_table[pos]), output) != 0) {
+		pos = (pos + 1) & mask;
+	}
+
+	return pos;
+}
+
+/**
+ * @brief Make the record the latest one of its output.
+ */
+void _index_insert(const build_log_record_t *record) {
+	/* keep the table at most half full */
+	if ((index_count + 1) * 2 > index_capacity) {
+		_index_grow();
+	}
+
+	size_t pos = _index_slot(mb_build_log_output(record));
+	if (index_table[pos] == NULL) {
+		index_count++;
+	}
+
+	index_table[pos] = record;
+}
+
+const build_log_record_t *mb_build_log_find(const char *output) {
+	/* the table is replaced when it grows */
+	pthread_mutex_lock(&log_lock);
+	const build_log_record_t *record =
+		index_table == NULL ? NULL : index_table[_index_slot(output)];
+	pthread_mutex_unlock(&log_lock);
+
+	return record;
+}
+
+bool mb_build_log_is_open(void) {
+	return log_fd >= 0;
+}
+
+bool _write_header(int fd) {
+	build_log_header_t header = {
+		.magic = BUILD_LOG_MAGIC,
+		.version = BUILD_LOG_VERSION,
+		.reserved = 0,
+	};
+
+	return mb_write_all(fd, &header, sizeof(header));
+}
+
+/**
+ * @brief Index every valid record of the mapped log.
+ * @return The size of the valid part of the log, 0 if it has to be started
+ * from scratch.
+ */
+size_t _load(void) {
+	const build_log_header_t *header = (const build_log_header_t *)map;
+	if (map_size < sizeof(*header) ||
+		memcmp(header->magic, BUILD_LOG_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != BUILD_LOG_VERSION) {
+		return 0;
+	}
+
+	size_t offset = sizeof(*header);
+	while (offset < map_size) {
+		const build_log_record_t *record =
+			(const build_log_record_t *)(map + offset);
+		if (!_record_valid(record, map_size - offset)) {
+			mb_logf(
+				LOG_DEBUG, "build log is truncated after %zu bytes\n", offset);
+			break;
+		}
+
+		_index_insert(record);
+		record_count++;
+		offset += record->size;
+	}
+
+	return offset;
+}
+
+bool mb_build_log_open(const char *path) {
+	log_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (log_fd < 0) {
+		mb_logf(
+			LOG_WARNING, "could not open build log \"%s\": %s\n", path,
+			strerror(errno));
+		return false;
+	}
+
+	log_path = strdup(path);
+
+	struct stat st;
+	if (fstat(log_fd, &st) != 0) {
+		mb_build_log_close();
+		return false;
+	}
+
+	size_t valid = 0;
+	if (st.st_size > 0) {
+		map_size = st.st_size;
+		map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, log_fd, 0);
+		if (map == MAP_FAILED) {
+			map = NULL;
+			map_size = 0;
+		} else {
+			valid = _load();
+		}
+	}
+
+	if (valid == 0) {
+		/* new or unusable, start over */
+		if (ftruncate(log_fd, 0) != 0 || !_write_header(log_fd)) {
+			mb_build_log_close();
+			return false;
+		}
+	} else if (valid < (size_t)st.st_size && ftruncate(log_fd, valid) != 0) {
+		mb_build_log_close();
+		return false;
+	}
+
+	mb_logf(
+		LOG_DEBUG, "build log has %zu records of %zu outputs\n", record_count,
+		index_count);
+	return true;
+}
+
+/**
+ * @brief Rewrite the log with only the latest record of every output.
+ */
+void _compact(void) {
+	size_t tmp_path_size = strlen(log_path) + 5;
+	char *tmp_path = XMALLOC(tmp_path_size);
+	snprintf(tmp_path, tmp_path_size, "%s.tmp", log_path);
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	bool ok = fd >= 0 && _write_header(fd);
+
+	for (size_t ix = 0; ok && ix < index_capacity; ix++) {
+		if (index_table[ix] != NULL) {
+			ok = mb_write_all(fd, index_table[ix], index_table[ix]->size);
+		}
+	}
+
+	if (fd >= 0) {
+		ok = close(fd) == 0 && ok;
+	}
+
+	if (ok && rename(tmp_path, log_path) == 0) {
+		mb_logf(
+			LOG_DEBUG, "compacted build log from %zu to %zu records\n",
+			record_count, index_count);
+	} else {
+		unlink(tmp_path);
+	}
+
+	XFREE(tmp_path);
+}
+
+void mb_build_log_close(void) {
+	if (log_fd >= 0 && index_count >= BUILD_LOG_COMPACT_MIN_RECORDS &&
+		record_count > index_count * BUILD_LOG_COMPACT_RATIO) {
+		_compact();
+	}
+
+	if (index_table != NULL) {
+		XFREE(index_table);
+		index_table = NULL;
+	}
+	index_capacity = 0;
+	index_count = 0;
+	record_count = 0;
+
+	for (size_t ix = 0; ix < memo_capacity; ix++) {
+		if (memo_table[ix].path != NULL) {
+			XFREE(memo_table[ix].path);
+		}
+	}
+	if (memo_table != NULL) {
+		XFREE(memo_table);
+		memo_table = NULL;
+	}
+	memo_capacity = 0;
+	memo_count = 0;
+
+	for (size_t ix = 0; ix < appended_count; ix++) {
+		XFREE(appended[ix]);
+	}
+	if (appended != NULL) {
+		XFREE(appended);
+		appended = NULL;
+	}
+	appended_count = 0;
+	appended_capacity = 0;
+
+	if (map != NULL) {
+		munmap(map, map_size);
+		map = NULL;
+		map_size = 0;
+	}
+
+	if (log_fd >= 0) {
+		close(log_fd);
+		log_fd = -1;
+	}
+
+	if (log_path != NULL) {
+		XFREE(log_path);
+		log_path = NULL;
+	}
+}
+
+/**
+ * @brief Append a record equal to the given one but with the current
+ * metadata of its inputs, whose contents are known to be unchanged.
+ */
+void _refresh(const char *output, const build_log_record_t *record) {
+	build_log_input_t *inputs =
+		XCALLOC(record->input_count, sizeof(*inputs));
+	size_t count = 0;
+
+	const uint8_t *pos = NULL;
+	const build_log_input_record_t *recorded;
+	const char *path;
+
+	while (mb_build_log_next_input(record, &pos, &recorded, &path)) {
+		build_log_input_t *input = &inputs[count++];
+		mb_build_log_stat(path, false, input);
+		/* the record outlives the new one being written */
+		input->path = (char *)path;
+		input->hash = recorded->hash;
+		input->hashed = (recorded->flags & BUILD_LOG_INPUT_HASHED) != 0;
+	}
+
+	mb_build_log_record(
+		output, record->command_hash, record->duration_ns, record->flags,
+		inputs, count);
+
+	XFREE(inputs);
+}
+
+build_log_state_t mb_build_log_check(
+	const char *output,
+	const char *input,
+	uint64_t command_hash,
+	bool hashed) {
+	const build_log_record_t *record = mb_build_log_find(output);
+	if (record == NULL || record->input_count == 0) {
+		return BUILD_LOG_UNKNOWN;
+	}
+
+	if (record->flags & BUILD_LOG_DIRTY) {
+		return BUILD_LOG_OUTDATED;
+	}
+
+	if (record->command_hash != command_hash) {
+		mb_logf(LOG_DEBUG, "command of \"%s\" changed\n", output);
+		return BUILD_LOG_OUTDATED;
+	}
+
+	struct timespec mtime;
+	if (!mb_file_mtime(output, &mtime)) {
+		return BUILD_LOG_OUTDATED;
+	}
+
+	/* the output was touched by something else */
+	if (!_mtime_equal(
+			mtime, record->output_mtime_sec, record->output_mtime_nsec)) {
+		return BUILD_LOG_UNKNOWN;
+	}
+
+	const uint8_t *pos = NULL;
+	const build_log_input_record_t *recorded;
+	const char *path;
+	bool first = true;
+	bool refresh = false;
+
+	while (mb_build_log_next_input(record, &pos, &recorded, &path)) {
+		if (first && strcmp(path, input) != 0) {
+			return BUILD_LOG_UNKNOWN;
+		}
+		first = false;
+
+		build_log_input_t current = {0};
+		if (!mb_build_log_stat(path, false, &current)) {
+			return BUILD_LOG_OUTDATED;
+		}
+
+		if (_input_unchanged(&current, recorded, hashed)) {
+			continue;
+		}
+
+		if (!hashed || (recorded->flags & BUILD_LOG_INPUT_HASHED) == 0 ||
+			current.size != recorded->size) {
+			return BUILD_LOG_OUTDATED;
+		}
+
+		uint64_t hash;
+		if (!_hash_input(path, &current, &hash) || hash != recorded->hash) {
+			return BUILD_LOG_OUTDATED;
+		}
+
+		mb_logf(LOG_DEBUG, "contents of \"%s\" did not change\n", path);
+		refresh = true;
+	}
+
+	/* so that the next check can take the fast path again */
+	if (refresh) {
+		_refresh(output, record);
+	}
+
+	return BUILD_LOG_CLEAN;
+}
+
+void mb_build_log_record(
+	const char *output,
+	uint64_t command_hash,
+	uint64_t duration_ns,
+	uint32_t flags,
+	const build_log_input_t *inputs,
+	size_t input_count) {
+	if (log_fd < 0) {
+		return;
+	}
+
+	struct timespec output_mtime = {0};
+	if (!mb_file_mtime(output, &output_mtime)) {
+		flags |= BUILD_LOG_DIRTY;
+	}
+
+	size_t output_length = strlen(output);
+	size_t size = sizeof(build_log_record_t) + PAD8(output_length + 1);
+	for (size_t ix = 0; ix < input_count; ix++) {
+		size += sizeof(build_log_input_record_t) +
+				PAD8(strlen(inputs[ix].path) + 1);
+	}
+
+	/* zeroed so that the padding is deterministic */
+	uint8_t *buffer = XCALLOC(1, size);
+	build_log_record_t *record = (build_log_record_t *)buffer;
+	*record = (build_log_record_t){
+		.size = size,
+		.flags = flags,
+		.command_hash = command_hash,
+		.duration_ns = duration_ns,
+		.output_mtime_sec = output_mtime.tv_sec,
+		.output_mtime_nsec = output_mtime.tv_nsec,
+		.output_length = output_length,
+		.input_count = input_count,
+	};
+
+	uint8_t *pos = (uint8_t *)(record + 1);
+	memcpy(pos, output, output_length);
+	pos += PAD8(output_length + 1);
+
+	for (size_t ix = 0; ix < input_count; ix++) {
+		size_t path_length = strlen(inputs[ix].path);
+		build_log_input_record_t *input = (build_log_input_record_t *)pos;
+		*input = (build_log_input_record_t){
+			.mtime_sec = inputs[ix].mtime.tv_sec,
+			.mtime_nsec = inputs[ix].mtime.tv_nsec,
+			.size = inputs[ix].size,
+			.inode = inputs[ix].inode,
+			.hash = inputs[ix].hashed ? inputs[ix].hash : 0,
+			.flags = inputs[ix].hashed ? BUILD_LOG_INPUT_HASHED : 0,
+			.path_length = path_length,
+		};
+
+		pos += sizeof(*input);
+		memcpy(pos, inputs[ix].path, path_length);
+		pos += PAD8(path_length + 1);
+	}
+
+	pthread_mutex_lock(&log_lock);
+
+	if (!mb_write_all(log_fd, buffer, size)) {
+		pthread_mutex_unlock(&log_lock);
+		mb_logf(
+			LOG_WARNING, "could not write to build log: %s\n",
+			strerror(errno));
+		XFREE(buffer);
+		return;
+	}
+
+	if (appended_count == appended_capacity) {
+		appended_capacity = appended_capacity == 0 ? 64 : appended_capacity * 2;
+		appended =
+			XREALLOC(appended, appended_capacity * sizeof(*appended));
+	}
+
+	appended[appended_count++] = record;
+	record_count++;
+	_index_insert(record);
+
+	pthread_mutex_unlock(&log_lock);
+}
@@ -0,0 +1,161 @@
+/* buildlog.h ; mariebuild persistent build log header
+ *
+ * The build log remembers for every output which inputs it was built from,
+ * their metadata and possibly the hash of their contents, the hash of the
+ * command and how long it took.
+ * It is an append-only file which is memory-mapped when mariebuild starts,
+ * later records of an output supersede earlier ones.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef BUILDLOG_H
+#define BUILDLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define BUILD_LOG_DEFAULT_PATH ".mb_log"
+
+/* the output has to be rebuilt, e.g. because its last job failed */
+#define BUILD_LOG_DIRTY 1
+
+/**
+ * @brief Layout of a record within the log file. It is followed by the
+ * terminated output path and input_count inputs, each of them padded to 8
+ * bytes.
+ */
+typedef struct build_log_record {
+	/* size of the whole record including what follows it */
+	uint32_t size;
+	uint32_t flags;
+	uint64_t command_hash;
+	uint64_t duration_ns;
+	int64_t output_mtime_sec;
+	int64_t output_mtime_nsec;
+	uint32_t output_length;
+	uint32_t input_count;
+} build_log_record_t;
+
+/* the hash of the input's contents was recorded */
+#define BUILD_LOG_INPUT_HASHED 1
+
+typedef struct build_log_input_record {
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t size;
+	uint64_t inode;
+	uint64_t hash;
+	uint32_t flags;
+	uint32_t path_length;
+} build_log_input_record_t;
+
+typedef struct build_log_input {
+	char *path;
+	struct timespec mtime;
+	uint64_t size;
+	uint64_t inode;
+	/* only valid if hashed is set */
+	uint64_t hash;
+	bool hashed;
+} build_log_input_t;
+
+typedef enum build_log_state {
+	/* there is no usable record, the output has to be checked on disk */
+	BUILD_LOG_UNKNOWN = 0,
+	BUILD_LOG_CLEAN,
+	BUILD_LOG_OUTDATED,
+} build_log_state_t;
+
+/**
+ * @brief Modification time of a file.
+ * @return Whether the file could be stat'ed.
+ */
+bool mb_file_mtime(const char *path, struct timespec *mtime);
+
+/**
+ * @brief Whether a file with the given modification time may have been
+ * changed at or after the given CLOCK_REALTIME time, e.g. while a job which
+ * read it was running.
+ */
+bool mb_mtime_racy(struct timespec mtime, struct timespec time);
+
+/**
+ * @brief Fill in everything but the path of an input from disk, hashing its
+ * contents if requested. Inputs which can not be stat'ed are zeroed.
+ * @return Whether the input exists.
+ */
+bool mb_build_log_stat(
+	const char *path,
+	bool hashed,
+	build_log_input_t *input);
+
+/**
+ * @brief Map the build log at the given path and index its records. A
+ * missing or invalid log is started from scratch.
+ * @return Whether the log can be used.
+ */
+bool mb_build_log_open(const char *path);
+
+/**
+ * @brief Close the log, rewriting it without superseded records first if
+ * they make up most of it.
+ */
+void mb_build_log_close(void);
+
+bool mb_build_log_is_open(void);
+
+/*
+ * Records may be looked up, checked and appended from any thread while the
+ * log is open.
+ */
+
+/**
+ * @brief The latest record of an output, NULL if there is none.
+ */
+const build_log_record_t *mb_build_log_find(const char *output);
+
+const char *mb_build_log_output(const build_log_record_t *record);
+
+/**
+ * @brief Iterate over the inputs of a record.
+ * @param pos Start with NULL, updated with every call.
+ * @return Whether there was another input.
+ */
+bool mb_build_log_next_input(
+	const build_log_record_t *record,
+	const uint8_t **pos,
+	const build_log_input_record_t **input,
+	const char **path);
+
+/**
+ * @brief Check an output against its record. It is clean if neither the
+ * output, its command nor any of its inputs changed since the record was
+ * written.
+ * @param input The primary input, which has to be the first one recorded.
+ * @param command_hash Hash of the command which would build the output.
+ * @param hashed Inputs whose metadata changed are still clean if their
+ * contents did not, their record is then refreshed.
+ */
+build_log_state_t mb_build_log_check(
+	const char *output,
+	const char *input,
+	uint64_t command_hash,
+	bool hashed);
+
+/**
+ * @brief Append a record for an output, its modification time is taken
+ * from disk.
+ */
+void mb_build_log_record(
+	const char *output,
+	uint64_t command_hash,
+	uint64_t duration_ns,
+	uint32_t flags,
+	const build_log_input_t *inputs,
+	size_t input_count);
+
+#endif /* #ifndef BUILDLOG_H */
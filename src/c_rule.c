@@ -5,24 +5,37 @@
  */
 
 #define _XOPEN_SOURCE 700
-#define _POSIX_C_SOURCE 2
+#define _POSIX_C_SOURCE 200809L
 
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 
+#include "artifacts.h"
+#include "buildlog.h"
 #include "c_rule.h"
-#include "executor.h"
+#include "depfile.h"
+#include "fileindex.h"
+#include "flight.h"
+#include "hash.h"
+#include "inputglob.h"
+#include "jobs.h"
 #include "logging.h"
 #include "mcfg.h"
 #include "mcfg_format.h"
 #include "mcfg_util.h"
+#include "probes.h"
+#include "stats.h"
+#include "timeutil.h"
+#include "trace.h"
 #include "types.h"
+#include "workers.h"
 #include "xmem.h"
 
 #define FMT_ERR_CHECK(fmt_res, tag)                                       \
@@ -36,127 +49,112 @@
 		}                                                                 \
 	} while (0)
 
-#define ADD_DYNFIELD(file, name)                                             \
-	do {                                                                     \
-		if (mcfg_get_dynfield(file, name) == NULL) {                         \
-			mcfg_err_t err =                                                 \
-				mcfg_add_dynfield(file, TYPE_STRING, strdup(name), NULL, 0); \
-			if (err != MCFG_OK) {                                            \
-				mb_logf(                                                     \
-					LOG_ERROR,                                               \
-					"[c_rule:%s] mcfg_add_dynfield failed: %s (%d)\n", name, \
-					mcfg_err_string(err), err);                              \
-				return 1;                                                    \
-			}                                                                \
-		}                                                                    \
+#define ADD_DYNFIELD(file, name)                                            \
+	do {                                                                    \
+		if (mb_get_dynfield(file, name) == NULL) {                          \
+			mcfg_field_t field = {strdup(name), TYPE_STRING, NULL, 0};      \
+			mcfg_err_t err = mb_dynfield_push(file, field);                 \
+			if (err != MCFG_OK) {                                           \
+				mb_logf(                                                    \
+					LOG_ERROR,                                              \
+					"[c_rule:%s] mb_dynfield_push failed: %s (%d)\n", name, \
+					mcfg_err_string(err), err);                             \
+				return 1;                                                   \
+			}                                                               \
+		}                                                                   \
 	} while (0)
 
-struct io_fields {
-	mcfg_field_t *input;
-	mcfg_field_t *output;
-};
-
-size_t _size_t_max(size_t a, size_t b) {
-	return a > b ? a : b;
-}
-
-void _append_char(char **dest, size_t wix, size_t *dest_size, char chr) {
-	if (dest == NULL || *dest == NULL) {
-		return;
-	}
-
-	if (wix >= *dest_size) {
-		size_t size_diff = wix - *dest_size + 1;
-		size_t new_size =
-			*dest_size +
-			_size_t_max(MCFG_EMBED_FORMAT_RESIZE_AMOUNT, size_diff);
-
-		*dest = XREALLOC(*dest, new_size);
-		*dest_size = new_size;
+/**
+ * @brief Non-returning variant of FMT_ERR_CHECK for loops which have to clean
+ * up before bailing out.
+ * @return Whether formatting succeeded.
+ */
+bool _fmt_ok(mcfg_fmt_res_t fmt_res, char *tag, int *ret) {
+	if (fmt_res.err == MCFG_FMT_OK) {
+		return true;
 	}
 
-	(*dest)[wix] = chr;
+	mb_logf(
+		LOG_ERROR, "[c_rule:%s] mcfg_format_field_embeds failed: %d\n", tag,
+		fmt_res.err);
+	*ret = fmt_res.err;
+	return false;
 }
 
-size_t _append_str(char **dest, size_t wix, size_t *dest_size, char *src) {
-	if (dest == NULL || *dest == NULL || src == NULL) {
-		return 0;
-	}
-
-	for (size_t ix = 0; ix < strlen(src); ix++) {
-		_append_char(dest, wix, dest_size, src[ix]);
-		wix++;
-	}
+struct io_fields {
+	mcfg_field_t *input;
+	mcfg_field_t *output;
+};
 
-	return wix;
+/**
+ * @brief Append to a string which is the last allocation of the arena, so
+ * that it grows in place.
+ * @param length The length of dest without its terminator, updated.
+ */
+void _append_str(
+	arena_t *arena,
+	char **dest,
+	size_t *length,
+	const char *src,
+	size_t src_length) {
+	size_t old_size = *dest == NULL ? 0 : *length + 1;
+	*dest = mb_arena_grow(arena, *dest, old_size, *length + src_length + 1);
+
+	memcpy(*dest + *length, src, src_length);
+	*length += src_length;
+	(*dest)[*length] = '\0';
 }
 
 bool is_file_newer(char *file1, char *file2) {
-	FILE *f_1 = fopen(file1, "r");
-	FILE *f_2 = fopen(file2, "r");
-
-	int f_1_mtime = 1;
-	int f_2_mtime = 0;
+	/* file1 counts as newer if either of them can not be stat'ed */
+	struct timespec f_1_mtime = {.tv_sec = 1};
+	struct timespec f_2_mtime = {0};
+	MB_STAT_INC(STAT_NEWER_CHECKS);
 
-	if (f_1 == NULL || f_2 == NULL) {
+	if (!mb_file_mtime(file1, &f_1_mtime) ||
+		!mb_file_mtime(file2, &f_2_mtime)) {
 		if (errno != ENOENT) {
 			mb_logf(
-				LOG_DEBUG,
-				"file opening for file %d failed: OS Error %d (%s)\n",
-				f_1 == NULL ? 1 : 2, errno, strerror(errno));
+				LOG_DEBUG, "stat for %s or %s failed: OS Error %d (%s)\n",
+				file1, file2, errno, strerror(errno));
 		}
 		goto exit;
 	}
 
-	int fd_1 = fileno(f_1);
-	int fd_2 = fileno(f_2);
-
-	struct stat f_1_stat;
-	if (fstat(fd_1, &f_1_stat) != 0) {
-		mb_logf(
-			LOG_ERROR, "%s/%s:%d: fstat for f_1 failed: OS Error %d (%s)\n",
-			__FILE__, __FUNCTION__, __LINE__, errno, strerror(errno));
-		goto exit;
-	}
-
-	struct stat f_2_stat;
-	if (fstat(fd_2, &f_2_stat) != 0) {
-		mb_logf(
-			LOG_ERROR, "%s/%s:%d: fstat for f_2 failed: OS Error %d (%s)\n",
-			__FILE__, __FUNCTION__, __LINE__, errno, strerror(errno));
-		goto exit;
-	}
-
-#ifdef __APPLE__
-	f_1_mtime = f_1_stat.st_mtimespec.tv_sec;
-	f_2_mtime = f_2_stat.st_mtimespec.tv_sec;
-#else
-	f_1_mtime = f_1_stat.st_mtim.tv_sec;
-	f_2_mtime = f_2_stat.st_mtim.tv_sec;
-#endif
-
 #ifdef LOG_TIMESTAMPS
-	fprintf(stderr, "%s: %d ; %s: %d\n", file1, f_1_mtime, file2, f_2_mtime);
+	fprintf(
+		stderr, "%s: %lld.%09ld ; %s: %lld.%09ld\n", file1,
+		(long long)f_1_mtime.tv_sec, f_1_mtime.tv_nsec, file2,
+		(long long)f_2_mtime.tv_sec, f_2_mtime.tv_nsec);
 #endif
 
-exit:
-	if (f_1 != NULL) {
-		fclose(f_1);
-	}
-	if (f_2 != NULL) {
-		fclose(f_2);
-	}
-
-	return f_1_mtime > f_2_mtime;
+exit:;
+	bool newer = f_1_mtime.tv_sec > f_2_mtime.tv_sec ||
+				 (f_1_mtime.tv_sec == f_2_mtime.tv_sec &&
+				  f_1_mtime.tv_nsec > f_2_mtime.tv_nsec);
+	MB_PROBE3(newer__check, file1, file2, newer);
+	return newer;
 }
 
 bool get_io_fields(
 	mcfg_file_t *file,
 	mcfg_section_t *rule,
 	struct io_fields *dest) {
-	mcfg_field_t *field_input = mcfg_get_field(rule, "input");
-	if (field_input == NULL) {
-		mcfg_field_t *field_input_src = mcfg_get_field(rule, "input_src");
+	mcfg_field_t *field_input = mb_get_field(rule, "input");
+	mcfg_field_t *field_input_glob = mb_get_field(rule, "input_glob");
+	if (field_input == NULL && field_input_glob != NULL) {
+		if (field_input_glob->type != TYPE_STRING ||
+			field_input_glob->data == NULL) {
+			mb_log(LOG_ERROR, "field \"input_glob\" is not of type str!\n");
+			return false;
+		}
+
+		field_input = mb_glob_expand(mcfg_data_as_string(*field_input_glob));
+		if (field_input == NULL) {
+			return false;
+		}
+	} else if (field_input == NULL) {
+		mcfg_field_t *field_input_src = mb_get_field(rule, "input_src");
 		if (field_input_src == NULL) {
 			mb_log(LOG_ERROR, "missing input element list!\n");
 			return false;
@@ -165,7 +163,7 @@ bool get_io_fields(
 		char *raw_path = mcfg_data_to_string(*field_input_src);
 		mcfg_path_t path = mcfg_parse_path(raw_path);
 
-		field_input = mcfg_get_field_by_path(file, path);
+		field_input = mb_get_field_by_path(file, path);
 
 		mcfg_free_path(path);
 		XFREE(raw_path);
@@ -189,9 +187,9 @@ bool get_io_fields(
 		return false;
 	}
 
-	mcfg_field_t *field_output = mcfg_get_field(rule, "output");
+	mcfg_field_t *field_output = mb_get_field(rule, "output");
 	if (field_output == NULL) {
-		mcfg_field_t *field_output_src = mcfg_get_field(rule, "input_src");
+		mcfg_field_t *field_output_src = mb_get_field(rule, "input_src");
 		if (field_output_src == NULL) {
 			field_output = field_input;
 			goto field_out_null_done;
@@ -200,7 +198,7 @@ bool get_io_fields(
 		char *raw_path = mcfg_data_to_string(*field_output_src);
 		mcfg_path_t path = mcfg_parse_path(raw_path);
 
-		field_output = mcfg_get_field_by_path(file, path);
+		field_output = mb_get_field_by_path(file, path);
 
 		mcfg_free_path(path);
 		XFREE(raw_path);
@@ -225,131 +223,141 @@ bool get_io_fields(
 	return true;
 }
 
-int mb_run_c_rules(
-	mcfg_file_t *file,
-	mcfg_field_t *field_required_c_rules,
-	int org_type,
-	char *org_name,
-	const config_t cfg) {
-	if (field_required_c_rules == NULL) {
-		return 0;
+build_type_t _get_build_type(mcfg_section_t *rule, build_type_t fallback) {
+	mcfg_field_t *field = mb_get_field(rule, "build_type");
+	if (field == NULL) {
+		return fallback;
 	}
 
-	mcfg_sector_t *c_rules = mcfg_get_sector(file, "c_rules");
-	if (c_rules == NULL || c_rules->section_count == 0) {
-		mb_log(LOG_ERROR, "No c_rules defined!\n");
-		return 1;
+	char *data = mcfg_data_to_string(*field);
+	build_type_t build_type = str_to_build_type(data, fallback);
+	XFREE(data);
+
+	return build_type;
+}
+
+exec_mode_t _get_exec_mode(mcfg_section_t *rule) {
+	mcfg_field_t *field = mb_get_field(rule, "exec_mode");
+	if (field == NULL) {
+		return EXEC_MODE_SINGULAR;
 	}
 
-	mcfg_list_t *required_c_rules = mcfg_data_as_list(*field_required_c_rules);
+	char *data = mcfg_data_to_string(*field);
+	exec_mode_t exec_mode = str_to_exec_mode(data, EXEC_MODE_SINGULAR);
+	XFREE(data);
 
-	int ret = 0;
+	return exec_mode;
+}
 
-	for (size_t ix = 0; ix < required_c_rules->field_count; ix++) {
-		char *curr_c_rule_name =
-			mcfg_data_to_string(required_c_rules->fields[ix]);
-		if (curr_c_rule_name == NULL) {
-			mb_logf(
-				LOG_WARNING, "%s/%s:%d: curr_c_rule_name is NULL!\n", __FILE__,
-				__FUNCTION__, __LINE__);
-			continue;
+/**
+ * @brief Set the job limit of a singular rule's group from its parallel and
+ * max_procs fields.
+ */
+int _prepare_parallel(c_rule_run_t *run) {
+	bool run_parallel = false;
+	/* jobs of this rule running at once, 0 = as many as the job pool allows */
+	size_t max_procs = 1;
+
+	mcfg_field_t *field_parallel = mb_get_field(run->rule, "parallel");
+	mcfg_field_t *field_max_procs = mb_get_field(run->rule, "max_procs");
+
+	if (field_parallel != NULL) {
+		if (field_parallel->type != TYPE_BOOL) {
+			mb_log(LOG_ERROR, "field \"parallel\" should be of type bool\n");
+			return 1;
 		}
 
-		mcfg_section_t *curr_c_rule =
-			mcfg_get_section(c_rules, curr_c_rule_name);
-		if (curr_c_rule == NULL) {
-			mb_logf(
-				LOG_ERROR,
-				"c_rule \"%s\" required by %s \"%s\" does not exist.\n",
-				curr_c_rule_name, org_type == TARGET ? "target" : "c_rule",
-				org_name);
-			XFREE(curr_c_rule_name);
-
-			ret = 1;
-			if (cfg.ignore_failures) {
-				continue;
+		run_parallel = mcfg_data_as_bool(*field_parallel);
+	}
+
+	if (run_parallel) {
+		max_procs = 0;
+
+		if (field_max_procs != NULL) {
+			if (field_max_procs->type != TYPE_U8) {
+				mb_log(
+					LOG_ERROR, "field \"max_procs\" should be of type u8\n");
+				return 1;
 			}
 
-			return ret;
+			max_procs = mcfg_data_as_u8(*field_max_procs);
 		}
 
-		int tmp_ret = mb_run_c_rule(file, curr_c_rule, cfg);
-		ret = ret > tmp_ret ? ret : tmp_ret;
-		XFREE(curr_c_rule_name);
+		mb_logf(
+			LOG_DEBUG, "running parallel with max procs of %zu\n", max_procs);
+	}
+
+	run->group->max_running = max_procs;
+	return 0;
+}
 
-		if (ret != 0 && !cfg.ignore_failures) {
-			return ret;
-		}
+int _compile_template(
+	c_rule_run_t *run,
+	template_t *template,
+	char *src,
+	char *tag) {
+	mcfg_fmt_err_t err =
+		mb_template_compile(template, src, run->file, run->pathrel);
+	if (err != MCFG_FMT_OK) {
+		mb_logf(
+			LOG_ERROR, "[c_rule:%s] template compilation failed: %d\n", tag,
+			err);
+		return 1;
 	}
 
-	return ret;
+	return 0;
 }
 
 /**
- * @brief helper function to find a position within an array of process_t
- * which can be reused for a new process. A position can be reused
- * if the associated process (via process.pid) has exited.
- * The script will be deleted from the system and the location string freed.
- *
- * @param max_procs The amount of processes in the processes_array.
- * @param process_ix Pointer to the output variable for the reusable slot.
- *
- * @return The exit code of the process which freed up the slot
+ * @brief Render one of the rule's templates.
+ * @return Whether rendering succeeded, otherwise ret is set.
  */
-int _find_process_slot(
-	const size_t max_procs,
-	const process_t *processes,
-	size_t *used_processes,
-	size_t *process_ix) {
-	bool found = false;
-	int exit_status = 0;
-
-	/* previously unused process slot */
-	for (size_t pix = 0; pix < max_procs; pix++) {
-		if (processes[pix].pid == 0) {
-			*process_ix = pix;
-			*used_processes += 1;
-			return 0;
-		}
-	}
-
-	/* wait for slot to free up */
-	while (!found) {
-		for (size_t pix = 0; pix < max_procs; pix++) {
-			int stat = 0;
-			if (waitpid(processes[pix].pid, &stat, WNOHANG) <= 0) {
-				continue;
-			}
-
-			found = true;
-			exit_status = WEXITSTATUS(stat);
-			if (exit_status != 0) {
-				break;
-			}
-
-			mb_remove_script(processes[pix].location);
-			XFREE(processes[pix].location);
-			*process_ix = pix;
-			break;
-		}
-	}
-
-	return exit_status;
+bool _render(
+	template_t *template,
+	const char *const *values,
+	char **rendered,
+	char *tag,
+	int *ret) {
+	mcfg_fmt_err_t err = mb_template_render(template, values, rendered);
+	return _fmt_ok((mcfg_fmt_res_t){.err = err}, tag, ret);
 }
 
-int run_singular(
+int mb_c_rule_prepare(
+	c_rule_run_t *run,
 	mcfg_file_t *file,
 	mcfg_section_t *rule,
 	const config_t cfg,
-	build_type_t build_type) {
-	mcfg_field_t *field_exec = mcfg_get_field(rule, "exec");
-	if (field_exec == NULL || field_exec->data == NULL) {
+	job_group_t *group) {
+	mb_job_group_init(group, rule->name, 1, cfg.ignore_failures);
+	group->buffer_output = true;
+
+	*run = (c_rule_run_t){
+		.file = file,
+		.rule = rule,
+		.cfg = cfg,
+		.build_type = _get_build_type(rule, cfg.build_type),
+		.exec_mode = _get_exec_mode(rule),
+		.group = group,
+
+		.pathrel =
+			{
+				.absolute = true,
+				.dynfield_path = false,
+
+				.sector = "c_rules",
+				.section = rule->name,
+				.field = "",
+			},
+	};
+
+	run->field_exec = mb_get_field(rule, "exec");
+	if (run->field_exec == NULL || run->field_exec->data == NULL) {
 		mb_log(LOG_ERROR, "c_rule missing field \"exec\"\n");
 		return 1;
 	}
 
-	mcfg_field_t *field_input_format = mcfg_get_field(rule, "input_format");
-	mcfg_field_t *field_output_format = mcfg_get_field(rule, "output_format");
+	mcfg_field_t *field_input_format = mb_get_field(rule, "input_format");
+	mcfg_field_t *field_output_format = mb_get_field(rule, "output_format");
 
 	if (field_input_format == NULL || field_output_format == NULL) {
 		mb_logf(
@@ -366,13 +374,13 @@ int run_singular(
 		return 1;
 	}
 
-	char *input_format = mcfg_data_as_string(*field_input_format);
-	char *output_format = mcfg_data_as_string(*field_output_format);
+	run->input_format = mcfg_data_as_string(*field_input_format);
+	run->output_format = mcfg_data_as_string(*field_output_format);
 
-	if (input_format == NULL || output_format == NULL) {
+	if (run->input_format == NULL || run->output_format == NULL) {
 		mb_logf(
 			LOG_ERROR, "field \"%s\" is missing data!\n",
-			input_format == NULL ? "input_format" : "output_format");
+			run->input_format == NULL ? "input_format" : "output_format");
 		return 1;
 	}
 
@@ -381,295 +389,864 @@ int run_singular(
 		return 1;
 	}
 
-	mcfg_list_t *list_input = mcfg_data_as_list(*io_fields.input);
-	mcfg_list_t *list_output = mcfg_data_as_list(*io_fields.output);
+	run->list_input = mcfg_data_as_list(*io_fields.input);
+	run->list_output = mcfg_data_as_list(*io_fields.output);
 
-	mcfg_path_t pathrel = {
-		.absolute = true,
-		.dynfield_path = false,
+	mcfg_field_t *field_depfile = mb_get_field(rule, "depfile");
+	if (field_depfile != NULL) {
+		if (field_depfile->type != TYPE_STRING) {
+			mb_log(
+				LOG_ERROR,
+				"invalid datatype for field \"depfile\"! Expected str\n");
+			return 1;
+		}
+
+		run->depfile_format = mcfg_data_as_string(*field_depfile);
+	}
 
-		.sector = "c_rules",
-		.section = rule->name,
-		.field = ""};
+	/* caching needs the build log to track elements until they are done */
+	run->cache = mb_artifacts_is_open() && mb_build_log_is_open();
+	mcfg_field_t *field_cache = mb_get_field(rule, "cache");
+	if (field_cache != NULL) {
+		if (field_cache->type != TYPE_BOOL) {
+			mb_log(LOG_ERROR, "field \"cache\" should be of type bool\n");
+			return 1;
+		}
+
+		run->cache = run->cache && mcfg_data_as_bool(*field_cache);
+	}
+
+	mcfg_field_t *field_restat = mb_get_field(rule, "restat");
+	if (field_restat != NULL) {
+		if (field_restat->type != TYPE_BOOL) {
+			mb_log(LOG_ERROR, "field \"restat\" should be of type bool\n");
+			return 1;
+		}
+
+		/* without the build log, the restored mtimes would make the
+		 * outputs look outdated on every run */
+		run->restat =
+			mb_build_log_is_open() && mcfg_data_as_bool(*field_restat);
+	}
 
 	ADD_DYNFIELD(file, "element");
 	ADD_DYNFIELD(file, "input");
 	ADD_DYNFIELD(file, "output");
 
-	mcfg_field_t *dynfield_element = mcfg_get_dynfield(file, "element");
-	mcfg_field_t *dynfield_input = mcfg_get_dynfield(file, "input");
-	mcfg_field_t *dynfield_output = mcfg_get_dynfield(file, "output");
-
-	bool run_parallel = false;
-	size_t max_procs = 4; /* only important if run_parallel is true */
+	if (_compile_template(run, &run->input_template, run->input_format,
+						  "input_format") != 0) {
+		return 1;
+	}
 
-	mcfg_field_t *field_parallel = mcfg_get_field(rule, "parallel");
-	mcfg_field_t *field_max_procs = mcfg_get_field(rule, "max_procs");
+	if (run->exec_mode == EXEC_MODE_SINGULAR) {
+		if (_compile_template(
+				run, &run->output_template, run->output_format,
+				"output_format") != 0 ||
+			_compile_template(
+				run, &run->exec_template,
+				mcfg_data_as_string(*run->field_exec), "exec") != 0) {
+			return 1;
+		}
 
-	if (field_parallel != NULL) {
-		if (field_parallel->type != TYPE_BOOL) {
-			mb_log(LOG_ERROR, "field \"parallel\" should be of type bool\n");
+		if (run->depfile_format != NULL &&
+			_compile_template(
+				run, &run->depfile_template, run->depfile_format,
+				"depfile") != 0) {
 			return 1;
 		}
 
-		run_parallel = mcfg_data_as_bool(*field_parallel);
+		if (mb_build_log_is_open() && run->list_output->field_count > 0) {
+			run->elements = XCALLOC(
+				run->list_output->field_count, sizeof(*run->elements));
+		}
+
+		return _prepare_parallel(run);
 	}
 
-	if (field_max_procs != NULL && run_parallel) {
-		if (field_max_procs->type != TYPE_U8) {
-			mb_log(LOG_ERROR, "field \"max_procs\" should be of type u8\n");
-			return 1;
-		}
+	/* only needed for the command hash of the output's build log record */
+	if (mb_build_log_is_open() &&
+		_compile_template(
+			run, &run->exec_template, mcfg_data_as_string(*run->field_exec),
+			"exec") != 0) {
+		return 1;
+	}
+
+	return 0;
+}
 
-		max_procs = mcfg_data_as_u8(*field_max_procs);
+size_t mb_c_rule_element_count(const c_rule_run_t *run) {
+	if (run->exec_mode != EXEC_MODE_SINGULAR || run->list_output == NULL) {
+		return 0;
 	}
 
-	process_t *processes = NULL;
-	if (run_parallel) {
+	return run->list_output->field_count;
+}
+
+struct input_set {
+	size_t count;
+	size_t capacity;
+	build_log_input_t *items;
+	/* whether the contents of prerequisites are hashed */
+	bool hashed;
+	/* the items and their paths are allocated from it */
+	arena_t *arena;
+	/* CLOCK_REALTIME start of the job which read the prerequisites, NULL if
+	 * none ran */
+	const struct timespec *job_start;
+	/* whether a prerequisite was changed while the job ran */
+	bool racy;
+};
+
+void _input_set_add(struct input_set *set, const build_log_input_t *input) {
+	if (set->count == set->capacity) {
+		size_t old_size = set->capacity * sizeof(*set->items);
+		set->capacity = set->capacity == 0 ? 8 : set->capacity * 2;
+		set->items = mb_arena_grow(
+			set->arena, set->items, old_size,
+			set->capacity * sizeof(*set->items));
+	}
+
+	build_log_input_t *item = &set->items[set->count++];
+	*item = *input;
+	item->path = mb_arena_strdup(set->arena, input->path);
+}
+
+bool _collect_prerequisite(char *prerequisite, void *ctx) {
+	struct input_set *set = ctx;
+
+	/* compilers list the input itself as well */
+	if (strcmp(prerequisite, set->items[0].path) == 0) {
+		return true;
+	}
+
+	/* missing prerequisites are zeroed, which never matches */
+	build_log_input_t input = {.path = prerequisite};
+	if (mb_build_log_stat(prerequisite, set->hashed, &input) &&
+		set->job_start != NULL && mb_mtime_racy(input.mtime, *set->job_start)) {
 		mb_logf(
-			LOG_DEBUG, "running parallel with max procs of %d\n", max_procs);
-		processes = XCALLOC(max_procs, sizeof(*processes));
+			LOG_DEBUG, "\"%s\" changed while it was used\n", prerequisite);
+		set->racy = true;
 	}
 
-	/* reused for mcfg_format_field_embeds(_str) calls */
-	mcfg_fmt_res_t fmt_res;
+	_input_set_add(set, &input);
+	return true;
+}
 
-	int ret = 0;
-	size_t used_processes = 0;
+/**
+ * @brief Write the build log record of an element, the prerequisites listed
+ * in its depfile are inputs as well. The record is dirty if one of them
+ * changed after the job started, since the output may have been built from
+ * its previous contents.
+ * @param job_start Start of the job which built the output, NULL if none ran.
+ */
+void _record_element(
+	c_rule_run_t *run,
+	c_rule_element_t *element,
+	const struct timespec *job_start,
+	uint64_t duration_ns,
+	uint32_t flags) {
+	struct input_set inputs = {
+		.hashed = element->input.hashed,
+		.arena = &run->scratch,
+		.job_start = job_start,
+	};
+	_input_set_add(&inputs, &element->input);
+
+	if (element->depfile != NULL && (flags & BUILD_LOG_DIRTY) == 0 &&
+		(!mb_depfile_read(element->depfile, _collect_prerequisite, &inputs) ||
+		 inputs.racy)) {
+		flags |= BUILD_LOG_DIRTY;
+	}
 
-	for (size_t ix = 0; ix < list_output->field_count; ix++) {
-		size_t process_ix = used_processes;
+	mb_build_log_record(
+		element->output, element->command_hash, duration_ns, flags,
+		inputs.items, inputs.count);
 
-		char *raw_in = mcfg_data_to_string(list_input->fields[ix]);
-		char *raw_out = mcfg_data_to_string(list_output->fields[ix]);
+	mb_arena_reset(&run->scratch);
+}
 
-		dynfield_element->data = raw_in;
-		dynfield_element->size = strlen(raw_in) + 1;
+/**
+ * @brief Compute the artifact cache key of an element from its command and
+ * the contents of its input.
+ * @return Whether the element can be cached.
+ */
+bool _cache_key(c_rule_element_t *element) {
+	uint64_t input_hash = element->input.hash;
+	if (!element->input.hashed &&
+		!mb_hash_file(element->input.path, &input_hash)) {
+		return false;
+	}
 
-		fmt_res = mcfg_format_field_embeds_str(input_format, *file, pathrel);
-		FMT_ERR_CHECK(fmt_res, "singular_input_format");
+	element->cache_key = mb_artifacts_key(element->command_hash, input_hash);
+	element->cacheable = true;
+	return true;
+}
 
-		char *in = fmt_res.formatted;
+/**
+ * @brief Remember the contents and modification time of the output before
+ * the element is rebuilt.
+ */
+void _stat_output(c_rule_element_t *element) {
+	element->restat =
+		mb_file_mtime(element->output, &element->output_mtime) &&
+		mb_hash_file(element->output, &element->output_hash);
+}
 
-		dynfield_element->data = raw_out;
-		dynfield_element->size = strlen(raw_in) + 1;
+/**
+ * @brief Give an output which was rebuilt with unchanged contents its
+ * previous modification time back, so that its dependents do not consider
+ * it updated.
+ */
+void _restat_output(c_rule_element_t *element) {
+	uint64_t hash;
+	if (!element->restat || !mb_hash_file(element->output, &hash) ||
+		hash != element->output_hash) {
+		return;
+	}
 
-		fmt_res = mcfg_format_field_embeds_str(output_format, *file, pathrel);
-		FMT_ERR_CHECK(fmt_res, "singular_output_format");
+	struct timespec times[2] = {
+		{.tv_nsec = UTIME_OMIT},
+		element->output_mtime,
+	};
+	if (utimensat(AT_FDCWD, element->output, times, 0) == 0) {
+		mb_logf(LOG_DEBUG, "output \"%s\" did not change\n", element->output);
+	}
+}
 
-		char *out = fmt_res.formatted;
+/**
+ * @brief Mark an element as done, its strings are freed with the arena of
+ * its rule.
+ */
+void _free_element(c_rule_element_t *element) {
+	*element = (c_rule_element_t){0};
+}
 
-		if (build_type == BUILD_TYPE_INCREMENTAL && !is_file_newer(in, out) &&
-			!cfg.always_force) {
-			goto build_loop_continue;
-		}
+/**
+ * @brief Check whether an element has to be rebuilt. Outputs with a usable
+ * build log record are decided by it, including whether their command
+ * changed, others by their modification times and depfile. This may be
+ * called from any thread.
+ * @param depfile NULL if the rule has no depfile.
+ * @param command_hash Hash of the rendered exec script of the element.
+ * @param adopt Set to whether the element is up to date but has to be
+ * recorded, since there was no usable record.
+ */
+bool _element_outdated(
+	c_rule_run_t *run,
+	char *in,
+	char *out,
+	char *depfile,
+	uint64_t command_hash,
+	bool *adopt) {
+	*adopt = false;
+
+	if (run->build_type == BUILD_TYPE_FULL || run->cfg.always_force) {
+		return true;
+	}
 
-		dynfield_output->data = out;
-		dynfield_output->size = strlen(out) + 1;
-		dynfield_input->data = in;
-		dynfield_input->size = strlen(in) + 1;
+	build_log_state_t state =
+		run->elements != NULL
+			? mb_build_log_check(
+				  out, in, command_hash,
+				  run->build_type == BUILD_TYPE_HASHED)
+			: BUILD_LOG_UNKNOWN;
+	if (state != BUILD_LOG_UNKNOWN) {
+		return state == BUILD_LOG_OUTDATED;
+	}
 
-		fmt_res = mcfg_format_field_embeds(*field_exec, *file, pathrel);
-		FMT_ERR_CHECK(fmt_res, "singular_script_format");
+	if (is_file_newer(in, out)) {
+		return true;
+	}
 
-		char *script = fmt_res.formatted;
+	if (depfile != NULL && mb_depfile_outdated(depfile, out)) {
+		return true;
+	}
 
-		mb_logf(LOG_STEPS, "exec: %s > %s\n", in, out);
+	*adopt = run->elements != NULL;
+	return false;
+}
 
-		if (!run_parallel) {
-			int tmp_ret = mb_exec(script, rule->name);
-			ret = ret > tmp_ret ? ret : tmp_ret;
-		} else {
-			int exit_status = _find_process_slot(
-				max_procs, processes, &used_processes, &process_ix);
+/**
+ * @brief The value of a list element, string elements are not copied.
+ * @param copy Set to the value if it had to be copied, otherwise NULL.
+ */
+const char *_list_value(mcfg_list_t *list, size_t ix, char **copy) {
+	*copy = NULL;
+	if (list->type == TYPE_STRING && list->fields[ix].data != NULL) {
+		return list->fields[ix].data;
+	}
 
-			if (!cfg.ignore_failures && exit_status != 0) {
-				ret = exit_status;
-				goto build_loop_continue;
-			}
+	*copy = mcfg_data_to_string(list->fields[ix]);
+	return *copy;
+}
 
-			processes[process_ix] = mb_exec_parallel(script, rule->name);
-		}
+char *mb_c_rule_element_name(c_rule_run_t *run, ssize_t ix) {
+	if (run->list_input == NULL || ix < 0 ||
+		(size_t)ix >= run->list_input->field_count) {
+		return NULL;
+	}
 
-		XFREE(script);
-	build_loop_continue:
-		XFREE(raw_in);
-		XFREE(raw_out);
-		XFREE(in);
-		XFREE(out);
+	char *copy;
+	const char *name = _list_value(run->list_input, ix, &copy);
+	return copy != NULL ? copy : strdup(name);
+}
 
-		if (ret != 0 && !cfg.ignore_failures) {
-			break;
-		}
+/**
+ * @brief Render a string of an element into a buffer of the calling thread,
+ * or into the template's own buffer on the main thread.
+ */
+bool _render_string(
+	template_t *template,
+	const char *const *values,
+	render_buffer_t *buffers,
+	render_string_t string,
+	char **rendered,
+	char *tag,
+	int *ret) {
+	if (buffers == NULL) {
+		return _render(template, values, rendered, tag, ret);
 	}
 
-	/* We have to do this to avoid double-frees when running mcfg_free_file at
-	 * exit in build.c
-	 */
-	dynfield_element->data = NULL;
-	dynfield_input->data = NULL;
-	dynfield_output->data = NULL;
+	render_buffer_t *buffer = &buffers[string];
+	if (!mb_template_render_plain(
+			template, values, &buffer->data, &buffer->capacity)) {
+		return false;
+	}
+
+	*rendered = buffer->data;
+	return true;
+}
+
+/**
+ * @brief Render the strings of an element and check whether it is
+ * outdated.
+ * @param buffers RENDER_STRING_COUNT buffers owned by the calling thread,
+ * which are rendered into without mcfg. NULL on the main thread, which
+ * renders into the templates' own buffers and logs errors.
+ * @return 0 unless rendering failed on the main thread.
+ */
+int _render_strings(
+	c_rule_run_t *run,
+	size_t ix,
+	render_buffer_t *buffers,
+	c_rule_render_t *render) {
+	*render = (c_rule_render_t){0};
+	int ret = 0;
+	uint64_t format_start = mb_trace_now();
+
+	char *raw_in_copy;
+	char *raw_out_copy;
+	const char *raw_in = _list_value(run->list_input, ix, &raw_in_copy);
+	const char *raw_out = _list_value(run->list_output, ix, &raw_out_copy);
+
+	char *in;
+	char *out;
+	char *depfile = NULL;
+	char *script;
 
-	if (used_processes == 0) {
+	const char *values[TEMPLATE_SLOT_COUNT] = {
+		[TEMPLATE_SLOT_ELEMENT] = raw_in,
+	};
+
+	if (!_render_string(
+			&run->input_template, values, buffers, RENDER_STRING_IN, &in,
+			"singular_input_format", &ret)) {
 		goto exit;
 	}
 
-	/* cleanup remaining child processes */
-	for (size_t pix = 0; pix < max_procs; pix++) {
-		if (processes[pix].pid == 0 || processes[pix].location == NULL) {
-			continue;
+	values[TEMPLATE_SLOT_ELEMENT] = raw_out;
+	values[TEMPLATE_SLOT_INPUT] = in;
+
+	if (!_render_string(
+			&run->output_template, values, buffers, RENDER_STRING_OUT, &out,
+			"singular_output_format", &ret)) {
+		goto exit;
+	}
+
+	values[TEMPLATE_SLOT_OUTPUT] = out;
+
+	if (run->depfile_format != NULL &&
+		!_render_string(
+			&run->depfile_template, values, buffers, RENDER_STRING_DEPFILE,
+			&depfile, "singular_depfile_format", &ret)) {
+		goto exit;
+	}
+
+	/* rendered up front, a changed command makes the element outdated */
+	if (!_render_string(
+			&run->exec_template, values, buffers, RENDER_STRING_SCRIPT,
+			&script, "singular_script_format", &ret)) {
+		goto exit;
+	}
+
+	*render = (c_rule_render_t){
+		.rendered = true,
+		.in = in,
+		.out = out,
+		.depfile = depfile,
+		.script = script,
+		.command_hash = mb_hash_str(script),
+	};
+
+	trace_arg_t trace_args[] = {
+		TRACE_STR("rule", run->rule->name),
+		TRACE_STR("element", in),
+		TRACE_NUM("outdated", 0),
+	};
+	mb_trace_span("c_rule", "format", format_start, trace_args, 2);
+	uint64_t check_start = mb_trace_now();
+
+	render->outdated = _element_outdated(
+		run, in, out, depfile, render->command_hash, &render->adopt);
+	MB_PROBE3(element__check, run->rule->name, in, render->outdated);
+
+	flight_event_t event = FLIGHT_EVENT(FLIGHT_CHECK, run->rule->name);
+	event.element = ix;
+	event.status = render->outdated;
+	mb_flight_record(event);
+
+	if (run->elements != NULL && (render->outdated || render->adopt)) {
+		render->input.path = in;
+		mb_build_log_stat(
+			in, run->build_type == BUILD_TYPE_HASHED, &render->input);
+	}
+
+	trace_args[2].num = render->outdated;
+	mb_trace_span("c_rule", "check", check_start, trace_args, 3);
+
+exit:
+	if (raw_in_copy != NULL) {
+		XFREE(raw_in_copy);
+	}
+	if (raw_out_copy != NULL) {
+		XFREE(raw_out_copy);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Move the strings of a render out of the buffers of its thread.
+ */
+void _pack_render(c_rule_render_t *render) {
+	char **strings[RENDER_STRING_COUNT] = {
+		[RENDER_STRING_IN] = &render->in,
+		[RENDER_STRING_OUT] = &render->out,
+		[RENDER_STRING_DEPFILE] = &render->depfile,
+		[RENDER_STRING_SCRIPT] = &render->script,
+	};
+
+	size_t size = 0;
+	for (size_t ix = 0; ix < RENDER_STRING_COUNT; ix++) {
+		if (*strings[ix] != NULL) {
+			size += strlen(*strings[ix]) + 1;
 		}
+	}
 
-		int stat;
-		if (waitpid(processes[pix].pid, &stat, 0) <= 0) {
+	render->strings = XMALLOC(size);
+
+	char *pos = render->strings;
+	for (size_t ix = 0; ix < RENDER_STRING_COUNT; ix++) {
+		if (*strings[ix] == NULL) {
 			continue;
 		}
 
-		stat = WEXITSTATUS(stat);
-		if (stat != 0) {
-			ret = stat;
+		size_t length = strlen(*strings[ix]) + 1;
+		memcpy(pos, *strings[ix], length);
+		*strings[ix] = pos;
+		pos += length;
+	}
+
+	render->input.path = render->in;
+}
+
+void _render_ahead(void *ctx, size_t item, size_t worker) {
+	c_rule_run_t *run = ctx;
+	c_rule_render_t *render = &run->renders[item];
+
+	_render_strings(
+		run, item, &run->render_buffers[worker * RENDER_STRING_COUNT],
+		render);
+
+	/* the buffers are reused for the next element */
+	if (render->rendered) {
+		_pack_render(render);
+	}
+}
+
+void mb_c_rule_render_ahead(c_rule_run_t *run) {
+	size_t count = mb_c_rule_element_count(run);
+	if (mb_workers_count() == 0 || count < 2) {
+		return;
+	}
+
+	run->renders = XCALLOC(count, sizeof(*run->renders));
+	run->render_buffers = XCALLOC(
+		(mb_workers_count() + 1) * RENDER_STRING_COUNT,
+		sizeof(*run->render_buffers));
+
+	mb_workers_start(&run->render_batch, _render_ahead, run, count);
+}
+
+/**
+ * @brief Submit the job of a rendered element if it is outdated, otherwise
+ * record it if it has to be.
+ */
+void _submit_render(
+	c_rule_run_t *run,
+	size_t ix,
+	c_rule_render_t *render,
+	bool *submitted) {
+	if (!render->outdated) {
+		run->skipped++;
+		if (render->adopt) {
+			c_rule_element_t element = {
+				.input = render->input,
+				.output = render->out,
+				.depfile = render->depfile,
+				.command_hash = render->command_hash,
+			};
+			_record_element(run, &element, NULL, 0, 0);
 		}
 
-		mb_remove_script(processes[pix].location);
-		XFREE(processes[pix].location);
+		return;
 	}
 
-exit:;
-	if (processes != NULL) {
-		XFREE(processes);
+	if (run->elements != NULL) {
+		c_rule_element_t *element = &run->elements[ix];
+		*element = (c_rule_element_t){
+			.input = render->input,
+			.output = mb_arena_strdup(&run->arena, render->out),
+			.depfile = render->depfile != NULL
+						   ? mb_arena_strdup(&run->arena, render->depfile)
+						   : NULL,
+			.command_hash = render->command_hash,
+		};
+		element->input.path = mb_arena_strdup(&run->arena, render->in);
+
+		if (run->restat) {
+			_stat_output(element);
+		}
+
+		if (run->cache && _cache_key(element) &&
+			mb_artifacts_restore(
+				element->cache_key, render->out, render->depfile)) {
+			mb_logf(LOG_STEPS, "cached: %s > %s\n", render->in, render->out);
+			run->cached++;
+			_restat_output(element);
+			_record_element(run, element, NULL, 0, 0);
+			_free_element(element);
+			return;
+		}
 	}
 
-	return ret;
+	mb_logf(LOG_STEPS, "exec: %s > %s\n", render->in, render->out);
+
+	/* the job pool takes ownership of the script */
+	mb_jobs_submit(run->group, strdup(render->script), (ssize_t)ix);
+	*submitted = true;
 }
 
-int run_unify(
-	mcfg_file_t *file,
-	mcfg_section_t *rule,
-	const config_t cfg,
-	build_type_t build_type) {
-	mcfg_field_t *field_exec = mcfg_get_field(rule, "exec");
-	if (field_exec == NULL || field_exec->data == NULL) {
-		mb_log(LOG_ERROR, "c_rule missing field \"exec\"\n");
-		return 1;
+int mb_c_rule_submit_element(c_rule_run_t *run, size_t ix, bool *submitted) {
+	*submitted = false;
+
+	c_rule_render_t render = {0};
+	if (run->renders != NULL) {
+		mb_workers_wait(&run->render_batch, ix);
+		render = run->renders[ix];
+		run->renders[ix] = (c_rule_render_t){0};
 	}
 
-	mcfg_field_t *field_input_format = mcfg_get_field(rule, "input_format");
-	mcfg_field_t *field_output_format = mcfg_get_field(rule, "output_format");
+	if (!render.rendered) {
+		int ret = _render_strings(run, ix, NULL, &render);
+		if (!render.rendered) {
+			return ret;
+		}
+	}
 
-	if (field_input_format == NULL || field_output_format == NULL) {
-		mb_logf(
-			LOG_ERROR, "c_rule missing field \"%s\"!\n",
-			field_input_format == NULL ? "input_format" : "output_format");
-		return 1;
-	} else if (
-		field_input_format->type != TYPE_STRING ||
-		field_output_format->type != TYPE_STRING) {
-		mb_logf(
-			LOG_ERROR, "invalid datatype for field \"%s\"! Expected str\n",
-			field_input_format->type != TYPE_STRING ? "input_format"
-													: "output_format");
-		return 1;
+	_submit_render(run, ix, &render, submitted);
+
+	if (render.strings != NULL) {
+		XFREE(render.strings);
 	}
 
-	char *input_format = mcfg_data_as_string(*field_input_format);
-	char *output_format = mcfg_data_as_string(*field_output_format);
+	return 0;
+}
 
-	if (input_format == NULL || output_format == NULL) {
-		mb_logf(
-			LOG_ERROR, "field \"%s\" is missing data!\n",
-			input_format == NULL ? "input_format" : "output_format");
-		return 1;
+uint64_t _job_duration(const job_t *job) {
+	return mb_monotonic_ns() - mb_timespec_ns(job->started);
+}
+
+void mb_c_rule_job_done(c_rule_run_t *run, const job_t *job, int status) {
+	/* a failed link keeps the previous record, so that a changed command
+	 * is still detected by the next run */
+	if (job->element < 0) {
+		if (run->unify_output != NULL && status == 0) {
+			mb_build_log_record(
+				run->unify_output, run->command_hash, _job_duration(job), 0,
+				NULL, 0);
+		}
+		return;
 	}
 
-	struct io_fields io_fields;
-	if (!get_io_fields(file, rule, &io_fields)) {
-		return 1;
+	if (run->elements == NULL) {
+		return;
 	}
 
-	mcfg_list_t *list_input = mcfg_data_as_list(*io_fields.input);
+	c_rule_element_t *element = &run->elements[job->element];
+	if (element->output == NULL) {
+		return;
+	}
 
-	mcfg_path_t pathrel = {
-		.absolute = true,
-		.dynfield_path = false,
+	uint64_t duration_ns = _job_duration(job);
 
-		.sector = "c_rules",
-		.section = rule->name,
-		.field = ""};
+	if (status == 0) {
+		_restat_output(element);
+	}
 
-	ADD_DYNFIELD(file, "element");
-	ADD_DYNFIELD(file, "input");
-	ADD_DYNFIELD(file, "output");
+	if (status == 0 && element->cacheable) {
+		mb_artifacts_store(
+			element->cache_key, element->output, element->depfile);
+	}
 
-	mcfg_field_t *dynfield_element = mcfg_get_dynfield(file, "element");
-	mcfg_field_t *dynfield_input = mcfg_get_dynfield(file, "input");
-	mcfg_field_t *dynfield_output = mcfg_get_dynfield(file, "output");
+	_record_element(
+		run, element, &job->started_wall, duration_ns,
+		status == 0 ? 0 : BUILD_LOG_DIRTY);
+	_free_element(element);
+}
 
-	mcfg_fmt_res_t fmt_res =
-		mcfg_format_field_embeds_str(output_format, *file, pathrel);
-	FMT_ERR_CHECK(fmt_res, "unify_output_format");
+/**
+ * @brief Stop rendering ahead and free the renders which were not used.
+ */
+void _release_renders(c_rule_run_t *run) {
+	mb_workers_finish(&run->render_batch);
 
-	dynfield_output->data = fmt_res.formatted;
-	dynfield_output->size = strlen(dynfield_output->data) + 1;
+	for (size_t ix = 0; ix < mb_c_rule_element_count(run); ix++) {
+		if (mb_workers_done(&run->render_batch, ix) &&
+			run->renders[ix].strings != NULL) {
+			XFREE(run->renders[ix].strings);
+		}
+	}
+
+	for (size_t ix = 0;
+		 ix < (mb_workers_count() + 1) * RENDER_STRING_COUNT; ix++) {
+		if (run->render_buffers[ix].data != NULL) {
+			XFREE(run->render_buffers[ix].data);
+		}
+	}
+
+	mb_workers_free(&run->render_batch);
+	XFREE(run->renders);
+	XFREE(run->render_buffers);
+	run->renders = NULL;
+	run->render_buffers = NULL;
+}
 
-	size_t incount = 0;
-	size_t wix = 0;
+void mb_c_rule_release(c_rule_run_t *run) {
+	/* workers may still be reading the templates */
+	if (run->renders != NULL) {
+		_release_renders(run);
+	}
 
-	dynfield_input->size = 16;
-	dynfield_input->data = XMALLOC(dynfield_input->size);
+	mb_template_free(&run->input_template);
+	mb_template_free(&run->output_template);
+	mb_template_free(&run->exec_template);
+	mb_template_free(&run->depfile_template);
 
-	int ret = 0;
+	mb_arena_free(&run->arena);
+	mb_arena_free(&run->scratch);
 
-	for (size_t ix = 0; ix < list_input->field_count; ix++) {
-		char *raw_in = mcfg_data_to_string(list_input->fields[ix]);
-		dynfield_element->data = raw_in;
-		dynfield_element->size = strlen(raw_in) + 1;
+	if (run->elements == NULL) {
+		return;
+	}
 
-		fmt_res = mcfg_format_field_embeds_str(input_format, *file, pathrel);
-		FMT_ERR_CHECK(fmt_res, "unify_input_format");
+	XFREE(run->elements);
+	run->elements = NULL;
+}
 
-		char *fmted = fmt_res.formatted;
+/**
+ * @brief Render the inputs of a unify rule into a space separated list.
+ * @param force Whether every input is listed, not only outdated ones.
+ * @param input_hash Set to the hash of every input in order, if not NULL.
+ * @return The amount of inputs listed, or -1 if rendering failed.
+ */
+ssize_t _unify_inputs(
+	c_rule_run_t *run,
+	const char *output,
+	bool force,
+	char **input,
+	uint64_t *input_hash,
+	int *ret) {
+	size_t input_length = 0;
+	ssize_t incount = 0;
+	*input = NULL;
+
+	const char *values[TEMPLATE_SLOT_COUNT] = {
+		[TEMPLATE_SLOT_OUTPUT] = output,
+	};
+
+	for (size_t ix = 0; ix < run->list_input->field_count; ix++) {
+		char *raw_in_copy;
+		values[TEMPLATE_SLOT_ELEMENT] =
+			_list_value(run->list_input, ix, &raw_in_copy);
+
+		char *fmted;
+		bool rendered = _render(
+			&run->input_template, values, &fmted, "unify_input_format", ret);
+
+		if (raw_in_copy != NULL) {
+			XFREE(raw_in_copy);
+		}
 
-		if (build_type == BUILD_TYPE_INCREMENTAL &&
-			!is_file_newer(fmted, dynfield_output->data) && !cfg.always_force) {
-			goto input_assembly_continue;
+		if (!rendered) {
+			return -1;
 		}
 
-		wix = _append_str(
-			(char **)&dynfield_input->data, wix, &dynfield_input->size, fmted);
-		_append_char(
-			(char **)&dynfield_input->data, wix, &dynfield_input->size, ' ');
-		wix++;
+		if (input_hash != NULL) {
+			*input_hash = mb_hash64(fmted, strlen(fmted) + 1, *input_hash);
+		}
+
+		bool outdated = force || run->build_type == BUILD_TYPE_FULL ||
+						is_file_newer(fmted, (char *)output) ||
+						run->cfg.always_force;
+
+		flight_event_t event = FLIGHT_EVENT(FLIGHT_CHECK, run->rule->name);
+		event.element = ix;
+		event.status = outdated;
+		mb_flight_record(event);
+
+		if (!outdated) {
+			continue;
+		}
+
+		_append_str(&run->scratch, input, &input_length, fmted, strlen(fmted));
+		_append_str(&run->scratch, input, &input_length, " ", 1);
 
 		incount++;
-	input_assembly_continue:
-		XFREE(raw_in);
-		XFREE(fmted);
 	}
 
-	_append_char((char **)&dynfield_input->data, wix, &dynfield_input->size, 0);
-	wix++;
+	return incount;
+}
+
+/**
+ * @brief Hash the exec script of a unify rule with every field but its
+ * input resolved, combined with the hash of all of its inputs.
+ * @return Whether rendering succeeded, otherwise ret is set.
+ */
+bool _unify_command_hash(
+	c_rule_run_t *run,
+	const char *output,
+	uint64_t input_hash,
+	uint64_t *hash,
+	int *ret) {
+	const char *values[TEMPLATE_SLOT_COUNT] = {
+		[TEMPLATE_SLOT_ELEMENT] = "",
+		[TEMPLATE_SLOT_INPUT] = "",
+		[TEMPLATE_SLOT_OUTPUT] = output,
+	};
+
+	char *script;
+	if (!_render(&run->exec_template, values, &script, "exec", ret)) {
+		return false;
+	}
+
+	*hash = mb_hash64(script, strlen(script), input_hash);
+	return true;
+}
+
+int mb_c_rule_submit_unify(c_rule_run_t *run) {
+	mcfg_file_t *file = run->file;
+
+	mcfg_field_t *dynfield_element = mb_get_dynfield(file, "element");
+	mcfg_field_t *dynfield_input = mb_get_dynfield(file, "input");
+	mcfg_field_t *dynfield_output = mb_get_dynfield(file, "output");
+
+	MB_STAT_TIMER(output_start);
+	MB_PROBE1(format__start, "unify_output_format");
+	mcfg_fmt_res_t fmt_res = mcfg_format_field_embeds_str(
+		run->output_format, *file, run->pathrel);
+	MB_PROBE2(format__end, "unify_output_format", fmt_res.err);
+	MB_STAT_FORMATTED(output_start, fmt_res);
+	FMT_ERR_CHECK(fmt_res, "unify_output_format");
+
+	dynfield_output->data = fmt_res.formatted;
+	dynfield_output->size = strlen(dynfield_output->data) + 1;
+	const char *output = dynfield_output->data;
+
+	int ret = 0;
+	uint64_t check_start = mb_trace_now();
+	trace_arg_t trace_args[] = {
+		TRACE_STR("rule", run->rule->name),
+		TRACE_NUM("outdated", 0),
+	};
+
+	/* rules like strip-executable have no output to keep a record of */
+	bool logged = mb_build_log_is_open() && output[0] != '\0';
+	uint64_t input_hash = 0;
+	char *input;
+	ssize_t incount = _unify_inputs(
+		run, output, false, &input, logged ? &input_hash : NULL, &ret);
+	if (incount < 0) {
+		goto exit;
+	}
+
+	if (logged) {
+		if (!_unify_command_hash(
+				run, output, input_hash, &run->command_hash, &ret)) {
+			goto exit;
+		}
+
+		size_t output_size = strlen(output) + 1;
+		run->unify_output = mb_arena_alloc(&run->arena, output_size);
+		memcpy(run->unify_output, output, output_size);
+
+		const build_log_record_t *record = mb_build_log_find(output);
+		if (record == NULL && incount == 0) {
+			/* up to date, recorded so that later changes are noticed */
+			mb_build_log_record(output, run->command_hash, 0, 0, NULL, 0);
+		} else if (
+			record != NULL && record->command_hash != run->command_hash &&
+			(size_t)incount < run->list_input->field_count) {
+			mb_logf(LOG_DEBUG, "command of \"%s\" changed\n", output);
+			incount = _unify_inputs(run, output, true, &input, NULL, &ret);
+			if (incount < 0) {
+				goto exit;
+			}
+		}
+	}
+
+	trace_args[1].num = incount;
+	mb_trace_span("c_rule", "check", check_start, trace_args, 2);
 
 	if (incount == 0) {
 		mb_log(LOG_INFO, "no inputs, skipping!\n");
+		run->skipped++;
 		goto exit;
 	}
 
+	dynfield_input->data = input;
+	dynfield_input->size = strlen(input) + 1;
+
 	mb_logf(
 		LOG_STEPS, "exec: %s > %s\n", mcfg_data_as_string(*dynfield_input),
 		mcfg_data_as_string(*dynfield_output));
 
-	fmt_res = mcfg_format_field_embeds(*field_exec, *file, pathrel);
-	FMT_ERR_CHECK(fmt_res, "unify_script_format");
-
-	char *script = fmt_res.formatted;
-
-	int tmp_ret = mb_exec(script, rule->name);
-	ret = ret > tmp_ret ? ret : tmp_ret;
+	uint64_t format_start = mb_trace_now();
+	MB_STAT_TIMER(exec_start);
+	MB_PROBE1(format__start, "unify_script_format");
+	fmt_res = mcfg_format_field_embeds(*run->field_exec, *file, run->pathrel);
+	MB_PROBE2(format__end, "unify_script_format", fmt_res.err);
+	MB_STAT_FORMATTED(exec_start, fmt_res);
+	mb_trace_span("c_rule", "format", format_start, trace_args, 1);
+	if (!_fmt_ok(fmt_res, "unify_script_format", &ret)) {
+		goto exit;
+	}
 
-	XFREE(script);
+	/* the job pool takes ownership of the script */
+	mb_jobs_submit(run->group, fmt_res.formatted, -1);
 exit:
-	XFREE(dynfield_input->data);
 	XFREE(dynfield_output->data);
+	mb_arena_reset(&run->scratch);
 
 	dynfield_element->data = NULL;
 	dynfield_input->data = NULL;
@@ -678,55 +1255,55 @@ exit:
 	return ret;
 }
 
-int mb_run_c_rule(mcfg_file_t *file, mcfg_section_t *rule, const config_t cfg) {
-	mb_logf(LOG_INFO, "fulfilling c_rule \"%s\"\n", rule->name);
+/**
+ * @brief Resolve the input list of a rule like get_io_fields, without
+ * logging anything.
+ */
+mcfg_field_t *_find_input_list(mcfg_file_t *file, mcfg_section_t *rule) {
+	mcfg_field_t *field_input = mb_get_field(rule, "input");
+	mcfg_field_t *field_input_glob = mb_get_field(rule, "input_glob");
+	if (field_input == NULL && field_input_glob != NULL) {
+		if (field_input_glob->type != TYPE_STRING ||
+			field_input_glob->data == NULL) {
+			return NULL;
+		}
 
-	mcfg_field_t *field_c_rules = mcfg_get_field(rule, "c_rules");
-	if (field_c_rules != NULL) {
-		if (field_c_rules->type != TYPE_LIST) {
-			mb_log(
-				LOG_WARNING, "field c_rules is of incorrect type! ignoring.\n");
-		} else {
-			int ret =
-				mb_run_c_rules(file, field_c_rules, C_RULE, rule->name, cfg);
-			if (ret != 0) {
-				return ret;
-			}
+		/* expanded once per build, so both rules get the same list */
+		field_input = mb_glob_expand(mcfg_data_as_string(*field_input_glob));
+	} else if (field_input == NULL) {
+		mcfg_field_t *field_input_src = mb_get_field(rule, "input_src");
+		if (field_input_src == NULL) {
+			return NULL;
 		}
-	}
 
-	build_type_t build_type = cfg.build_type;
-	if (mcfg_get_field(rule, "build_type") != NULL) {
-		char *data = mcfg_data_to_string(*mcfg_get_field(rule, "build_type"));
+		char *raw_path = mcfg_data_to_string(*field_input_src);
+		mcfg_path_t path = mcfg_parse_path(raw_path);
 
-		build_type = str_to_build_type(data, build_type);
+		field_input = mb_get_field_by_path(file, path);
 
-		XFREE(data);
+		mcfg_free_path(path);
+		XFREE(raw_path);
 	}
 
-	exec_mode_t exec_mode = EXEC_MODE_SINGULAR;
-	if (mcfg_get_field(rule, "exec_mode") != NULL) {
-		char *data = mcfg_data_to_string(*mcfg_get_field(rule, "exec_mode"));
-
-		exec_mode = str_to_exec_mode(data, exec_mode);
-
-		XFREE(data);
+	if (field_input == NULL || field_input->type != TYPE_LIST ||
+		field_input->data == NULL) {
+		return NULL;
 	}
 
-	int ret = 0;
+	return field_input;
+}
 
-	switch (exec_mode) {
-		case EXEC_MODE_SINGULAR:
-			ret = run_singular(file, rule, cfg, build_type);
-			break;
-		case EXEC_MODE_UNIFY:
-			ret = run_unify(file, rule, cfg, build_type);
-			break;
+bool mb_c_rule_can_pipe(
+	mcfg_file_t *file,
+	mcfg_section_t *upstream,
+	mcfg_section_t *downstream) {
+	if (_get_exec_mode(upstream) != EXEC_MODE_SINGULAR ||
+		_get_exec_mode(downstream) != EXEC_MODE_SINGULAR) {
+		return false;
 	}
 
-	if (ret == 0) {
-		mb_logf(LOG_INFO, "fulfilled c_rule \"%s\"!\n", rule->name);
-	}
+	mcfg_field_t *input_upstream = _find_input_list(file, upstream);
+	mcfg_field_t *input_downstream = _find_input_list(file, downstream);
 
-	return ret;
+	return input_upstream != NULL && input_upstream == input_downstream;
 }
@@ -7,19 +7,215 @@
 #ifndef C_RULE_H
 #define C_RULE_H
 
+#include <stdint.h>
+#include <time.h>
+
+#include "buildlog.h"
+#include "jobs.h"
 #include "mcfg.h"
+#include "mcfg_util.h"
+#include "template.h"
 #include "types.h"
+#include "workers.h"
+#include "xmem.h"
+
+/**
+ * @brief What is needed to record an element in the build log once its job
+ * is done.
+ */
+typedef struct c_rule_element {
+	/* the input as it was when the job was rendered, zeroed if it did not
+	 * exist. The strings of an element are allocated from the rule's
+	 * arena. */
+	build_log_input_t input;
+	char *output;
+	/* NULL if the rule has no depfile */
+	char *depfile;
+	uint64_t command_hash;
+	/* whether the output is stored in the artifact cache under cache_key
+	 * once its job succeeded */
+	bool cacheable;
+	uint64_t cache_key;
+	/* whether the output existed before its job ran, with the hash of its
+	 * contents and its modification time at that point */
+	bool restat;
+	uint64_t output_hash;
+	struct timespec output_mtime;
+} c_rule_element_t;
+
+/**
+ * @brief An element of a singular rule which was rendered and checked,
+ * possibly ahead of its submission on a worker thread.
+ */
+typedef struct c_rule_render {
+	/* false if the element still has to be rendered on the main thread,
+	 * e.g. because a value has embeds only mcfg can format */
+	bool rendered;
+	bool outdated;
+	/* whether the element is up to date without a usable build log record
+	 * and has to be recorded */
+	bool adopt;
+
+	char *in;
+	char *out;
+	/* NULL if the rule has no depfile */
+	char *depfile;
+	char *script;
+	uint64_t command_hash;
+	/* stat'ed if the element is outdated or adopted while the build log is
+	 * open */
+	build_log_input_t input;
+
+	/* the strings of a render done ahead, in a single allocation */
+	char *strings;
+} c_rule_render_t;
+
+typedef enum render_string {
+	RENDER_STRING_IN = 0,
+	RENDER_STRING_OUT,
+	RENDER_STRING_DEPFILE,
+	RENDER_STRING_SCRIPT,
+	RENDER_STRING_COUNT,
+} render_string_t;
+
+/* a buffer which a thread renders one of the strings of an element into */
+typedef struct render_buffer {
+	char *data;
+	size_t capacity;
+} render_buffer_t;
+
+/**
+ * @brief The resolved fields of a c_rule, shared by the calls rendering its
+ * elements. The lists and formats point into the file.
+ */
+typedef struct c_rule_run {
+	mcfg_file_t *file;
+	mcfg_section_t *rule;
+	config_t cfg;
+	build_type_t build_type;
+	exec_mode_t exec_mode;
+	job_group_t *group;
+
+	mcfg_field_t *field_exec;
+	char *input_format;
+	char *output_format;
+	mcfg_list_t *list_input;
+	mcfg_list_t *list_output;
+	/* format of the depfile of each output, NULL if there is none */
+	char *depfile_format;
+
+	/* the formats and exec field compiled when the rule is prepared, the
+	 * depfile template is only compiled if there is a depfile */
+	template_t input_template;
+	template_t output_template;
+	template_t exec_template;
+	template_t depfile_template;
+	/* whether outputs are looked up in and stored to the artifact cache */
+	bool cache;
+	/* whether outputs whose contents a job did not change keep their
+	 * previous modification time */
+	bool restat;
+
+	/* The output of a unify rule and the hash of its command, recorded
+	 * once its job succeeded. NULL unless the build log is open.
+	 */
+	char *unify_output;
+	uint64_t command_hash;
+
+	/* jobs which were not run since they were up to date and jobs whose
+	 * outputs were restored from the artifact cache */
+	size_t skipped;
+	size_t cached;
+
+	/* one per element of a singular rule while the build log is open,
+	 * otherwise NULL */
+	c_rule_element_t *elements;
+	/* strings which live until the rule is released */
+	arena_t arena;
+	/* strings which only live while a single element is rendered or
+	 * recorded, or while the input of a unify rule is built */
+	arena_t scratch;
+
+	/* one per element while they are rendered ahead on the worker pool,
+	 * otherwise NULL */
+	c_rule_render_t *renders;
+	work_batch_t render_batch;
+	/* RENDER_STRING_COUNT per worker and for the main thread */
+	render_buffer_t *render_buffers;
 
-#define TARGET 0
-#define C_RULE 1
+	mcfg_path_t pathrel;
+} c_rule_run_t;
 
-int mb_run_c_rules(
+/**
+ * @brief Resolve and check the fields of a c_rule and initialize the job
+ * group its jobs are submitted to. The c_rules required by this rule are not
+ * run, they are nodes of their own within the build graph.
+ * @return 0 if the rule can be run.
+ */
+int mb_c_rule_prepare(
+	c_rule_run_t *run,
 	mcfg_file_t *file,
-	mcfg_field_t *field_required_c_rules,
-	int org_type,
-	char *org_name,
-	const config_t cfg);
+	mcfg_section_t *rule,
+	const config_t cfg,
+	job_group_t *group);
+
+/**
+ * @brief The amount of jobs a prepared singular rule may submit, one per
+ * element.
+ */
+size_t mb_c_rule_element_count(const c_rule_run_t *run);
+
+/**
+ * @brief Start rendering and checking the elements of a singular rule on
+ * the worker pool, so that mb_c_rule_submit_element only has to wait for
+ * the result of its element. Only the template slots differ per element,
+ * so workers never touch the file's dynfields. Must only be called once
+ * the inputs of all elements are final.
+ */
+void mb_c_rule_render_ahead(c_rule_run_t *run);
+
+/**
+ * @brief Render the job for a single element of a singular rule and submit
+ * it to the job pool, tagged with the element's index.
+ * @param submitted Set to whether a job was submitted, false if the element
+ * is up to date or could not be rendered.
+ * @return 0 if the element could be rendered.
+ */
+int mb_c_rule_submit_element(c_rule_run_t *run, size_t ix, bool *submitted);
+
+/**
+ * @brief Render the single job of a unify rule and submit it to the job pool.
+ * @return 0 if the job could be rendered or there was nothing to do.
+ */
+int mb_c_rule_submit_unify(c_rule_run_t *run);
 
-int mb_run_c_rule(mcfg_file_t *file, mcfg_section_t *rule, const config_t cfg);
+/**
+ * @brief The name of an element of a prepared singular rule as it is listed
+ * in its input list.
+ * @return An allocated copy, NULL if there is no such element.
+ */
+char *mb_c_rule_element_name(c_rule_run_t *run, ssize_t ix);
+
+/**
+ * @brief Record the outcome of a job of the rule in the build log and store
+ * its output in the artifact cache if it succeeded.
+ */
+void mb_c_rule_job_done(c_rule_run_t *run, const job_t *job, int status);
+
+/**
+ * @brief Free what was allocated for a prepared rule once all of its jobs
+ * are done.
+ */
+void mb_c_rule_release(c_rule_run_t *run);
+
+/**
+ * @brief Whether the elements of downstream can run as soon as the same
+ * element of upstream is done, instead of waiting for the whole rule. This
+ * is the case if both are singular rules over the same input list.
+ */
+bool mb_c_rule_can_pipe(
+	mcfg_file_t *file,
+	mcfg_section_t *upstream,
+	mcfg_section_t *downstream);
 
 #endif /* #infdef C_RULE_H */
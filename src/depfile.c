@@ -0,0 +1,233 @@
+/* depfile.c ; mariebuild Makefile-style dependency file impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "buildlog.h"
+#include "depfile.h"
+#include "logging.h"
+#include "xmem.h"
+
+bool _is_space(char chr) {
+	return chr == ' ' || chr == '\t' || chr == '\r';
+}
+
+/**
+ * @brief Length of the line continuation at pos, 0 if there is none.
+ */
+size_t _continuation(char *pos, char *end) {
+	if (pos[0] != '\\' || pos + 1 >= end) {
+		return 0;
+	}
+
+	if (pos[1] == '\n') {
+		return 2;
+	}
+
+	if (pos[1] == '\r' && pos + 2 < end && pos[2] == '\n') {
+		return 3;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Whether the colon at pos separates targets from prerequisites,
+ * which is not the case for colons within paths.
+ */
+bool _is_separator(char *pos, char *end) {
+	return pos[0] == ':' &&
+		   (pos + 1 >= end || _is_space(pos[1]) || pos[1] == '\n' ||
+			_continuation(pos + 1, end) != 0);
+}
+
+bool mb_depfile_parse(
+	char *content,
+	size_t size,
+	depfile_visit_t visit,
+	void *ctx) {
+	char *pos = content;
+	char *end = content + size;
+	bool in_targets = true;
+
+	while (pos < end) {
+		size_t skip = _continuation(pos, end);
+		if (skip != 0) {
+			pos += skip;
+			continue;
+		}
+
+		if (_is_space(*pos)) {
+			pos++;
+			continue;
+		}
+
+		if (*pos == '\n') {
+			in_targets = true;
+			pos++;
+			continue;
+		}
+
+		if (_is_separator(pos, end)) {
+			in_targets = false;
+			pos++;
+			continue;
+		}
+
+		/* unescape the token in place, it never grows */
+		char *token = pos;
+		char *wpos = pos;
+		bool separator = false;
+
+		while (pos < end) {
+			if (_continuation(pos, end) != 0 || _is_space(*pos) ||
+				*pos == '\n') {
+				break;
+			}
+
+			if (_is_separator(pos, end)) {
+				separator = true;
+				pos++;
+				break;
+			}
+
+			if (pos[0] == '\\' && pos + 1 < end &&
+				(pos[1] == ' ' || pos[1] == '#')) {
+				*wpos++ = pos[1];
+				pos += 2;
+				continue;
+			}
+
+			if (pos[0] == '$' && pos + 1 < end && pos[1] == '$') {
+				*wpos++ = '$';
+				pos += 2;
+				continue;
+			}
+
+			*wpos++ = *pos++;
+		}
+
+		/* consume the delimiter before the terminator may overwrite it */
+		bool newline = false;
+		if (!separator && pos < end) {
+			size_t delim = _continuation(pos, end);
+			if (delim == 0) {
+				newline = *pos == '\n';
+				delim = 1;
+			}
+
+			pos += delim;
+		}
+
+		*wpos = '\0';
+
+		if (!in_targets && !visit(token, ctx)) {
+			return false;
+		}
+
+		if (separator) {
+			in_targets = false;
+		}
+		if (newline) {
+			in_targets = true;
+		}
+	}
+
+	return true;
+}
+
+bool mb_depfile_read(char *depfile, depfile_visit_t visit, void *ctx) {
+	int fd = open(depfile, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		mb_logf(
+			LOG_DEBUG, "depfile \"%s\" can not be opened: %s\n", depfile,
+			strerror(errno));
+		return false;
+	}
+
+	struct stat depfile_stat;
+	if (fstat(fd, &depfile_stat) != 0) {
+		close(fd);
+		return false;
+	}
+
+	size_t size = depfile_stat.st_size;
+	/* room for the terminator of the last token */
+	char *content = XMALLOC(size + 1);
+
+	size_t read_total = 0;
+	while (read_total < size) {
+		ssize_t res = read(fd, content + read_total, size - read_total);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			break;
+		}
+
+		read_total += res;
+	}
+
+	close(fd);
+
+	bool ok = read_total == size && mb_depfile_parse(content, size, visit, ctx);
+
+	XFREE(content);
+	return ok;
+}
+
+struct outdated_check {
+	struct timespec output_mtime;
+	bool outdated;
+};
+
+bool _check_prerequisite(char *prerequisite, void *ctx) {
+	struct outdated_check *check = ctx;
+
+	struct timespec mtime;
+	if (!mb_file_mtime(prerequisite, &mtime)) {
+		mb_logf(
+			LOG_DEBUG, "prerequisite \"%s\" can not be checked: %s\n",
+			prerequisite, strerror(errno));
+		check->outdated = true;
+		return false;
+	}
+
+	if (mtime.tv_sec > check->output_mtime.tv_sec ||
+		(mtime.tv_sec == check->output_mtime.tv_sec &&
+		 mtime.tv_nsec > check->output_mtime.tv_nsec)) {
+		mb_logf(LOG_DEBUG, "prerequisite \"%s\" changed\n", prerequisite);
+		check->outdated = true;
+		return false;
+	}
+
+	return true;
+}
+
+bool mb_depfile_outdated(char *depfile, char *output) {
+	struct outdated_check check = {.outdated = false};
+	if (!mb_file_mtime(output, &check.output_mtime)) {
+		return true;
+	}
+
+	if (!mb_depfile_read(depfile, _check_prerequisite, &check)) {
+		return true;
+	}
+
+	return check.outdated;
+}
@@ -0,0 +1,47 @@
+/* depfile.h ; mariebuild Makefile-style dependency file header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef DEPFILE_H
+#define DEPFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Called for every prerequisite within a depfile.
+ * @return Whether parsing should continue.
+ */
+typedef bool (*depfile_visit_t)(char *prerequisite, void *ctx);
+
+/**
+ * @brief Parse the contents of a Makefile-style depfile as written by
+ * "cc -MD" in place. Targets are skipped, every prerequisite of every rule
+ * is passed to visit with escaped spaces, hashes and dollar signs resolved.
+ * @param content The contents, which are modified. Does not have to be
+ * terminated, but needs room for one more byte after size.
+ * @return Whether all prerequisites were visited.
+ */
+bool mb_depfile_parse(
+	char *content,
+	size_t size,
+	depfile_visit_t visit,
+	void *ctx);
+
+/**
+ * @brief Read and parse a depfile.
+ * @return Whether the depfile could be read and all prerequisites were
+ * visited.
+ */
+bool mb_depfile_read(char *depfile, depfile_visit_t visit, void *ctx);
+
+/**
+ * @brief Check whether an output is out of date according to its depfile.
+ * @return True if the depfile can not be read, or if any prerequisite is
+ * missing or newer than the output.
+ */
+bool mb_depfile_outdated(char *depfile, char *output);
+
+#endif /* #ifndef DEPFILE_H */
@@ -7,6 +7,17 @@
 #define _XOPEN_SOURCE 700
 #define _POSIX_C_SOURCE 2
 
+#if defined(__linux__) && !defined(MB_NO_MEMFD)
+#define _GNU_SOURCE
+#define MB_HAVE_MEMFD
+#endif
+
+/* for wait4 */
+#define _DEFAULT_SOURCE
+#ifdef __APPLE__
+#define _DARWIN_C_SOURCE
+#endif
+
 #include <errno.h>
 #include <limits.h>
 #include <math.h>
@@ -17,14 +28,22 @@
 #include <string.h>
 
 #include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "executor.h"
+#include "ioutil.h"
 #include "logging.h"
 #include "signals.h"
+#include "stats.h"
 #include "xmem.h"
 
+extern char **environ;
+
 /* this is such a disgusting hack i dont even want to think about it */
 static uint64_t script_counter = 0;
 
@@ -74,46 +93,346 @@ int _prepare_exec(char *script, char **name) {
 	return 0;
 }
 
-int mb_exec(char *script, char *name) {
-	int ret = _prepare_exec(script, &name);
-	if (ret != 0) {
-		goto exit;
+#ifdef MB_HAVE_MEMFD
+/* -1 = not probed yet, 0 = unusable, 1 = usable */
+static int memfd_usable = -1;
+#endif
+
+/**
+ * @brief Try to place the script into a sealed anonymous memory file, so
+ * that it can be executed via /dev/fd/ without touching the filesystem.
+ * The descriptor is inherited by the child process, the caller has to close
+ * it after forking.
+ *
+ * @return The file descriptor or -1 if the script has to be written to a
+ * temporary file instead.
+ */
+int _prepare_exec_memfd(char *script, char *name) {
+#ifdef MB_HAVE_MEMFD
+	if (memfd_usable == 0) {
+		return -1;
+	}
+
+	unsigned int flags = MFD_ALLOW_SEALING;
+#ifdef MFD_EXEC
+	flags |= MFD_EXEC;
+#endif
+
+	int fd = memfd_create(name, flags);
+#ifdef MFD_EXEC
+	/* kernels before 6.3 reject MFD_EXEC */
+	if (fd < 0 && errno == EINVAL) {
+		fd = memfd_create(name, MFD_ALLOW_SEALING);
+	}
+#endif
+
+	if (fd < 0) {
+		mb_logf(
+			LOG_DEBUG, "memfd_create failed: OS Error %d (%s)\n", errno,
+			strerror(errno));
+		memfd_usable = 0;
+		return -1;
+	}
+
+	if (memfd_usable == -1) {
+		char path[32];
+		snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+		memfd_usable = access(path, R_OK) == 0;
+		if (!memfd_usable) {
+			mb_log(LOG_DEBUG, "/dev/fd/ is unavailable, using temp files\n");
+			close(fd);
+			return -1;
+		}
+	}
+
+	if (!mb_write_all(fd, script, strlen(script))) {
+		mb_logf(
+			LOG_DEBUG, "writing script to memfd failed: OS Error %d (%s)\n",
+			errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if (fcntl(
+			fd, F_ADD_SEALS,
+			F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+		mb_logf(
+			LOG_DEBUG, "sealing script memfd failed: OS Error %d (%s)\n",
+			errno, strerror(errno));
+	}
+
+	return fd;
+#else
+	(void)script;
+	(void)name;
+	return -1;
+#endif
+}
+
+int mb_launch(char *const argv[], const launch_opts_t *opts) {
+	launch_opts_t defaults = LAUNCH_OPTS_DEFAULT;
+	if (opts == NULL) {
+		opts = &defaults;
 	}
 
-	mb_register_tmp_file(name);
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+
+	const int redirects[3][2] = {
+		{opts->stdin_fd, STDIN_FILENO},
+		{opts->stdout_fd, STDOUT_FILENO},
+		{opts->stderr_fd, STDERR_FILENO},
+	};
+
+	for (size_t ix = 0; ix < 3; ix++) {
+		if (redirects[ix][0] < 0) {
+			continue;
+		}
 
-	int pid = fork();
-	if (pid == 0) {
-		execl("/bin/sh", "sh", "-c", name, (char *)NULL);
-		__builtin_unreachable();
+		posix_spawn_file_actions_adddup2(
+			&actions, redirects[ix][0], redirects[ix][1]);
+	}
+
+	pid_t pid;
+	MB_STAT_TIMER(spawn_start);
+	int err = posix_spawn(
+		&pid, argv[0], &actions, NULL, argv,
+		opts->env == NULL ? environ : opts->env);
+	MB_STAT_ELAPSED(STAT_SPAWN_NS, spawn_start);
+	MB_STAT_INC(STAT_SPAWNS);
+
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (err != 0) {
+		mb_logf(
+			LOG_ERROR, "posix_spawn of \"%s\" failed: OS Error %d (%s)\n",
+			argv[0], err, strerror(err));
+		return -1;
+	}
+
+	return pid;
+}
+
+/**
+ * @brief Launch the given script location via /bin/sh.
+ * @return The pid of the child process or -1 on failure.
+ */
+int _launch_script(char *location, const launch_opts_t *opts) {
+	char *const argv[] = {"/bin/sh", "-c", location, NULL};
+	return mb_launch(argv, opts);
+}
+
+/**
+ * @brief Start the given script, preferring an in-memory copy of the script
+ * and falling back to a temporary file.
+ * @param location Output for the temporary file path, NULL if none was
+ * created.
+ * @return The pid of the child process or -1 on failure.
+ */
+int _start_script(
+	char *script,
+	char *name,
+	const launch_opts_t *opts,
+	char **location) {
+	*location = NULL;
+
+	MB_STAT_TIMER(write_start);
+	int fd = _prepare_exec_memfd(script, name);
+	if (fd >= 0) {
+		MB_STAT_ELAPSED(STAT_SCRIPT_NS, write_start);
+		MB_STAT_INC(STAT_SCRIPT_WRITES);
+		MB_STAT_ADD(STAT_SCRIPT_BYTES, strlen(script));
+
+		char path[32];
+		snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+		mb_logf(LOG_DEBUG, "passing script \"%s\" via %s\n", name, path);
+
+		int pid = _launch_script(path, opts);
+		close(fd);
+		return pid;
+	}
+
+	char *tmp_name = name;
+	if (_prepare_exec(script, &tmp_name) != 0) {
+		XFREE(tmp_name);
+		return -1;
+	}
+
+	MB_STAT_ELAPSED(STAT_SCRIPT_NS, write_start);
+	MB_STAT_INC(STAT_SCRIPT_WRITES);
+	MB_STAT_ADD(STAT_SCRIPT_BYTES, strlen(script));
+
+	mb_register_tmp_file(tmp_name);
+
+	int pid = _launch_script(tmp_name, opts);
+	if (pid < 0) {
+		mb_remove_script(tmp_name);
+		XFREE(tmp_name);
+		return -1;
+	}
+
+	*location = tmp_name;
+	return pid;
+}
+
+int mb_exec(char *script, char *name) {
+	return mb_exec_opts(script, name, NULL);
+}
+
+int mb_exec_opts(char *script, char *name, const launch_opts_t *opts) {
+	char *location;
+	int ret = 1;
+
+	int pid = _start_script(script, name, opts, &location);
+	if (pid < 0) {
+		return ret;
 	}
 
 	waitpid(pid, &ret, 0);
 
-	mb_unregister_tmp_file(name);
+	if (location != NULL) {
+		mb_remove_script(location);
+		XFREE(location);
+	}
 
-exit:
-	XFREE(name);
 	return WEXITSTATUS(ret);
 }
 
 process_t mb_exec_parallel(char *script, char *name) {
-	int ret = _prepare_exec(script, &name);
-	if (ret != 0) {
+	return mb_exec_parallel_opts(script, name, NULL);
+}
+
+process_t mb_exec_parallel_opts(
+	char *script,
+	char *name,
+	const launch_opts_t *opts) {
+	char *location;
+
+	int pid = _start_script(script, name, opts, &location);
+	if (pid < 0) {
 		return (process_t){.pid = 0, .location = NULL};
 	}
 
-	int pid = fork();
-	if (pid != 0) {
-		mb_register_tmp_file(name);
-		return (process_t){.pid = pid, .location = name};
+	return (process_t){.pid = pid, .location = location};
+}
+
+int mb_wait_process(
+	process_t *processes,
+	size_t count,
+	size_t *process_ix,
+	bool block,
+	struct rusage *usage) {
+	struct rusage unused;
+	if (usage == NULL) {
+		usage = &unused;
 	}
 
-	execl("/bin/sh", "sh", "-c", name, (char *)NULL);
-	__builtin_unreachable();
+	for (;;) {
+		MB_STAT_INC(STAT_WAIT_ROUNDS);
+		mb_drain_sigchld_fd();
+
+		for (size_t pix = 0; pix < count; pix++) {
+			if (processes[pix].pid <= 0) {
+				continue;
+			}
+
+			int stat = 0;
+			MB_STAT_INC(STAT_WAIT_CALLS);
+			if (wait4(processes[pix].pid, &stat, WNOHANG, usage) <= 0) {
+				continue;
+			}
+
+			*process_ix = pix;
+			return WIFEXITED(stat) ? WEXITSTATUS(stat) : 1;
+		}
+
+		if (!block) {
+			return -1;
+		}
+
+		int sigchld_fd = mb_sigchld_fd();
+		if (sigchld_fd < 0) {
+			/* no self-pipe, block until any child exits */
+			int stat = 0;
+			MB_STAT_INC(STAT_WAIT_CALLS);
+			int pid = wait4(-1, &stat, 0, usage);
+			if (pid < 0 && errno == ECHILD) {
+				return -1;
+			}
+
+			for (size_t pix = 0; pix < count; pix++) {
+				if (processes[pix].pid == pid) {
+					*process_ix = pix;
+					return WIFEXITED(stat) ? WEXITSTATUS(stat) : 1;
+				}
+			}
+
+			continue;
+		}
+
+		struct pollfd pfd = {.fd = sigchld_fd, .events = POLLIN};
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			mb_logf(
+				LOG_ERROR, "poll failed: OS Error %d (%s)\n", errno,
+				strerror(errno));
+			return -1;
+		}
+	}
+}
+
+int mb_capture_open(const char *name) {
+#ifdef MB_HAVE_MEMFD
+	int memfd = memfd_create(name, MFD_CLOEXEC);
+	if (memfd >= 0) {
+		return memfd;
+	}
+#else
+	(void)name;
+#endif
+
+	char path[] = "/tmp/mb_output.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		mb_logf(
+			LOG_WARNING, "could not capture job output: OS Error %d (%s)\n",
+			errno, strerror(errno));
+		return -1;
+	}
+
+	unlink(path);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+}
+
+bool mb_capture_replay(int fd, int out_fd) {
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		return false;
+	}
+
+	char buf[65536];
+	for (;;) {
+		ssize_t size = read(fd, buf, sizeof(buf));
+		if (size < 0 && errno == EINTR) {
+			continue;
+		}
+		if (size <= 0) {
+			return size == 0;
+		}
+
+		if (!mb_write_all(out_fd, buf, size)) {
+			return false;
+		}
+	}
 }
 
 void mb_remove_script(char *script) {
 	remove(script);
 	mb_unregister_tmp_file(script);
 }
+
+void mb_cleanup_process(process_t *process) {
+	if (process->location != NULL) {
+		mb_remove_script(process->location);
+		XFREE(process->location);
+	}
+}
@@ -7,16 +7,90 @@
 #ifndef EXECUTOR_H
 #define EXECUTOR_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/resource.h>
+
 typedef struct process {
 	int pid;
 
+	/* path of the temporary script file, NULL if the script was passed to
+	 * the interpreter in-memory */
 	char *location;
 } process_t;
 
+/**
+ * @brief Options for launching a child process. Stdio descriptors which are
+ * set to -1 are inherited from mariebuild, an env of NULL inherits
+ * mariebuild's environment.
+ */
+typedef struct launch_opts {
+	int stdin_fd;
+	int stdout_fd;
+	int stderr_fd;
+
+	char **env;
+} launch_opts_t;
+
+#define LAUNCH_OPTS_DEFAULT \
+	{.stdin_fd = -1, .stdout_fd = -1, .stderr_fd = -1, .env = NULL}
+
+/**
+ * @brief Launch a child process via posix_spawn, which avoids copying
+ * mariebuild's page tables like fork() would.
+ * @param argv NULL-terminated argument vector, argv[0] has to be a path.
+ * @param opts Launch options, NULL for the defaults.
+ * @return The pid of the child process or -1 on failure.
+ */
+int mb_launch(char *const argv[], const launch_opts_t *opts);
+
 int mb_exec(char *script, char *name);
 
+int mb_exec_opts(char *script, char *name, const launch_opts_t *opts);
+
 process_t mb_exec_parallel(char *script, char *name);
 
+process_t mb_exec_parallel_opts(
+	char *script,
+	char *name,
+	const launch_opts_t *opts);
+
+/**
+ * @brief Reap one of the given processes. If block is set, this waits until
+ * one of them exits, without consuming CPU time while waiting. Slots with a
+ * pid of 0 are ignored.
+ * @param process_ix Output for the index of the process which exited.
+ * @param usage Output for the resource usage of the process and the
+ * children it waited for, may be NULL.
+ * @return The exit status of the process or -1 if none exited.
+ */
+int mb_wait_process(
+	process_t *processes,
+	size_t count,
+	size_t *process_ix,
+	bool block,
+	struct rusage *usage);
+
+/**
+ * @brief Create an anonymous file to capture the output of a child process
+ * in, which is closed on exec unless it is passed as one of its stdio
+ * descriptors.
+ * @return The file descriptor or -1 on failure.
+ */
+int mb_capture_open(const char *name);
+
+/**
+ * @brief Copy everything captured in fd to out_fd.
+ */
+bool mb_capture_replay(int fd, int out_fd);
+
 void mb_remove_script(char *script);
 
+/**
+ * @brief Remove the temporary script of a finished process, if it has one,
+ * and free its location.
+ */
+void mb_cleanup_process(process_t *process);
+
 #endif /* #ifndef EXECUTOR_H */
@@ -0,0 +1,682 @@
+/* filecache.c ; mariebuild compiled build file cache impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "filecache.h"
+#include "hash.h"
+#include "ioutil.h"
+#include "logging.h"
+#include "xmem.h"
+
+#define FILE_CACHE_MAGIC "MBFILE\0"
+#define FILE_CACHE_VERSION 1
+
+/* offset of a NULL name or value */
+#define FILE_CACHE_NULL UINT64_MAX
+
+#define PAD8(x) (((x) + 7) & ~(size_t)7)
+
+/*
+ * The header is followed by the sectors, sections, fields and lists and
+ * finally the strings, which hold all names and values. Sections, fields
+ * and lists refer to each other by index, names and values by their offset
+ * within the strings.
+ */
+
+typedef struct file_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+
+	uint64_t source_hash;
+	uint64_t source_size;
+
+	uint64_t sector_count;
+	uint64_t section_count;
+	uint64_t field_count;
+	uint64_t list_count;
+	/* ends in a terminator, so every string within it is terminated */
+	uint64_t strings_size;
+} file_cache_header_t;
+
+typedef struct file_cache_sector {
+	uint64_t name;
+	uint64_t section_count;
+	uint64_t first_section;
+} file_cache_sector_t;
+
+typedef struct file_cache_section {
+	uint64_t name;
+	uint64_t field_count;
+	uint64_t first_field;
+} file_cache_section_t;
+
+typedef struct file_cache_field {
+	uint64_t name;
+	int32_t type;
+	uint32_t reserved;
+	/* the index of the list for lists, otherwise the offset of the value */
+	uint64_t data;
+	uint64_t size;
+} file_cache_field_t;
+
+typedef struct file_cache_list {
+	int32_t type;
+	uint32_t reserved;
+	uint64_t field_count;
+	uint64_t first_field;
+} file_cache_list_t;
+
+/* the source of the file last loaded, the key of its cache */
+static uint64_t source_hash = 0;
+static uint64_t source_size = 0;
+static bool source_known = false;
+
+/* what was allocated for a file loaded from its cache */
+static void *map = NULL;
+static size_t map_size = 0;
+static mcfg_sector_t *loaded_sectors = NULL;
+static mcfg_section_t *loaded_sections = NULL;
+static mcfg_field_t *loaded_fields = NULL;
+static mcfg_list_t *loaded_lists = NULL;
+
+char *_file_cache_path(const char *path) {
+	size_t size = strlen(path) + strlen(FILE_CACHE_EXTENSION) + 1;
+	char *ret = XMALLOC(size);
+	snprintf(ret, size, "%s" FILE_CACHE_EXTENSION, path);
+	return ret;
+}
+
+/**
+ * @brief Whether count items starting at first lie within an array of the
+ * given size.
+ */
+bool _in_range(uint64_t first, uint64_t count, uint64_t size) {
+	return first <= size && count <= size - first;
+}
+
+bool _load_string(
+	const char *strings,
+	uint64_t size,
+	uint64_t offset,
+	char **str) {
+	if (offset == FILE_CACHE_NULL) {
+		*str = NULL;
+		return true;
+	}
+
+	if (offset >= size) {
+		return false;
+	}
+
+	*str = (char *)strings + offset;
+	return true;
+}
+
+/**
+ * @brief Turn the cached fields into mcfg fields pointing into the map.
+ */
+bool _load_fields(
+	const file_cache_header_t *header,
+	const file_cache_field_t *fields,
+	const file_cache_list_t *lists,
+	const char *strings) {
+	for (uint64_t ix = 0; ix < header->field_count; ix++) {
+		const file_cache_field_t *cached = &fields[ix];
+		mcfg_field_t *field = &loaded_fields[ix];
+
+		field->type = cached->type;
+		field->size = cached->size;
+		if (!_load_string(
+				strings, header->strings_size, cached->name, &field->name)) {
+			return false;
+		}
+
+		if (cached->type == TYPE_LIST) {
+			if (cached->data >= header->list_count) {
+				return false;
+			}
+			field->data = &loaded_lists[cached->data];
+			continue;
+		}
+
+		if (cached->type == TYPE_STRING) {
+			if (!_load_string(
+					strings, header->strings_size, cached->data,
+					(char **)&field->data)) {
+				return false;
+			}
+			continue;
+		}
+
+		ssize_t value_size = mcfg_sizeof(cached->type);
+		if (value_size < 0 ||
+			!_in_range(cached->data, value_size, header->strings_size)) {
+			return false;
+		}
+		field->data = (char *)strings + cached->data;
+	}
+
+	for (uint64_t ix = 0; ix < header->list_count; ix++) {
+		const file_cache_list_t *cached = &lists[ix];
+		if (!_in_range(
+				cached->first_field, cached->field_count,
+				header->field_count)) {
+			return false;
+		}
+
+		loaded_lists[ix] = (mcfg_list_t){
+			.type = cached->type,
+			.field_count = cached->field_count,
+			.fields = &loaded_fields[cached->first_field],
+		};
+	}
+
+	return true;
+}
+
+bool _load_sectors(
+	const file_cache_header_t *header,
+	const file_cache_sector_t *sectors,
+	const file_cache_section_t *sections,
+	const char *strings) {
+	for (uint64_t ix = 0; ix < header->section_count; ix++) {
+		const file_cache_section_t *cached = &sections[ix];
+		mcfg_section_t *section = &loaded_sections[ix];
+
+		if (!_in_range(
+				cached->first_field, cached->field_count,
+				header->field_count) ||
+			!_load_string(
+				strings, header->strings_size, cached->name,
+				&section->name)) {
+			return false;
+		}
+
+		section->field_count = cached->field_count;
+		section->fields = &loaded_fields[cached->first_field];
+	}
+
+	for (uint64_t ix = 0; ix < header->sector_count; ix++) {
+		const file_cache_sector_t *cached = &sectors[ix];
+		mcfg_sector_t *sector = &loaded_sectors[ix];
+
+		if (!_in_range(
+				cached->first_section, cached->section_count,
+				header->section_count) ||
+			!_load_string(
+				strings, header->strings_size, cached->name,
+				&sector->name)) {
+			return false;
+		}
+
+		sector->section_count = cached->section_count;
+		sector->sections = &loaded_sections[cached->first_section];
+	}
+
+	return true;
+}
+
+void _free_loaded(void) {
+	if (loaded_sectors != NULL) {
+		XFREE(loaded_sectors);
+		loaded_sectors = NULL;
+	}
+	if (loaded_sections != NULL) {
+		XFREE(loaded_sections);
+		loaded_sections = NULL;
+	}
+	if (loaded_fields != NULL) {
+		XFREE(loaded_fields);
+		loaded_fields = NULL;
+	}
+	if (loaded_lists != NULL) {
+		XFREE(loaded_lists);
+		loaded_lists = NULL;
+	}
+
+	if (map != NULL) {
+		munmap(map, map_size);
+		map = NULL;
+		map_size = 0;
+	}
+}
+
+/**
+ * @brief Map the cache of a file and check that it belongs to the current
+ * source.
+ */
+const file_cache_header_t *_map_cache(const char *cache_path) {
+	int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 ||
+		(size_t)st.st_size < sizeof(file_cache_header_t)) {
+		close(fd);
+		return NULL;
+	}
+
+	/* private and writable, mcfg does not take its values as const */
+	map_size = st.st_size;
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		map = NULL;
+		map_size = 0;
+		return NULL;
+	}
+
+	const file_cache_header_t *header = map;
+	if (memcmp(header->magic, FILE_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != FILE_CACHE_VERSION ||
+		header->source_hash != source_hash ||
+		header->source_size != source_size) {
+		return NULL;
+	}
+
+	return header;
+}
+
+bool _load_cache(const char *cache_path, mcfg_file_t *file) {
+	const file_cache_header_t *header = _map_cache(cache_path);
+	if (header == NULL) {
+		return false;
+	}
+
+	uint64_t counts[] = {
+		header->sector_count,
+		header->section_count,
+		header->field_count,
+		header->list_count,
+	};
+	uint64_t record_sizes[] = {
+		sizeof(file_cache_sector_t),
+		sizeof(file_cache_section_t),
+		sizeof(file_cache_field_t),
+		sizeof(file_cache_list_t),
+	};
+
+	uint64_t offset = sizeof(*header);
+	uint64_t offsets[4];
+	for (size_t ix = 0; ix < 4; ix++) {
+		if (counts[ix] > (map_size - offset) / record_sizes[ix]) {
+			return false;
+		}
+		offsets[ix] = offset;
+		offset += counts[ix] * record_sizes[ix];
+	}
+
+	const char *strings = (const char *)map + offset;
+	if (header->strings_size == 0 ||
+		map_size - offset != header->strings_size ||
+		strings[header->strings_size - 1] != '\0') {
+		return false;
+	}
+
+	loaded_sectors = XCALLOC(counts[0] + 1, sizeof(*loaded_sectors));
+	loaded_sections = XCALLOC(counts[1] + 1, sizeof(*loaded_sections));
+	loaded_fields = XCALLOC(counts[2] + 1, sizeof(*loaded_fields));
+	loaded_lists = XCALLOC(counts[3] + 1, sizeof(*loaded_lists));
+
+	const uint8_t *base = map;
+	if (!_load_fields(
+			header, (const file_cache_field_t *)(base + offsets[2]),
+			(const file_cache_list_t *)(base + offsets[3]), strings) ||
+		!_load_sectors(
+			header, (const file_cache_sector_t *)(base + offsets[0]),
+			(const file_cache_section_t *)(base + offsets[1]), strings)) {
+		return false;
+	}
+
+	*file = (mcfg_file_t){
+		.sector_count = header->sector_count,
+		.sectors = loaded_sectors,
+		.dynfield_count = 0,
+		.dynfields = NULL,
+	};
+	return true;
+}
+
+mcfg_parse_result_t mb_file_cache_load(const char *path, bool *cached) {
+	*cached = false;
+
+	struct stat st;
+	source_known = stat(path, &st) == 0 && mb_hash_file(path, &source_hash);
+	source_size = source_known ? (uint64_t)st.st_size : 0;
+
+	if (source_known) {
+		char *cache_path = _file_cache_path(path);
+		mcfg_file_t file;
+		*cached = _load_cache(cache_path, &file);
+		XFREE(cache_path);
+
+		if (*cached) {
+			mb_logf(LOG_DEBUG, "loaded \"%s\" from its cache\n", path);
+			return (mcfg_parse_result_t){.err = MCFG_OK, .value = file};
+		}
+
+		_free_loaded();
+	}
+
+	return mcfg_parse_from_file(path);
+}
+
+/* the cache while it is being written */
+struct cache_writer {
+	file_cache_sector_t *sectors;
+	size_t sector_count;
+	file_cache_section_t *sections;
+	size_t section_count;
+	size_t section_capacity;
+	file_cache_field_t *fields;
+	size_t field_count;
+	size_t field_capacity;
+	file_cache_list_t *lists;
+	size_t list_count;
+	size_t list_capacity;
+
+	char *strings;
+	size_t strings_size;
+	size_t strings_capacity;
+};
+
+/**
+ * @brief Reserve room for count items in one of the writer's arrays.
+ * @return Index of the first reserved item.
+ */
+size_t _writer_reserve(
+	void **items,
+	size_t *count,
+	size_t *capacity,
+	size_t item_size,
+	size_t reserved) {
+	if (*count + reserved > *capacity) {
+		while (*count + reserved > *capacity) {
+			*capacity = *capacity == 0 ? 64 : *capacity * 2;
+		}
+		*items = XREALLOC(*items, *capacity * item_size);
+	}
+
+	size_t first = *count;
+	*count += reserved;
+	return first;
+}
+
+uint64_t _writer_add_data(
+	struct cache_writer *writer,
+	const void *data,
+	size_t size) {
+	size_t offset = PAD8(writer->strings_size);
+	size_t length = offset - writer->strings_size + size;
+
+	void *strings = writer->strings;
+	_writer_reserve(
+		&strings, &writer->strings_size, &writer->strings_capacity, 1,
+		length);
+	writer->strings = strings;
+
+	memset(writer->strings + offset - (length - size), 0, length - size);
+	memcpy(writer->strings + offset, data, size);
+	return offset;
+}
+
+uint64_t _writer_add_string(struct cache_writer *writer, const char *str) {
+	if (str == NULL) {
+		return FILE_CACHE_NULL;
+	}
+
+	size_t size = strlen(str) + 1;
+	void *strings = writer->strings;
+	size_t offset = _writer_reserve(
+		&strings, &writer->strings_size, &writer->strings_capacity, 1, size);
+	writer->strings = strings;
+
+	memcpy(writer->strings + offset, str, size);
+	return offset;
+}
+
+bool _writer_add_fields(struct cache_writer *writer, const mcfg_field_t *fields,
+						size_t count, uint64_t *first);
+
+bool _writer_add_field(
+	struct cache_writer *writer,
+	const mcfg_field_t *field,
+	size_t ix) {
+	file_cache_field_t cached = {
+		.name = _writer_add_string(writer, field->name),
+		.type = field->type,
+		.size = field->size,
+	};
+
+	if (field->type == TYPE_LIST && field->data != NULL) {
+		const mcfg_list_t *list = field->data;
+
+		void *lists = writer->lists;
+		size_t list_ix = _writer_reserve(
+			&lists, &writer->list_count, &writer->list_capacity,
+			sizeof(*writer->lists), 1);
+		writer->lists = lists;
+
+		uint64_t first;
+		if (!_writer_add_fields(writer, list->fields, list->field_count,
+								&first)) {
+			return false;
+		}
+
+		writer->lists[list_ix] = (file_cache_list_t){
+			.type = list->type,
+			.field_count = list->field_count,
+			.first_field = first,
+		};
+		cached.data = list_ix;
+	} else if (field->type == TYPE_STRING || field->data == NULL) {
+		if (field->type != TYPE_STRING) {
+			return false;
+		}
+		cached.data = _writer_add_string(writer, field->data);
+	} else {
+		ssize_t value_size = mcfg_sizeof(field->type);
+		if (value_size < 0) {
+			return false;
+		}
+		cached.data = _writer_add_data(writer, field->data, value_size);
+	}
+
+	writer->fields[ix] = cached;
+	return true;
+}
+
+/**
+ * @brief Add fields, which are kept next to each other ahead of the fields
+ * of any list among them.
+ */
+bool _writer_add_fields(struct cache_writer *writer, const mcfg_field_t *fields,
+						size_t count, uint64_t *first) {
+	void *items = writer->fields;
+	*first = _writer_reserve(
+		&items, &writer->field_count, &writer->field_capacity,
+		sizeof(*writer->fields), count);
+	writer->fields = items;
+
+	for (size_t ix = 0; ix < count; ix++) {
+		if (!_writer_add_field(writer, &fields[ix], *first + ix)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool _writer_add_file(struct cache_writer *writer, const mcfg_file_t *file) {
+	writer->sector_count = file->sector_count;
+	writer->sectors =
+		XCALLOC(file->sector_count + 1, sizeof(*writer->sectors));
+
+	for (size_t sector_ix = 0; sector_ix < file->sector_count; sector_ix++) {
+		const mcfg_sector_t *sector = &file->sectors[sector_ix];
+
+		void *sections = writer->sections;
+		size_t first_section = _writer_reserve(
+			&sections, &writer->section_count, &writer->section_capacity,
+			sizeof(*writer->sections), sector->section_count);
+		writer->sections = sections;
+
+		writer->sectors[sector_ix] = (file_cache_sector_t){
+			.name = _writer_add_string(writer, sector->name),
+			.section_count = sector->section_count,
+			.first_section = first_section,
+		};
+
+		for (size_t section_ix = 0; section_ix < sector->section_count;
+			 section_ix++) {
+			const mcfg_section_t *section = &sector->sections[section_ix];
+
+			uint64_t first_field;
+			if (!_writer_add_fields(
+					writer, section->fields, section->field_count,
+					&first_field)) {
+				return false;
+			}
+
+			writer->sections[first_section + section_ix] =
+				(file_cache_section_t){
+					.name = _writer_add_string(writer, section->name),
+					.field_count = section->field_count,
+					.first_field = first_field,
+				};
+		}
+	}
+
+	/* terminates the strings, see file_cache_header_t */
+	_writer_add_string(writer, "");
+	return true;
+}
+
+bool _write_cache(const char *cache_path, struct cache_writer *writer) {
+	file_cache_header_t header = {
+		.magic = FILE_CACHE_MAGIC,
+		.version = FILE_CACHE_VERSION,
+		.reserved = 0,
+		.source_hash = source_hash,
+		.source_size = source_size,
+		.sector_count = writer->sector_count,
+		.section_count = writer->section_count,
+		.field_count = writer->field_count,
+		.list_count = writer->list_count,
+		.strings_size = writer->strings_size,
+	};
+
+	size_t tmp_path_size = strlen(cache_path) + 5;
+	char *tmp_path = XMALLOC(tmp_path_size);
+	snprintf(tmp_path, tmp_path_size, "%s.tmp", cache_path);
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	bool ok = fd >= 0 && mb_write_all(fd, &header, sizeof(header)) &&
+			  mb_write_all(
+				  fd, writer->sectors,
+				  writer->sector_count * sizeof(*writer->sectors)) &&
+			  mb_write_all(
+				  fd, writer->sections,
+				  writer->section_count * sizeof(*writer->sections)) &&
+			  mb_write_all(
+				  fd, writer->fields,
+				  writer->field_count * sizeof(*writer->fields)) &&
+			  mb_write_all(
+				  fd, writer->lists,
+				  writer->list_count * sizeof(*writer->lists)) &&
+			  mb_write_all(fd, writer->strings, writer->strings_size);
+
+	if (fd >= 0) {
+		ok = close(fd) == 0 && ok;
+	}
+
+	ok = ok && rename(tmp_path, cache_path) == 0;
+	if (!ok) {
+		unlink(tmp_path);
+	}
+
+	XFREE(tmp_path);
+	return ok;
+}
+
+void mb_file_cache_store(const char *path, const mcfg_file_t *file) {
+	if (!source_known || file->sectors == loaded_sectors) {
+		return;
+	}
+
+	struct cache_writer writer = {0};
+	char *cache_path = _file_cache_path(path);
+
+	if (!_writer_add_file(&writer, file)) {
+		mb_log(LOG_DEBUG, "build file can not be cached\n");
+	} else if (!_write_cache(cache_path, &writer)) {
+		mb_logf(
+			LOG_DEBUG, "could not write \"%s\": %s\n", cache_path,
+			strerror(errno));
+	}
+
+	XFREE(cache_path);
+
+	void *arrays[] = {
+		writer.sectors, writer.sections, writer.fields, writer.lists,
+		writer.strings,
+	};
+	for (size_t ix = 0; ix < sizeof(arrays) / sizeof(*arrays); ix++) {
+		if (arrays[ix] != NULL) {
+			XFREE(arrays[ix]);
+		}
+	}
+}
+
+void mb_file_cache_remove(const char *path) {
+	char *cache_path = _file_cache_path(path);
+	if (unlink(cache_path) == 0) {
+		mb_logf(LOG_DEBUG, "removed \"%s\"\n", cache_path);
+	}
+
+	XFREE(cache_path);
+}
+
+void mb_file_cache_free(mcfg_file_t file) {
+	if (file.sectors == NULL || file.sectors != loaded_sectors) {
+		mcfg_free_file(file);
+		return;
+	}
+
+	/* dynfields are all added by mariebuild, as for mcfg_free_file */
+	for (size_t ix = 0; ix < file.dynfield_count; ix++) {
+		if (file.dynfields[ix].name != NULL) {
+			XFREE(file.dynfields[ix].name);
+		}
+		if (file.dynfields[ix].data != NULL) {
+			XFREE(file.dynfields[ix].data);
+		}
+	}
+	if (file.dynfields != NULL) {
+		XFREE(file.dynfields);
+	}
+
+	_free_loaded();
+}
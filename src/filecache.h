@@ -0,0 +1,45 @@
+/* filecache.h ; mariebuild compiled build file cache header
+ *
+ * The parsed and validated build file is stored next to it in a binary,
+ * position independent form, keyed by the hash of its source. Later runs
+ * map the cache instead of parsing the file again, only the structures mcfg
+ * expects are allocated, all names and values point into the mapping.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <stdbool.h>
+
+#include "mcfg.h"
+
+#define FILE_CACHE_EXTENSION ".cache"
+
+/**
+ * @brief Load a build file from its cache if that matches the file's
+ * contents, otherwise parse it.
+ * @param cached Set to whether the file was loaded from its cache.
+ */
+mcfg_parse_result_t mb_file_cache_load(const char *path, bool *cached);
+
+/**
+ * @brief Write the cache of a file which was parsed by mb_file_cache_load.
+ * Files of types the cache can not represent are not cached.
+ */
+void mb_file_cache_store(const char *path, const mcfg_file_t *file);
+
+/**
+ * @brief Remove the cache of a file, so that later runs parse it again.
+ */
+void mb_file_cache_remove(const char *path);
+
+/**
+ * @brief Free a file loaded by mb_file_cache_load, whichever way it was
+ * loaded.
+ */
+void mb_file_cache_free(mcfg_file_t file);
+
+#endif /* #ifndef FILECACHE_H */
@@ -0,0 +1,344 @@
+/* fileindex.c ; mariebuild build file index impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fileindex.h"
+#include "hash.h"
+#include "logging.h"
+#include "stats.h"
+#include "xmem.h"
+
+/* sectors, sections and fields, keyed by their parent and name */
+typedef struct index_entry {
+	const void *parent;
+	const char *name;
+	/* NULL if the entry is empty */
+	void *item;
+} index_entry_t;
+
+typedef struct dynfield_slot {
+	/* NULL if the slot is empty */
+	const char *name;
+	uint64_t hash;
+	size_t ix;
+} dynfield_slot_t;
+
+static const mcfg_sector_t *indexed_sectors = NULL;
+static index_entry_t *entries = NULL;
+static size_t entry_capacity = 0;
+
+static mcfg_file_t *dynfield_file = NULL;
+static dynfield_slot_t *dynfield_slots = NULL;
+static size_t dynfield_slot_capacity = 0;
+/* capacity of the file's dynfield array */
+static size_t dynfield_capacity = 0;
+
+uint64_t _entry_hash(const void *parent, const char *name) {
+	return mb_hash64(name, strlen(name), (uint64_t)(uintptr_t)parent);
+}
+
+size_t _entry_slot(const void *parent, const char *name) {
+	size_t mask = entry_capacity - 1;
+	size_t pos = _entry_hash(parent, name) & mask;
+
+	while (entries[pos].item != NULL &&
+		   (entries[pos].parent != parent ||
+			strcmp(entries[pos].name, name) != 0)) {
+		pos = (pos + 1) & mask;
+	}
+
+	return pos;
+}
+
+void _entry_insert(const void *parent, const char *name, void *item) {
+	size_t pos = _entry_slot(parent, name);
+
+	/* the first of several items with the same name wins, as with mcfg */
+	if (entries[pos].item == NULL) {
+		entries[pos] = (index_entry_t){
+			.parent = parent,
+			.name = name,
+			.item = item,
+		};
+	}
+}
+
+void *_entry_find(const void *parent, const char *name) {
+	return entries[_entry_slot(parent, name)].item;
+}
+
+/**
+ * @brief Smallest power of two which is at least twice the given count.
+ */
+size_t _table_capacity(size_t count) {
+	size_t capacity = 64;
+	while (capacity < count * 2) {
+		capacity *= 2;
+	}
+
+	return capacity;
+}
+
+size_t _dynfield_slot(const char *name, uint64_t hash) {
+	size_t mask = dynfield_slot_capacity - 1;
+	size_t pos = hash & mask;
+
+	while (dynfield_slots[pos].name != NULL &&
+		   (dynfield_slots[pos].hash != hash ||
+			strcmp(dynfield_slots[pos].name, name) != 0)) {
+		pos = (pos + 1) & mask;
+	}
+
+	return pos;
+}
+
+void _dynfield_insert(const char *name, size_t ix);
+
+void _dynfield_grow_slots(void) {
+	dynfield_slot_t *old = dynfield_slots;
+	size_t old_capacity = dynfield_slot_capacity;
+
+	dynfield_slot_capacity =
+		old_capacity == 0 ? _table_capacity(0) : old_capacity * 2;
+	dynfield_slots =
+		XCALLOC(dynfield_slot_capacity, sizeof(*dynfield_slots));
+
+	for (size_t ix = 0; ix < old_capacity; ix++) {
+		if (old[ix].name != NULL) {
+			dynfield_slots[_dynfield_slot(old[ix].name, old[ix].hash)] =
+				old[ix];
+		}
+	}
+
+	if (old != NULL) {
+		XFREE(old);
+	}
+}
+
+void _dynfield_insert(const char *name, size_t ix) {
+	/* keep the table at most half full */
+	if ((dynfield_file->dynfield_count + 1) * 2 > dynfield_slot_capacity) {
+		_dynfield_grow_slots();
+	}
+
+	uint64_t hash = mb_hash_str(name);
+	dynfield_slots[_dynfield_slot(name, hash)] = (dynfield_slot_t){
+		.name = name,
+		.hash = hash,
+		.ix = ix,
+	};
+}
+
+/**
+ * @brief Empty a slot, moving the slots after it back so that no probe
+ * sequence is interrupted.
+ */
+void _dynfield_delete(size_t pos) {
+	size_t mask = dynfield_slot_capacity - 1;
+	size_t hole = pos;
+
+	for (size_t next = (pos + 1) & mask; dynfield_slots[next].name != NULL;
+		 next = (next + 1) & mask) {
+		size_t home = dynfield_slots[next].hash & mask;
+
+		/* the slot may only move back if the hole is not before its home */
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			dynfield_slots[hole] = dynfield_slots[next];
+			hole = next;
+		}
+	}
+
+	dynfield_slots[hole].name = NULL;
+}
+
+void mb_index_build(mcfg_file_t *file) {
+	mb_index_destroy();
+
+	size_t count = file->sector_count;
+	for (size_t sector_ix = 0; sector_ix < file->sector_count; sector_ix++) {
+		mcfg_sector_t *sector = &file->sectors[sector_ix];
+		count += sector->section_count;
+
+		for (size_t section_ix = 0; section_ix < sector->section_count;
+			 section_ix++) {
+			count += sector->sections[section_ix].field_count;
+		}
+	}
+
+	entry_capacity = _table_capacity(count);
+	entries = XCALLOC(entry_capacity, sizeof(*entries));
+	indexed_sectors = file->sectors;
+
+	for (size_t sector_ix = 0; sector_ix < file->sector_count; sector_ix++) {
+		mcfg_sector_t *sector = &file->sectors[sector_ix];
+		_entry_insert(file->sectors, sector->name, sector);
+
+		for (size_t section_ix = 0; section_ix < sector->section_count;
+			 section_ix++) {
+			mcfg_section_t *section = &sector->sections[section_ix];
+			_entry_insert(sector, section->name, section);
+
+			for (size_t field_ix = 0; field_ix < section->field_count;
+				 field_ix++) {
+				mcfg_field_t *field = &section->fields[field_ix];
+				_entry_insert(section, field->name, field);
+			}
+		}
+	}
+
+	dynfield_file = file;
+	dynfield_capacity = file->dynfield_count;
+	_dynfield_grow_slots();
+	for (size_t ix = 0; ix < file->dynfield_count; ix++) {
+		_dynfield_insert(file->dynfields[ix].name, ix);
+	}
+
+	mb_logf(LOG_DEBUG, "indexed %zu sectors, sections and fields\n", count);
+}
+
+void mb_index_destroy(void) {
+	if (entries != NULL) {
+		XFREE(entries);
+		entries = NULL;
+	}
+	entry_capacity = 0;
+	indexed_sectors = NULL;
+
+	if (dynfield_slots != NULL) {
+		XFREE(dynfield_slots);
+		dynfield_slots = NULL;
+	}
+	dynfield_slot_capacity = 0;
+	dynfield_capacity = 0;
+	dynfield_file = NULL;
+}
+
+mcfg_sector_t *mb_get_sector(mcfg_file_t *file, char *name) {
+	if (entries == NULL || file->sectors != indexed_sectors) {
+		return mcfg_get_sector(file, name);
+	}
+
+	return _entry_find(file->sectors, name);
+}
+
+mcfg_section_t *mb_get_section(mcfg_sector_t *sector, char *name) {
+	if (entries == NULL || sector == NULL) {
+		return mcfg_get_section(sector, name);
+	}
+
+	return _entry_find(sector, name);
+}
+
+mcfg_field_t *mb_get_field(mcfg_section_t *section, char *name) {
+	if (entries == NULL || section == NULL) {
+		return mcfg_get_field(section, name);
+	}
+
+	return _entry_find(section, name);
+}
+
+mcfg_field_t *mb_get_dynfield(mcfg_file_t *file, char *name) {
+	if (file != dynfield_file) {
+		return mcfg_get_dynfield(file, name);
+	}
+
+	dynfield_slot_t *slot =
+		&dynfield_slots[_dynfield_slot(name, mb_hash_str(name))];
+	return slot->name != NULL ? &file->dynfields[slot->ix] : NULL;
+}
+
+mcfg_field_t *mb_get_field_by_path(mcfg_file_t *file, mcfg_path_t path) {
+	if (path.dynfield_path && path.field != NULL) {
+		return mb_get_dynfield(file, path.field);
+	}
+
+	if (path.sector == NULL || path.section == NULL || path.field == NULL) {
+		return mcfg_get_field_by_path(file, path);
+	}
+
+	mcfg_sector_t *sector = mb_get_sector(file, path.sector);
+	if (sector == NULL) {
+		return NULL;
+	}
+
+	mcfg_section_t *section = mb_get_section(sector, path.section);
+	if (section == NULL) {
+		return NULL;
+	}
+
+	return mb_get_field(section, path.field);
+}
+
+mcfg_err_t mb_dynfield_push(mcfg_file_t *file, mcfg_field_t field) {
+	if (file != dynfield_file) {
+		MB_STAT_INC(STAT_DYNFIELD_LINKS);
+		return mcfg_add_dynfield(
+			file, field.type, field.name, field.data, field.size);
+	}
+
+	if (mb_get_dynfield(file, field.name) != NULL) {
+		return MCFG_DUPLICATE_DYNFIELD;
+	}
+
+	if (file->dynfield_count == dynfield_capacity) {
+		dynfield_capacity = dynfield_capacity == 0 ? 16 : dynfield_capacity * 2;
+		file->dynfields = XREALLOC(
+			file->dynfields, dynfield_capacity * sizeof(*file->dynfields));
+	}
+
+	file->dynfields[file->dynfield_count] = field;
+	_dynfield_insert(field.name, file->dynfield_count);
+	file->dynfield_count++;
+	MB_STAT_INC(STAT_DYNFIELD_LINKS);
+
+	return MCFG_OK;
+}
+
+bool mb_dynfield_remove(mcfg_file_t *file, char *name) {
+	ssize_t field_ix = -1;
+	size_t slot = 0;
+
+	if (file == dynfield_file) {
+		slot = _dynfield_slot(name, mb_hash_str(name));
+		if (dynfield_slots[slot].name != NULL) {
+			field_ix = dynfield_slots[slot].ix;
+		}
+	} else {
+		for (size_t ix = 0; ix < file->dynfield_count; ix++) {
+			if (strcmp(file->dynfields[ix].name, name) == 0) {
+				field_ix = ix;
+				break;
+			}
+		}
+	}
+
+	if (field_ix == -1) {
+		return false;
+	}
+
+	if (file == dynfield_file) {
+		_dynfield_delete(slot);
+	}
+
+	file->dynfield_count--;
+
+	/* only dynfields which were not removed in reverse order are moved */
+	for (size_t ix = field_ix; ix < file->dynfield_count; ix++) {
+		file->dynfields[ix] = file->dynfields[ix + 1];
+
+		if (file == dynfield_file) {
+			const char *moved = file->dynfields[ix].name;
+			dynfield_slots[_dynfield_slot(moved, mb_hash_str(moved))].ix = ix;
+		}
+	}
+
+	MB_STAT_INC(STAT_DYNFIELD_UNLINKS);
+	return true;
+}
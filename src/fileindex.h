@@ -0,0 +1,60 @@
+/* fileindex.h ; mariebuild build file index header
+ *
+ * Hash index over the sectors, sections and fields of the parsed build file
+ * and over its dynfields, which replaces the linear lookups of mcfg. The
+ * dynfields mariebuild adds are pushed onto and popped off the end of the
+ * dynfield array like a stack.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef FILEINDEX_H
+#define FILEINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mcfg.h"
+#include "mcfg_util.h"
+
+/**
+ * @brief Index the given file. Sectors, sections and fields must not be
+ * added to it afterwards, dynfields only through mb_dynfield_push.
+ */
+void mb_index_build(mcfg_file_t *file);
+
+void mb_index_destroy(void);
+
+/*
+ * Lookups behave like their mcfg counterparts, which they fall back to for
+ * files which are not indexed.
+ */
+
+mcfg_sector_t *mb_get_sector(mcfg_file_t *file, char *name);
+
+mcfg_section_t *mb_get_section(mcfg_sector_t *sector, char *name);
+
+mcfg_field_t *mb_get_field(mcfg_section_t *section, char *name);
+
+/**
+ * @brief Look up a dynfield. The pointer is only valid until the next
+ * dynfield is pushed or popped.
+ */
+mcfg_field_t *mb_get_dynfield(mcfg_file_t *file, char *name);
+
+mcfg_field_t *mb_get_field_by_path(mcfg_file_t *file, mcfg_path_t path);
+
+/**
+ * @brief Add a dynfield to the end of the file's dynfields.
+ * @return MCFG_DUPLICATE_DYNFIELD if there already is one with its name.
+ */
+mcfg_err_t mb_dynfield_push(mcfg_file_t *file, mcfg_field_t field);
+
+/**
+ * @brief Remove a dynfield, which is O(1) if it was the last one pushed.
+ * @return Whether there was a dynfield with the given name.
+ */
+bool mb_dynfield_remove(mcfg_file_t *file, char *name);
+
+#endif /* #ifndef FILEINDEX_H */
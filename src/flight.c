@@ -0,0 +1,255 @@
+/* flight.c ; mariebuild flight recorder impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "flight.h"
+#include "ioutil.h"
+#include "timeutil.h"
+#include "xmem.h"
+
+/* fields are atomics so that a slot being overwritten while it is dumped
+ * is not a data race, seq tells whether it was */
+typedef struct flight_slot {
+	/* index of the event + 1, 0 while it is written */
+	atomic_uint_fast64_t seq;
+
+	_Atomic uint64_t time;
+	_Atomic int kind;
+	_Atomic(const char *) name;
+	_Atomic int slot;
+	_Atomic int pid;
+	_Atomic int64_t element;
+	_Atomic int status;
+	_Atomic uint64_t duration;
+} flight_slot_t;
+
+static flight_slot_t ring[FLIGHT_EVENTS];
+static atomic_uint_fast64_t next_event = 0;
+static atomic_bool recording = false;
+
+static char *flight_path = NULL;
+static uint64_t flight_start = 0;
+
+static const char *kind_names[FLIGHT_KIND_COUNT] = {
+	[FLIGHT_TARGET_START] = "target_start",
+	[FLIGHT_TARGET_END] = "target_end",
+	[FLIGHT_RULE_START] = "rule_start",
+	[FLIGHT_RULE_END] = "rule_end",
+	[FLIGHT_JOB_START] = "job_start",
+	[FLIGHT_JOB_EXIT] = "job_exit",
+	[FLIGHT_CHECK] = "check",
+};
+
+const char *_flight_kind_name(flight_kind_t kind) {
+	return (unsigned int)kind < FLIGHT_KIND_COUNT ? kind_names[kind]
+												  : "unknown";
+}
+
+void mb_flight_open(const char *path) {
+	if (path == NULL) {
+		return;
+	}
+
+	flight_path = strdup(path);
+	flight_start = mb_monotonic_ns();
+	atomic_store_explicit(&recording, true, memory_order_release);
+}
+
+void mb_flight_close(void) {
+	atomic_store_explicit(&recording, false, memory_order_release);
+
+	if (flight_path != NULL) {
+		XFREE(flight_path);
+		flight_path = NULL;
+	}
+}
+
+void mb_flight_record(flight_event_t event) {
+	if (!atomic_load_explicit(&recording, memory_order_relaxed)) {
+		return;
+	}
+
+	uint64_t ix =
+		atomic_fetch_add_explicit(&next_event, 1, memory_order_relaxed);
+	flight_slot_t *slot = &ring[ix & (FLIGHT_EVENTS - 1)];
+
+	atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	atomic_store_explicit(&slot->time, mb_monotonic_ns(), memory_order_relaxed);
+	atomic_store_explicit(&slot->kind, event.kind, memory_order_relaxed);
+	atomic_store_explicit(&slot->name, event.name, memory_order_relaxed);
+	atomic_store_explicit(&slot->slot, event.slot, memory_order_relaxed);
+	atomic_store_explicit(&slot->pid, event.pid, memory_order_relaxed);
+	atomic_store_explicit(&slot->element, event.element, memory_order_relaxed);
+	atomic_store_explicit(&slot->status, event.status, memory_order_relaxed);
+	atomic_store_explicit(
+		&slot->duration, event.duration, memory_order_relaxed);
+
+	atomic_store_explicit(&slot->seq, ix + 1, memory_order_release);
+}
+
+/* a line of the dump, assembled without stdio to stay signal-safe */
+typedef struct flight_line {
+	char data[512];
+	size_t length;
+} flight_line_t;
+
+void _line_str(flight_line_t *line, const char *str) {
+	if (str == NULL) {
+		str = "-";
+	}
+
+	while (*str != '\0' && line->length < sizeof(line->data) - 1) {
+		line->data[line->length++] = *str++;
+	}
+}
+
+void _line_u64(flight_line_t *line, uint64_t value) {
+	char digits[20];
+	size_t count = 0;
+
+	do {
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+
+	while (count > 0 && line->length < sizeof(line->data) - 1) {
+		line->data[line->length++] = digits[--count];
+	}
+}
+
+void _line_i64(flight_line_t *line, int64_t value) {
+	if (value < 0) {
+		_line_str(line, "-");
+		_line_u64(line, -(uint64_t)value);
+		return;
+	}
+
+	_line_u64(line, (uint64_t)value);
+}
+
+/**
+ * @brief Write a line and start the next one.
+ */
+bool _line_flush(int fd, flight_line_t *line) {
+	line->data[line->length++] = '\n';
+
+	size_t size = line->length;
+	line->length = 0;
+
+	return mb_write_all(fd, line->data, size);
+}
+
+/**
+ * @brief Copy a slot of the ring, unless it is being written or was
+ * overwritten since event ix was recorded into it.
+ */
+bool _read_slot(uint64_t ix, flight_event_t *event, uint64_t *time) {
+	flight_slot_t *slot = &ring[ix & (FLIGHT_EVENTS - 1)];
+	if (atomic_load_explicit(&slot->seq, memory_order_acquire) != ix + 1) {
+		return false;
+	}
+
+	*time = atomic_load_explicit(&slot->time, memory_order_relaxed);
+	*event = (flight_event_t){
+		.kind = atomic_load_explicit(&slot->kind, memory_order_relaxed),
+		.name = atomic_load_explicit(&slot->name, memory_order_relaxed),
+		.slot = atomic_load_explicit(&slot->slot, memory_order_relaxed),
+		.pid = atomic_load_explicit(&slot->pid, memory_order_relaxed),
+		.element = atomic_load_explicit(&slot->element, memory_order_relaxed),
+		.status = atomic_load_explicit(&slot->status, memory_order_relaxed),
+		.duration =
+			atomic_load_explicit(&slot->duration, memory_order_relaxed),
+	};
+
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&slot->seq, memory_order_relaxed) == ix + 1;
+}
+
+bool _flight_dump(const char *reason, int signal) {
+	if (!atomic_load_explicit(&recording, memory_order_acquire)) {
+		return false;
+	}
+
+	int fd = open(flight_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+
+	uint64_t end = atomic_load_explicit(&next_event, memory_order_acquire);
+	uint64_t begin = end > FLIGHT_EVENTS ? end - FLIGHT_EVENTS : 0;
+
+	flight_line_t line = {.length = 0};
+	_line_str(&line, "# mariebuild flight recorder: ");
+	_line_str(&line, reason);
+	if (signal != 0) {
+		_line_i64(&line, signal);
+	}
+	_line_str(&line, ", ");
+	_line_u64(&line, end - begin);
+	_line_str(&line, " of ");
+	_line_u64(&line, end);
+	_line_str(&line, " events");
+	bool ok = _line_flush(fd, &line);
+
+	_line_str(&line, "# time_us event name slot pid element status ");
+	_line_str(&line, "duration_us");
+	ok = ok && _line_flush(fd, &line);
+
+	for (uint64_t ix = begin; ok && ix < end; ix++) {
+		flight_event_t event;
+		uint64_t time;
+		if (!_read_slot(ix, &event, &time)) {
+			continue;
+		}
+
+		uint64_t since = time > flight_start ? time - flight_start : 0;
+		_line_u64(&line, since / 1000);
+		_line_str(&line, " ");
+		_line_str(&line, _flight_kind_name(event.kind));
+		_line_str(&line, " ");
+		_line_str(&line, event.name);
+		_line_str(&line, " ");
+		_line_i64(&line, event.slot);
+		_line_str(&line, " ");
+		_line_i64(&line, event.pid);
+		_line_str(&line, " ");
+		_line_i64(&line, event.element);
+		_line_str(&line, " ");
+		_line_i64(&line, event.status);
+		_line_str(&line, " ");
+		_line_u64(&line, event.duration / 1000);
+		ok = _line_flush(fd, &line);
+	}
+
+	close(fd);
+	return ok;
+}
+
+bool mb_flight_dump(const char *reason) {
+	return _flight_dump(reason, 0);
+}
+
+bool mb_flight_dump_signal(int signal) {
+	return _flight_dump("signal ", signal);
+}
+
+const char *mb_flight_path(void) {
+	return atomic_load_explicit(&recording, memory_order_acquire) ? flight_path
+																  : NULL;
+}
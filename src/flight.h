@@ -0,0 +1,89 @@
+/* flight.h ; mariebuild flight recorder header
+ *
+ * Keeps the last FLIGHT_EVENTS scheduler events in a lock-free ring, so
+ * that the order in which jobs ran and were decided on can be told apart
+ * after a failed or killed build, unlike with the interleaved log output.
+ * The ring is dumped to a file when the build fails or mariebuild is
+ * stopped by a signal.
+ *
+ * Recording an event is a clock read and a few relaxed stores, it is safe
+ * from any thread. Names are not copied, they have to stay valid until the
+ * recorder is closed.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FLIGHT_DEFAULT_PATH ".mb_flight"
+
+/* has to be a power of two */
+#define FLIGHT_EVENTS 4096
+
+typedef enum flight_kind {
+	FLIGHT_TARGET_START = 0,
+	FLIGHT_TARGET_END,
+	FLIGHT_RULE_START,
+	FLIGHT_RULE_END,
+	FLIGHT_JOB_START,
+	FLIGHT_JOB_EXIT,
+	/* whether an element was outdated, given as status */
+	FLIGHT_CHECK,
+	FLIGHT_KIND_COUNT
+} flight_kind_t;
+
+typedef struct flight_event {
+	flight_kind_t kind;
+	/* the target, c_rule or job group */
+	const char *name;
+	/* -1 if the event has none of them */
+	int slot;
+	int pid;
+	int64_t element;
+
+	int status;
+	/* of a job, 0 for other events */
+	uint64_t duration;
+} flight_event_t;
+
+#define FLIGHT_EVENT(k, n)                                             \
+	((flight_event_t){.kind = (k), .name = (n), .slot = -1, .pid = -1, \
+					  .element = -1, .status = 0, .duration = 0})
+
+/**
+ * @brief Start recording, the ring is dumped to path. Has to be called
+ * before any other threads are started.
+ */
+void mb_flight_open(const char *path);
+
+/**
+ * @brief Stop recording, nothing is dumped afterwards.
+ */
+void mb_flight_close(void);
+
+void mb_flight_record(flight_event_t event);
+
+/**
+ * @brief Write the recorded events to the file given to mb_flight_open.
+ * Only uses async-signal-safe functions.
+ * @param reason Written to the head of the file.
+ * @return Whether the file was written.
+ */
+bool mb_flight_dump(const char *reason);
+
+/**
+ * @brief Like mb_flight_dump, for the handlers of terminating signals.
+ */
+bool mb_flight_dump_signal(int signal);
+
+/**
+ * @return The path the recorder is dumped to, NULL if it is closed.
+ */
+const char *mb_flight_path(void);
+
+#endif /* #ifndef FLIGHT_H */
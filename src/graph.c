@@ -0,0 +1,1102 @@
+/* graph.c ; mariebuild build graph impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 2
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "c_rule.h"
+#include "cptrlist.h"
+#include "fileindex.h"
+#include "flight.h"
+#include "graph.h"
+#include "jobs.h"
+#include "logging.h"
+#include "mcfg.h"
+#include "mcfg_util.h"
+#include "probes.h"
+#include "summary.h"
+#include "target.h"
+#include "trace.h"
+#include "types.h"
+#include "xmem.h"
+
+#define TARGET 0
+#define C_RULE 1
+
+#define GRAPH_LOOKUP_INITIAL_CAPACITY 64
+
+void _index_list_append(index_list_t *list, size_t item) {
+	if (list->size == list->capacity) {
+		list->capacity = list->capacity == 0 ? 4 : list->capacity * 2;
+		list->items =
+			XREALLOC(list->items, list->capacity * sizeof(*list->items));
+	}
+
+	list->items[list->size++] = item;
+}
+
+void _index_list_free(index_list_t *list) {
+	if (list->items != NULL) {
+		XFREE(list->items);
+	}
+
+	*list = (index_list_t){0};
+}
+
+char *_node_kind_name(graph_node_kind_t kind) {
+	return kind == NODE_TARGET ? "target" : "c_rule";
+}
+
+size_t _lookup_hash(mcfg_section_t *section, ssize_t scope) {
+	uint64_t hash = (uint64_t)(uintptr_t)section;
+	hash ^= (uint64_t)(scope + 1) * 0x9e3779b97f4a7c15ULL;
+	hash ^= hash >> 29;
+	hash *= 0xbf58476d1ce4e5b9ULL;
+	hash ^= hash >> 32;
+	return (size_t)hash;
+}
+
+/**
+ * @brief The scope a node is looked up by. Targets are only added once, no
+ * matter which target required them.
+ */
+ssize_t _lookup_scope(graph_node_kind_t kind, ssize_t scope) {
+	return kind == NODE_TARGET ? -1 : scope;
+}
+
+ssize_t _find_node(
+	build_graph_t *graph,
+	graph_node_kind_t kind,
+	mcfg_section_t *section,
+	ssize_t scope) {
+	scope = _lookup_scope(kind, scope);
+
+	size_t mask = graph->lookup_capacity - 1;
+	size_t pos = _lookup_hash(section, scope) & mask;
+
+	while (graph->lookup[pos] != 0) {
+		graph_node_t *node = &graph->nodes[graph->lookup[pos] - 1];
+		if (node->kind == kind && node->section == section &&
+			_lookup_scope(node->kind, node->scope) == scope) {
+			return graph->lookup[pos] - 1;
+		}
+
+		pos = (pos + 1) & mask;
+	}
+
+	return -1;
+}
+
+void _lookup_insert(build_graph_t *graph, size_t ix) {
+	graph_node_t *node = &graph->nodes[ix];
+	size_t mask = graph->lookup_capacity - 1;
+	size_t pos =
+		_lookup_hash(node->section, _lookup_scope(node->kind, node->scope)) &
+		mask;
+
+	while (graph->lookup[pos] != 0) {
+		pos = (pos + 1) & mask;
+	}
+
+	graph->lookup[pos] = ix + 1;
+}
+
+size_t _new_node(
+	build_graph_t *graph,
+	graph_node_kind_t kind,
+	mcfg_section_t *section,
+	ssize_t scope) {
+	if (graph->node_count == graph->node_capacity) {
+		graph->node_capacity *= 2;
+		graph->nodes = XREALLOC(
+			graph->nodes, graph->node_capacity * sizeof(*graph->nodes));
+	}
+
+	/* keep the lookup table at most half full */
+	if ((graph->node_count + 1) * 2 > graph->lookup_capacity) {
+		XFREE(graph->lookup);
+		graph->lookup_capacity *= 2;
+		graph->lookup =
+			XCALLOC(graph->lookup_capacity, sizeof(*graph->lookup));
+		for (size_t ix = 0; ix < graph->node_count; ix++) {
+			_lookup_insert(graph, ix);
+		}
+	}
+
+	size_t ix = graph->node_count++;
+	graph->nodes[ix] = (graph_node_t){
+		.kind = kind,
+		.section = section,
+		.scope = scope,
+		.pipe_from = -1,
+		.pipes_out = false,
+		.state = NODE_PENDING,
+		.status = 0,
+	};
+
+	_lookup_insert(graph, ix);
+	return ix;
+}
+
+void _add_edge(build_graph_t *graph, size_t dep, size_t node) {
+	_index_list_append(&graph->nodes[node].deps, dep);
+	_index_list_append(&graph->nodes[dep].dependents, node);
+}
+
+void _add_edges(build_graph_t *graph, index_list_t *deps, size_t node) {
+	for (size_t ix = 0; ix < deps->size; ix++) {
+		_add_edge(graph, deps->items[ix], node);
+	}
+}
+
+size_t _count_deps_on(index_list_t *deps, size_t dep) {
+	size_t count = 0;
+	for (size_t ix = 0; ix < deps->size; ix++) {
+		count += deps->items[ix] == dep;
+	}
+
+	return count;
+}
+
+ssize_t _add_c_rule(
+	build_graph_t *graph,
+	mcfg_section_t *rule,
+	ssize_t owner,
+	index_list_t *prev,
+	int *ret);
+
+/**
+ * @brief Add the c_rules listed in field_c_rules to the graph. Each rule
+ * depends on the previous one, the first on the nodes in prev. Afterwards
+ * prev contains the nodes which rules listed after them have to depend on.
+ * @param ret Set to 1 if errors were ignored.
+ * @return 0 on success and -1 on fatal errors.
+ */
+int _add_c_rules(
+	build_graph_t *graph,
+	mcfg_field_t *field_c_rules,
+	int org_type,
+	char *org_name,
+	ssize_t owner,
+	index_list_t *prev,
+	int *ret) {
+	mcfg_sector_t *c_rules = mb_get_sector(graph->file, "c_rules");
+	if (c_rules == NULL || c_rules->section_count == 0) {
+		mb_log(LOG_ERROR, "No c_rules defined!\n");
+		return -1;
+	}
+
+	mcfg_list_t *required_c_rules = mcfg_data_as_list(*field_c_rules);
+
+	for (size_t ix = 0; ix < required_c_rules->field_count; ix++) {
+		char *curr_c_rule_name =
+			mcfg_data_to_string(required_c_rules->fields[ix]);
+		if (curr_c_rule_name == NULL) {
+			mb_logf(
+				LOG_WARNING, "%s/%s:%d: curr_c_rule_name is NULL!\n", __FILE__,
+				__FUNCTION__, __LINE__);
+			continue;
+		}
+
+		mcfg_section_t *curr_c_rule =
+			mb_get_section(c_rules, curr_c_rule_name);
+		if (curr_c_rule == NULL) {
+			mb_logf(
+				LOG_ERROR,
+				"c_rule \"%s\" required by %s \"%s\" does not exist.\n",
+				curr_c_rule_name, org_type == TARGET ? "target" : "c_rule",
+				org_name);
+			XFREE(curr_c_rule_name);
+
+			if (graph->cfg.ignore_failures) {
+				*ret = 1;
+				continue;
+			}
+
+			return -1;
+		}
+
+		XFREE(curr_c_rule_name);
+
+		if (_add_c_rule(graph, curr_c_rule, owner, prev, ret) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @return Whether node depends on dep, directly or through other nodes.
+ */
+bool _depends_on(build_graph_t *graph, size_t node, size_t dep) {
+	bool *visited = XCALLOC(graph->node_count, sizeof(*visited));
+	size_t *stack = XCALLOC(graph->node_count, sizeof(*stack));
+	size_t depth = 0;
+	bool found = false;
+
+	visited[node] = true;
+	stack[depth++] = node;
+
+	while (depth > 0 && !found) {
+		index_list_t *deps = &graph->nodes[stack[--depth]].deps;
+		for (size_t ix = 0; ix < deps->size; ix++) {
+			size_t curr = deps->items[ix];
+			if (curr == dep) {
+				found = true;
+				break;
+			}
+
+			if (!visited[curr]) {
+				visited[curr] = true;
+				stack[depth++] = curr;
+			}
+		}
+	}
+
+	XFREE(stack);
+	XFREE(visited);
+	return found;
+}
+
+/**
+ * @brief Order a rule which already is in the graph after the nodes in prev,
+ * unless one of them depends on it. Those stay in prev, so that rules listed
+ * afterwards still wait for them.
+ */
+void _reuse_c_rule(build_graph_t *graph, size_t node, index_list_t *prev) {
+	size_t kept = 0;
+	bool listed = false;
+
+	for (size_t ix = 0; ix < prev->size; ix++) {
+		size_t dep = prev->items[ix];
+		if (dep == node || _depends_on(graph, dep, node)) {
+			listed = listed || dep == node;
+			prev->items[kept++] = dep;
+			continue;
+		}
+
+		if (_count_deps_on(&graph->nodes[node].deps, dep) == 0) {
+			_add_edge(graph, dep, node);
+		}
+	}
+
+	prev->size = kept;
+	if (!listed) {
+		_index_list_append(prev, node);
+	}
+}
+
+/**
+ * @brief Add a c_rule and the rules it requires to the graph, depending on
+ * the nodes in prev. Afterwards prev contains the nodes which rules listed
+ * after it have to depend on.
+ * @param ret Set to 1 if errors were ignored.
+ * @return The index of the rule's node or -1 on fatal errors.
+ */
+ssize_t _add_c_rule(
+	build_graph_t *graph,
+	mcfg_section_t *rule,
+	ssize_t owner,
+	index_list_t *prev,
+	int *ret) {
+	ssize_t existing = _find_node(graph, NODE_C_RULE, rule, owner);
+	if (existing >= 0) {
+		_reuse_c_rule(graph, existing, prev);
+		return existing;
+	}
+
+	size_t node = _new_node(graph, NODE_C_RULE, rule, owner);
+
+	index_list_t deps = {0};
+	for (size_t ix = 0; ix < prev->size; ix++) {
+		_index_list_append(&deps, prev->items[ix]);
+	}
+
+	mcfg_field_t *field_c_rules = mb_get_field(rule, "c_rules");
+	if (field_c_rules != NULL) {
+		if (field_c_rules->type != TYPE_LIST) {
+			mb_log(
+				LOG_WARNING, "field c_rules is of incorrect type! ignoring.\n");
+		} else if (
+			_add_c_rules(
+				graph, field_c_rules, C_RULE, rule->name, owner, &deps,
+				ret) < 0) {
+			_index_list_free(&deps);
+			return -1;
+		}
+	}
+
+	_add_edges(graph, &deps, node);
+	_index_list_free(&deps);
+
+	prev->size = 0;
+	_index_list_append(prev, node);
+
+	return node;
+}
+
+/**
+ * @param ret Set to 1 if errors were ignored.
+ * @return The index of the target's node or -1 on fatal errors.
+ */
+ssize_t _add_target(
+	build_graph_t *graph,
+	mcfg_section_t *target,
+	ssize_t requester,
+	int *ret) {
+	ssize_t existing = _find_node(graph, NODE_TARGET, target, requester);
+	if (existing >= 0) {
+		return existing;
+	}
+
+	size_t node = _new_node(graph, NODE_TARGET, target, requester);
+
+	/* required targets do not depend on each other, everything else of this
+	 * target depends on all of them */
+	index_list_t deps = {0};
+
+	mcfg_field_t *field_required_targets =
+		mb_get_field(target, "required_targets");
+	if (field_required_targets != NULL) {
+		mcfg_list_t *required_targets =
+			mcfg_data_as_list(*field_required_targets);
+		mcfg_sector_t *targets = mb_get_sector(graph->file, "targets");
+
+		for (size_t ix = 0; ix < required_targets->field_count; ix++) {
+			char *curr_target_name =
+				mcfg_data_to_string(required_targets->fields[ix]);
+			if (curr_target_name == NULL) {
+				mb_logf(
+					LOG_WARNING, "%s/%s:%d: curr_target_name is NULL!\n",
+					__FILE__, __FUNCTION__, __LINE__);
+				continue;
+			}
+
+			mcfg_section_t *curr_target =
+				mb_get_section(targets, curr_target_name);
+			if (curr_target == NULL) {
+				mb_logf(
+					LOG_ERROR,
+					"target \"%s\" required by target \"%s\" does not "
+					"exist.\n",
+					curr_target_name, target->name);
+				XFREE(curr_target_name);
+
+				if (graph->cfg.ignore_failures) {
+					*ret = 1;
+					continue;
+				}
+
+				_index_list_free(&deps);
+				return -1;
+			}
+
+			XFREE(curr_target_name);
+
+			ssize_t required = _add_target(graph, curr_target, node, ret);
+			if (required < 0) {
+				_index_list_free(&deps);
+				return -1;
+			}
+
+			_index_list_append(&deps, required);
+		}
+	}
+
+	mcfg_field_t *field_c_rules = mb_get_field(target, "c_rules");
+	if (field_c_rules != NULL &&
+		_add_c_rules(
+			graph, field_c_rules, TARGET, target->name, node, &deps, ret) <
+			0) {
+		_index_list_free(&deps);
+		return -1;
+	}
+
+	_add_edges(graph, &deps, node);
+	_index_list_free(&deps);
+
+	return node;
+}
+
+/**
+ * @brief Report one of the cycles among the nodes which were not reached by
+ * the topological sort, every one of them has an unreached dependency.
+ */
+void _report_cycle(build_graph_t *graph, size_t *in_degree) {
+	size_t start = 0;
+	while (in_degree[start] == 0) {
+		start++;
+	}
+
+	/* step number + 1 at which a node was visited */
+	size_t *visited = XCALLOC(graph->node_count, sizeof(*visited));
+	size_t *path = XCALLOC(graph->node_count + 1, sizeof(*path));
+	size_t steps = 0;
+
+	size_t curr = start;
+	while (visited[curr] == 0) {
+		visited[curr] = steps + 1;
+		path[steps++] = curr;
+
+		index_list_t *deps = &graph->nodes[curr].deps;
+		for (size_t ix = 0; ix < deps->size; ix++) {
+			if (in_degree[deps->items[ix]] != 0) {
+				curr = deps->items[ix];
+				break;
+			}
+		}
+	}
+
+	mb_log(LOG_ERROR, "circular dependency:\n");
+	for (size_t ix = visited[curr] - 1; ix < steps; ix++) {
+		graph_node_t *node = &graph->nodes[path[ix]];
+		mb_logf(
+			LOG_ERROR, "  %s \"%s\" depends on\n", _node_kind_name(node->kind),
+			node->section->name);
+	}
+	mb_logf(
+		LOG_ERROR, "  %s \"%s\"\n", _node_kind_name(graph->nodes[curr].kind),
+		graph->nodes[curr].section->name);
+
+	XFREE(path);
+	XFREE(visited);
+}
+
+/**
+ * @brief Kahn's algorithm, O(V+E).
+ * @return Whether the graph is free of cycles.
+ */
+bool _check_cycles(build_graph_t *graph) {
+	size_t *in_degree = XCALLOC(graph->node_count, sizeof(*in_degree));
+	size_t *queue = XCALLOC(graph->node_count, sizeof(*queue));
+	size_t head = 0;
+	size_t tail = 0;
+
+	for (size_t ix = 0; ix < graph->node_count; ix++) {
+		in_degree[ix] = graph->nodes[ix].deps.size;
+		if (in_degree[ix] == 0) {
+			queue[tail++] = ix;
+		}
+	}
+
+	while (head < tail) {
+		index_list_t *dependents = &graph->nodes[queue[head++]].dependents;
+		for (size_t ix = 0; ix < dependents->size; ix++) {
+			if (--in_degree[dependents->items[ix]] == 0) {
+				queue[tail++] = dependents->items[ix];
+			}
+		}
+	}
+
+	bool acyclic = tail == graph->node_count;
+	if (!acyclic) {
+		_report_cycle(graph, in_degree);
+	}
+
+	XFREE(queue);
+	XFREE(in_degree);
+	return acyclic;
+}
+
+/**
+ * @brief Find the c_rules which can run element by element behind one of
+ * their dependencies. A rule with more than one such dependency waits for
+ * all of them as a whole.
+ */
+void _find_pipes(build_graph_t *graph) {
+	for (size_t ix = 0; ix < graph->node_count; ix++) {
+		graph_node_t *node = &graph->nodes[ix];
+		if (node->kind != NODE_C_RULE) {
+			continue;
+		}
+
+		ssize_t candidate = -1;
+		bool ambiguous = false;
+
+		for (size_t dix = 0; dix < node->deps.size; dix++) {
+			size_t dep = node->deps.items[dix];
+			if (graph->nodes[dep].kind != NODE_C_RULE ||
+				(ssize_t)dep == candidate ||
+				!mb_c_rule_can_pipe(
+					graph->file, graph->nodes[dep].section, node->section)) {
+				continue;
+			}
+
+			ambiguous = candidate >= 0;
+			candidate = dep;
+		}
+
+		if (candidate < 0 || ambiguous) {
+			continue;
+		}
+
+		node->pipe_from = candidate;
+		graph->nodes[candidate].pipes_out = true;
+
+		mb_logf(
+			LOG_DEBUG, "c_rule \"%s\" is piped behind c_rule \"%s\"\n",
+			node->section->name, graph->nodes[candidate].section->name);
+	}
+}
+
+int mb_graph_build(
+	build_graph_t *graph,
+	mcfg_file_t *file,
+	mcfg_section_t *target,
+	const config_t cfg) {
+	*graph = (build_graph_t){
+		.file = file,
+		.cfg = cfg,
+		.node_count = 0,
+		.node_capacity = 16,
+		.lookup_capacity = GRAPH_LOOKUP_INITIAL_CAPACITY,
+	};
+
+	graph->nodes = XMALLOC(graph->node_capacity * sizeof(*graph->nodes));
+	graph->lookup = XCALLOC(graph->lookup_capacity, sizeof(*graph->lookup));
+
+	int ret = 0;
+	ssize_t root = _add_target(graph, target, -1, &ret);
+	if (root < 0) {
+		return -1;
+	}
+
+	graph->root = root;
+
+	mb_logf(
+		LOG_DEBUG, "build graph for target \"%s\" has %zu nodes\n",
+		target->name, graph->node_count);
+
+	if (!_check_cycles(graph)) {
+		return -1;
+	}
+
+	_find_pipes(graph);
+
+	return ret;
+}
+
+/**
+ * @brief The innermost target whose target_ fields are in scope for the
+ * given node, -1 if there is none.
+ */
+ssize_t _scope_of(build_graph_t *graph, size_t ix) {
+	return graph->nodes[ix].kind == NODE_TARGET ? (ssize_t)ix
+												: graph->nodes[ix].scope;
+}
+
+/**
+ * @brief Link the target_ fields of the given target and every target in
+ * its scope, outermost target first so that its fields take precedence.
+ * @param linked Output for the linked fields, one list per target.
+ * @return The amount of lists written to linked.
+ */
+size_t _link_scope(build_graph_t *graph, ssize_t first, CPtrList **linked) {
+	size_t depth = 0;
+	for (ssize_t curr = first; curr >= 0; curr = graph->nodes[curr].scope) {
+		depth++;
+	}
+
+	if (depth == 0) {
+		*linked = NULL;
+		return 0;
+	}
+
+	size_t *chain = XCALLOC(depth, sizeof(*chain));
+	size_t pos = depth;
+	for (ssize_t curr = first; curr >= 0; curr = graph->nodes[curr].scope) {
+		chain[--pos] = curr;
+	}
+
+	*linked = XCALLOC(depth, sizeof(**linked));
+	for (size_t lix = 0; lix < depth; lix++) {
+		(*linked)[lix] =
+			link_target_fields(graph->file, graph->nodes[chain[lix]].section);
+	}
+
+	XFREE(chain);
+	return depth;
+}
+
+void _unlink_scope(build_graph_t *graph, CPtrList *linked, size_t depth) {
+	for (size_t lix = depth; lix > 0; lix--) {
+		unlink_target_fields(graph->file, linked[lix - 1]);
+		cptrlist_destroy(&linked[lix - 1]);
+	}
+
+	if (linked != NULL) {
+		XFREE(linked);
+	}
+}
+
+/* An element of a c_rule which piped dependents may start on. */
+struct element_event {
+	size_t node;
+	size_t element;
+};
+
+struct graph_run {
+	build_graph_t *graph;
+
+	size_t *ready;
+	size_t ready_head;
+	size_t ready_tail;
+
+	index_list_t running;
+
+	/* Filled by the job pool's callbacks, which must not render anything
+	 * themselves since they run from within mb_jobs_submit.
+	 */
+	size_t events_head;
+	size_t events_size;
+	size_t events_capacity;
+	struct element_event *events;
+
+	/* target scope currently linked while handling events */
+	ssize_t linked_scope;
+	size_t linked_depth;
+	CPtrList *linked;
+
+	int ret;
+	bool stop;
+};
+
+void _push_event(struct graph_run *run, size_t node, size_t element) {
+	if (run->events_size == run->events_capacity) {
+		run->events_capacity =
+			run->events_capacity == 0 ? 64 : run->events_capacity * 2;
+		run->events = XREALLOC(
+			run->events, run->events_capacity * sizeof(*run->events));
+	}
+
+	run->events[run->events_size++] =
+		(struct element_event){.node = node, .element = element};
+}
+
+void _on_job_done(
+	job_group_t *group,
+	const job_t *job,
+	int status,
+	void *ctx) {
+	struct graph_run *run = ctx;
+
+	/* every group is embedded in its node */
+	graph_node_t *node =
+		(graph_node_t *)((char *)group - offsetof(graph_node_t, group));
+	size_t ix = node - run->graph->nodes;
+
+	if (mb_summary_enabled()) {
+		mb_summary_job(
+			ix, job, status,
+			node->kind == NODE_C_RULE
+				? mb_c_rule_element_name(&node->rule_run, job->element)
+				: NULL);
+	}
+
+	if (node->kind != NODE_C_RULE) {
+		return;
+	}
+
+	mb_c_rule_job_done(&node->rule_run, job, status);
+
+	/* once a job of the group failed nothing is released unless failures
+	 * are ignored, the build stops as soon as the group is done */
+	if (!node->pipes_out || job->element < 0 ||
+		(group->status != 0 && !group->ignore_failures)) {
+		return;
+	}
+
+	_push_event(run, ix, job->element);
+}
+
+/**
+ * @brief Make sure the target_ fields of the given scope are linked for
+ * rendering outside of _start_node.
+ */
+void _use_scope(struct graph_run *run, ssize_t scope) {
+	if (run->linked_depth != 0 && run->linked_scope == scope) {
+		return;
+	}
+
+	_unlink_scope(run->graph, run->linked, run->linked_depth);
+	run->linked_depth = _link_scope(run->graph, scope, &run->linked);
+	run->linked_scope = scope;
+}
+
+void _release_scope(struct graph_run *run) {
+	_unlink_scope(run->graph, run->linked, run->linked_depth);
+	run->linked = NULL;
+	run->linked_depth = 0;
+}
+
+/**
+ * @brief Render and submit a single element of a running singular c_rule.
+ * Elements which do not result in a job are passed on to piped dependents
+ * right away.
+ */
+void _render_element(struct graph_run *run, size_t ix, size_t element) {
+	graph_node_t *node = &run->graph->nodes[ix];
+	if (node->element_rendered[element]) {
+		return;
+	}
+
+	node->element_rendered[element] = true;
+	if (node->render_stopped || run->stop) {
+		return;
+	}
+
+	node->elements_rendered++;
+
+	bool submitted;
+	int ret = mb_c_rule_submit_element(&node->rule_run, element, &submitted);
+	node->status = node->status > ret ? node->status : ret;
+
+	if ((ret != 0 || node->group.status != 0) &&
+		!run->graph->cfg.ignore_failures) {
+		node->render_stopped = true;
+		return;
+	}
+
+	if (!submitted && node->pipes_out) {
+		_push_event(run, ix, element);
+	}
+}
+
+bool _element_released(graph_node_t *node, size_t element) {
+	return node->pipe_from < 0 || node->upstream_done ||
+		   (element < node->released_capacity && node->released[element]);
+}
+
+void _start_c_rule(struct graph_run *run, size_t ix) {
+	graph_node_t *node = &run->graph->nodes[ix];
+
+	node->status = mb_c_rule_prepare(
+		&node->rule_run, run->graph->file, node->section, run->graph->cfg,
+		&node->group);
+	if (node->status != 0) {
+		return;
+	}
+
+	node->group.on_job_done = _on_job_done;
+	node->group.ctx = run;
+
+	if (node->rule_run.exec_mode == EXEC_MODE_UNIFY) {
+		node->status = mb_c_rule_submit_unify(&node->rule_run);
+		return;
+	}
+
+	node->element_count = mb_c_rule_element_count(&node->rule_run);
+	node->element_rendered =
+		XCALLOC(node->element_count + 1, sizeof(*node->element_rendered));
+
+	/* piped elements are only final once their upstream element is done */
+	if (node->pipe_from < 0 || node->upstream_done) {
+		mb_c_rule_render_ahead(&node->rule_run);
+	}
+
+	for (size_t element = 0; element < node->element_count; element++) {
+		if (_element_released(node, element)) {
+			_render_element(run, ix, element);
+		}
+	}
+}
+
+void _start_node(struct graph_run *run, size_t ix) {
+	build_graph_t *graph = run->graph;
+	graph_node_t *node = &graph->nodes[ix];
+	node->state = NODE_RUNNING;
+
+	_use_scope(run, _scope_of(graph, ix));
+	mb_trace_begin_async(
+		_node_kind_name(node->kind), node->section->name, ix);
+	mb_summary_node_started(
+		ix, _node_kind_name(node->kind), node->section->name);
+
+	switch (node->kind) {
+		case NODE_TARGET:
+			mb_logf(LOG_INFO, "building target \"%s\"\n", node->section->name);
+			MB_PROBE1(target__start, node->section->name);
+			mb_flight_record(
+				FLIGHT_EVENT(FLIGHT_TARGET_START, node->section->name));
+			node->status = mb_target_submit(
+				graph->file, node->section, graph->cfg, &node->group);
+			node->group.on_job_done = _on_job_done;
+			node->group.ctx = run;
+			break;
+		case NODE_C_RULE:
+			mb_logf(
+				LOG_INFO, "fulfilling c_rule \"%s\"\n", node->section->name);
+			MB_PROBE1(rule__start, node->section->name);
+			mb_flight_record(
+				FLIGHT_EVENT(FLIGHT_RULE_START, node->section->name));
+			_start_c_rule(run, ix);
+			break;
+	}
+}
+
+/**
+ * @brief Mark an upstream element as done for a piped node, rendering it if
+ * the node is already running.
+ */
+void _release_element(struct graph_run *run, size_t ix, size_t element) {
+	graph_node_t *node = &run->graph->nodes[ix];
+
+	if (element >= node->released_capacity) {
+		size_t capacity = node->released_capacity == 0
+							  ? 64
+							  : node->released_capacity * 2;
+		while (capacity <= element) {
+			capacity *= 2;
+		}
+
+		node->released =
+			XREALLOC(node->released, capacity * sizeof(*node->released));
+		memset(
+			node->released + node->released_capacity, 0,
+			(capacity - node->released_capacity) * sizeof(*node->released));
+		node->released_capacity = capacity;
+	}
+
+	node->released[element] = true;
+
+	if (node->state == NODE_RUNNING && element < node->element_count) {
+		_use_scope(run, _scope_of(run->graph, ix));
+		_render_element(run, ix, element);
+	}
+}
+
+/**
+ * @brief Pass finished elements on to the nodes piped behind them.
+ * @return Whether there were any events.
+ */
+bool _handle_events(struct graph_run *run) {
+	build_graph_t *graph = run->graph;
+	bool handled = run->events_head < run->events_size;
+
+	/* rendering may push further events */
+	while (run->events_head < run->events_size) {
+		struct element_event event = run->events[run->events_head++];
+		index_list_t *dependents = &graph->nodes[event.node].dependents;
+
+		for (size_t dix = 0; dix < dependents->size; dix++) {
+			size_t dependent = dependents->items[dix];
+			if (graph->nodes[dependent].pipe_from == (ssize_t)event.node) {
+				_release_element(run, dependent, event.element);
+			}
+		}
+	}
+
+	run->events_head = 0;
+	run->events_size = 0;
+
+	return handled;
+}
+
+bool _node_finished(build_graph_t *graph, size_t ix, struct graph_run *run) {
+	graph_node_t *node = &graph->nodes[ix];
+	if (node->group.outstanding != 0) {
+		return false;
+	}
+
+	if (node->kind != NODE_C_RULE || node->pipe_from < 0 || run->stop ||
+		node->render_stopped) {
+		return true;
+	}
+
+	return node->elements_rendered == node->element_count;
+}
+
+void _complete_node(build_graph_t *graph, size_t ix, struct graph_run *run) {
+	graph_node_t *node = &graph->nodes[ix];
+	node->state = NODE_DONE;
+	if (node->kind == NODE_C_RULE) {
+		mb_c_rule_release(&node->rule_run);
+	}
+
+	node->status =
+		node->status > node->group.status ? node->status : node->group.status;
+
+	trace_arg_t trace_args[] = {
+		TRACE_NUM("status", node->status),
+		TRACE_NUM("elements", node->elements_rendered),
+	};
+	mb_trace_end_async(
+		_node_kind_name(node->kind), node->section->name, ix, trace_args,
+		node->kind == NODE_C_RULE ? 2 : 1);
+	mb_summary_node_done(
+		ix, node->status, node->rule_run.skipped, node->rule_run.cached);
+
+	flight_event_t event = FLIGHT_EVENT(FLIGHT_TARGET_END, node->section->name);
+	event.status = node->status;
+	if (node->kind == NODE_TARGET) {
+		MB_PROBE2(target__end, node->section->name, node->status);
+	} else {
+		MB_PROBE2(rule__end, node->section->name, node->status);
+		event.kind = FLIGHT_RULE_END;
+	}
+	mb_flight_record(event);
+
+	/* piped nodes are cut short if the build stops */
+	if (node->status == 0 && node->elements_rendered == node->element_count) {
+		mb_logf(
+			LOG_INFO, "%s %s \"%s\"!\n",
+			node->kind == NODE_TARGET ? "built" : "fulfilled",
+			_node_kind_name(node->kind), node->section->name);
+	}
+
+	run->ret = run->ret > node->status ? run->ret : node->status;
+	if (run->ret != 0 && !graph->cfg.ignore_failures && !run->stop) {
+		run->stop = true;
+		mb_jobs_cancel_queued();
+	}
+
+	for (size_t dix = 0; dix < node->dependents.size; dix++) {
+		size_t dependent_ix = node->dependents.items[dix];
+		graph_node_t *dependent = &graph->nodes[dependent_ix];
+
+		/* piped nodes may be waiting for the elements nobody released */
+		if (dependent->pipe_from == (ssize_t)ix) {
+			dependent->upstream_done = true;
+			for (size_t element = 0;
+				 dependent->state == NODE_RUNNING &&
+				 element < dependent->element_count;
+				 element++) {
+				_use_scope(run, _scope_of(graph, dependent_ix));
+				_render_element(run, dependent_ix, element);
+			}
+			continue;
+		}
+
+		if (--dependent->unmet_deps == 0) {
+			run->ready[run->ready_tail++] = dependent_ix;
+		}
+	}
+}
+
+/**
+ * @brief Complete every running node which is finished.
+ * @return Whether any node was completed.
+ */
+bool _complete_finished(build_graph_t *graph, struct graph_run *run) {
+	bool completed = false;
+
+	for (size_t rix = 0; rix < run->running.size;) {
+		size_t ix = run->running.items[rix];
+		if (!_node_finished(graph, ix, run)) {
+			rix++;
+			continue;
+		}
+
+		run->running.items[rix] = run->running.items[--run->running.size];
+		_complete_node(graph, ix, run);
+		completed = true;
+	}
+
+	return completed;
+}
+
+int mb_graph_run(build_graph_t *graph) {
+	struct graph_run run = {
+		.graph = graph,
+		.ready = XCALLOC(graph->node_count, sizeof(size_t)),
+		.ready_head = 0,
+		.ready_tail = 0,
+		.running = {0},
+		.events = NULL,
+		.linked_scope = -1,
+		.linked_depth = 0,
+		.linked = NULL,
+		.ret = 0,
+		.stop = false,
+	};
+
+	for (size_t ix = 0; ix < graph->node_count; ix++) {
+		graph_node_t *node = &graph->nodes[ix];
+		node->unmet_deps = node->deps.size;
+		if (node->pipe_from >= 0) {
+			node->unmet_deps -= _count_deps_on(&node->deps, node->pipe_from);
+		}
+
+		if (node->unmet_deps == 0) {
+			run.ready[run.ready_tail++] = ix;
+		}
+	}
+
+	for (;;) {
+		bool progress = false;
+
+		while (!run.stop && run.ready_head < run.ready_tail) {
+			size_t ix = run.ready[run.ready_head++];
+			_start_node(&run, ix);
+			_index_list_append(&run.running, ix);
+			progress = true;
+		}
+
+		progress |= _handle_events(&run);
+		progress |= _complete_finished(graph, &run);
+
+		if (progress) {
+			continue;
+		}
+
+		if (run.running.size == 0) {
+			break;
+		}
+
+		_release_scope(&run);
+
+		/* dispatching may drop the queued jobs of failed groups without
+		 * anything left to wait for */
+		if (!mb_jobs_wait_any() && !_complete_finished(graph, &run)) {
+			mb_log(LOG_ERROR, "internal: build graph stalled\n");
+			run.ret = run.ret != 0 ? run.ret : 1;
+			break;
+		}
+	}
+
+	_release_scope(&run);
+
+	_index_list_free(&run.running);
+	XFREE(run.ready);
+	if (run.events != NULL) {
+		XFREE(run.events);
+	}
+
+	return run.ret;
+}
+
+void mb_graph_destroy(build_graph_t *graph) {
+	for (size_t ix = 0; ix < graph->node_count; ix++) {
+		graph_node_t *node = &graph->nodes[ix];
+		_index_list_free(&node->deps);
+		_index_list_free(&node->dependents);
+
+		if (node->kind == NODE_C_RULE) {
+			mb_c_rule_release(&node->rule_run);
+		}
+		if (node->element_rendered != NULL) {
+			XFREE(node->element_rendered);
+		}
+		if (node->released != NULL) {
+			XFREE(node->released);
+		}
+	}
+
+	if (graph->nodes != NULL) {
+		XFREE(graph->nodes);
+	}
+
+	if (graph->lookup != NULL) {
+		XFREE(graph->lookup);
+	}
+
+	*graph = (build_graph_t){0};
+}
@@ -0,0 +1,129 @@
+/* graph.h ; mariebuild build graph header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+#include "c_rule.h"
+#include "jobs.h"
+#include "mcfg.h"
+#include "types.h"
+
+typedef enum graph_node_kind {
+	NODE_TARGET = 0,
+	NODE_C_RULE,
+} graph_node_kind_t;
+
+typedef enum graph_node_state {
+	NODE_PENDING = 0,
+	NODE_RUNNING,
+	NODE_DONE,
+} graph_node_state_t;
+
+typedef struct index_list {
+	size_t size;
+	size_t capacity;
+	size_t *items;
+} index_list_t;
+
+typedef struct graph_node {
+	graph_node_kind_t kind;
+	mcfg_section_t *section;
+
+	/* The target whose target_ fields are in scope for this node. For
+	 * c_rules this is the target which owns them, for targets the target
+	 * which required it first. -1 if there is none.
+	 */
+	ssize_t scope;
+
+	/* nodes which have to be done before this one can run */
+	index_list_t deps;
+	/* nodes which depend on this one */
+	index_list_t dependents;
+
+	/* A singular c_rule among deps over the same input list. Each element
+	 * of this node only waits for the same element of that rule instead of
+	 * the whole rule, so the edge is not counted in unmet_deps. -1 if there
+	 * is none.
+	 */
+	ssize_t pipe_from;
+	/* whether any dependent pipes from this node */
+	bool pipes_out;
+
+	graph_node_state_t state;
+	size_t unmet_deps;
+
+	job_group_t group;
+	int status;
+
+	/* state of a running c_rule */
+	c_rule_run_t rule_run;
+	size_t element_count;
+	size_t elements_rendered;
+	bool *element_rendered;
+	/* stop rendering elements after an error */
+	bool render_stopped;
+
+	/* upstream elements which are done, grown as they finish */
+	size_t released_capacity;
+	bool *released;
+	bool upstream_done;
+} graph_node_t;
+
+typedef struct build_graph {
+	mcfg_file_t *file;
+	config_t cfg;
+
+	size_t node_count;
+	size_t node_capacity;
+	graph_node_t *nodes;
+
+	/* open addressing table of node index + 1, keyed by section and scope */
+	size_t lookup_capacity;
+	size_t *lookup;
+
+	size_t root;
+} build_graph_t;
+
+/**
+ * @brief Compile the given target, its required targets and all c_rules
+ * they need into a dependency graph and check it for cycles.
+ *
+ * Required targets do not depend on each other. The c_rules of a target
+ * depend on all of its required targets and run in the listed order, the
+ * same goes for the c_rules required by a c_rule. A target's exec field runs
+ * after all of its c_rules. Every target is only added once, c_rules once
+ * per target owning them.
+ *
+ * A singular c_rule which depends on another singular c_rule over the same
+ * input list is piped: each of its elements runs as soon as the same element
+ * of the other rule is done. Unify rules wait for the whole rule.
+ *
+ * @return 0 on success, 1 if errors were ignored because of
+ * cfg.ignore_failures and -1 if the graph can not be run.
+ */
+int mb_graph_build(
+	build_graph_t *graph,
+	mcfg_file_t *file,
+	mcfg_section_t *target,
+	const config_t cfg);
+
+/**
+ * @brief Run every node of the graph as soon as its dependencies are done,
+ * independent nodes run concurrently within the job pool. The elements of
+ * piped c_rules run as soon as their upstream element is done.
+ * @return The highest exit status of all nodes.
+ */
+int mb_graph_run(build_graph_t *graph);
+
+void mb_graph_destroy(build_graph_t *graph);
+
+#endif /* #ifndef GRAPH_H */
@@ -0,0 +1,410 @@
+/* hash.c ; mariebuild hashing impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "hash.h"
+#include "stats.h"
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define PRIME_MX1 0x165667919E3779F9ULL
+#define PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define SECRET_SIZE 192
+#define STRIPE_LEN 64
+#define ACC_COUNT (STRIPE_LEN / sizeof(uint64_t))
+/* the secret advances by this much for every stripe of a block */
+#define SECRET_CONSUME_RATE 8
+#define STRIPES_PER_BLOCK ((SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE)
+#define BLOCK_LEN (STRIPE_LEN * STRIPES_PER_BLOCK)
+
+#define MIDSIZE_MAX 240
+/* the smallest secret XXH3 allows, which the mid-size hashes are laid out
+ * for */
+#define SECRET_SIZE_MIN 136
+
+/* the default secret of XXH3 */
+static const uint8_t default_secret[SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+	0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+	0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+	0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+	0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+	0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+	0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+	0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+	0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+	0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+	0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+	0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+	0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 uint128_t;
+#endif
+
+uint64_t _rotl64(uint64_t value, int amount) {
+	return (value << amount) | (value >> (64 - amount));
+}
+
+/* memcpy keeps unaligned reads defined, compilers turn it into a load.
+ * Like XXH3, the hashes assume a little endian host. */
+uint64_t _read64(const uint8_t *pos) {
+	uint64_t value;
+	memcpy(&value, pos, sizeof(value));
+	return value;
+}
+
+uint32_t _read32(const uint8_t *pos) {
+	uint32_t value;
+	memcpy(&value, pos, sizeof(value));
+	return value;
+}
+
+void _write64(uint8_t *pos, uint64_t value) {
+	memcpy(pos, &value, sizeof(value));
+}
+
+uint32_t _swap32(uint32_t value) {
+	return ((value << 24) & 0xff000000U) | ((value << 8) & 0x00ff0000U) |
+		   ((value >> 8) & 0x0000ff00U) | ((value >> 24) & 0x000000ffU);
+}
+
+uint64_t _swap64(uint64_t value) {
+	return ((uint64_t)_swap32((uint32_t)value) << 32) |
+		   _swap32((uint32_t)(value >> 32));
+}
+
+/**
+ * @brief Multiply to 128 bits and fold the halves together.
+ */
+uint64_t _mul128_fold64(uint64_t lhs, uint64_t rhs) {
+#ifdef __SIZEOF_INT128__
+	uint128_t product = (uint128_t)lhs * rhs;
+	return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+	uint64_t lo_lo = (lhs & 0xffffffff) * (rhs & 0xffffffff);
+	uint64_t hi_lo = (lhs >> 32) * (rhs & 0xffffffff);
+	uint64_t lo_hi = (lhs & 0xffffffff) * (rhs >> 32);
+	uint64_t hi_hi = (lhs >> 32) * (rhs >> 32);
+
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+	uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	uint64_t lower = (cross << 32) | (lo_lo & 0xffffffff);
+	return lower ^ upper;
+#endif
+}
+
+uint64_t _xxh64_avalanche(uint64_t hash) {
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+uint64_t _avalanche(uint64_t hash) {
+	hash ^= hash >> 37;
+	hash *= PRIME_MX1;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+uint64_t _rrmxmx(uint64_t hash, size_t size) {
+	hash ^= _rotl64(hash, 49) ^ _rotl64(hash, 24);
+	hash *= PRIME_MX2;
+	hash ^= (hash >> 35) + size;
+	hash *= PRIME_MX2;
+	hash ^= hash >> 28;
+	return hash;
+}
+
+uint64_t _mix16(const uint8_t *pos, const uint8_t *secret, uint64_t seed) {
+	return _mul128_fold64(
+		_read64(pos) ^ (_read64(secret) + seed),
+		_read64(pos + 8) ^ (_read64(secret + 8) - seed));
+}
+
+uint64_t _hash_0to16(const uint8_t *pos, size_t size, uint64_t seed) {
+	const uint8_t *secret = default_secret;
+
+	if (size > 8) {
+		uint64_t lo = _read64(pos) ^
+					  ((_read64(secret + 24) ^ _read64(secret + 32)) + seed);
+		uint64_t hi = _read64(pos + size - 8) ^
+					  ((_read64(secret + 40) ^ _read64(secret + 48)) - seed);
+		return _avalanche(size + _swap64(lo) + hi + _mul128_fold64(lo, hi));
+	}
+
+	if (size >= 4) {
+		seed ^= (uint64_t)_swap32((uint32_t)seed) << 32;
+		uint64_t input =
+			_read32(pos + size - 4) + ((uint64_t)_read32(pos) << 32);
+		uint64_t bitflip = (_read64(secret + 8) ^ _read64(secret + 16)) - seed;
+		return _rrmxmx(input ^ bitflip, size);
+	}
+
+	if (size > 0) {
+		uint32_t combined = ((uint32_t)pos[0] << 16) |
+							((uint32_t)pos[size >> 1] << 24) |
+							(uint32_t)pos[size - 1] | ((uint32_t)size << 8);
+		uint64_t bitflip = (_read32(secret) ^ _read32(secret + 4)) + seed;
+		return _xxh64_avalanche(combined ^ bitflip);
+	}
+
+	return _xxh64_avalanche(seed ^ _read64(secret + 56) ^ _read64(secret + 64));
+}
+
+uint64_t _hash_17to128(const uint8_t *pos, size_t size, uint64_t seed) {
+	const uint8_t *secret = default_secret;
+	uint64_t acc = size * PRIME64_1;
+
+	if (size > 32) {
+		if (size > 64) {
+			if (size > 96) {
+				acc += _mix16(pos + 48, secret + 96, seed);
+				acc += _mix16(pos + size - 64, secret + 112, seed);
+			}
+			acc += _mix16(pos + 32, secret + 64, seed);
+			acc += _mix16(pos + size - 48, secret + 80, seed);
+		}
+		acc += _mix16(pos + 16, secret + 32, seed);
+		acc += _mix16(pos + size - 32, secret + 48, seed);
+	}
+	acc += _mix16(pos, secret, seed);
+	acc += _mix16(pos + size - 16, secret + 16, seed);
+
+	return _avalanche(acc);
+}
+
+uint64_t _hash_129to240(const uint8_t *pos, size_t size, uint64_t seed) {
+	const uint8_t *secret = default_secret;
+	uint64_t acc = size * PRIME64_1;
+	size_t rounds = size / 16;
+
+	for (size_t ix = 0; ix < 8; ix++) {
+		acc += _mix16(pos + 16 * ix, secret + 16 * ix, seed);
+	}
+	acc = _avalanche(acc);
+
+	/* the remaining rounds use the secret at an odd offset */
+	for (size_t ix = 8; ix < rounds; ix++) {
+		acc += _mix16(pos + 16 * ix, secret + 16 * (ix - 8) + 3, seed);
+	}
+	acc += _mix16(pos + size - 16, secret + SECRET_SIZE_MIN - 17, seed);
+
+	return _avalanche(acc);
+}
+
+#ifdef __SSE2__
+/* mixes 16 bytes at pos into two accumulators */
+#define ACCUMULATE_128(acc, pos, secret)                                     \
+	do {                                                                     \
+		__m128i data = _mm_loadu_si128((const __m128i *)(pos));              \
+		__m128i data_key =                                                   \
+			_mm_xor_si128(data, _mm_loadu_si128((const __m128i *)(secret))); \
+		__m128i product = _mm_mul_epu32(                                     \
+			data_key, _mm_shuffle_epi32(data_key, _MM_SHUFFLE(0, 3, 0, 1))); \
+		__m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));  \
+		(acc) = _mm_add_epi64(product, _mm_add_epi64((acc), swapped));       \
+	} while (0)
+#endif
+
+/**
+ * @brief Mix stripes of input into the accumulators, the secret advances by
+ * SECRET_CONSUME_RATE for every stripe. This and _scramble are where long
+ * inputs spend their time, the SSE2 version keeps the accumulators in
+ * registers and processes two of them at once.
+ */
+void _accumulate(
+	uint64_t *restrict acc,
+	const uint8_t *restrict pos,
+	const uint8_t *restrict secret,
+	size_t stripes) {
+#ifdef __SSE2__
+	__m128i *acc_vec = (__m128i *)acc;
+	__m128i acc0 = acc_vec[0];
+	__m128i acc1 = acc_vec[1];
+	__m128i acc2 = acc_vec[2];
+	__m128i acc3 = acc_vec[3];
+
+	for (size_t stripe = 0; stripe < stripes; stripe++) {
+		ACCUMULATE_128(acc0, pos, secret);
+		ACCUMULATE_128(acc1, pos + 16, secret + 16);
+		ACCUMULATE_128(acc2, pos + 32, secret + 32);
+		ACCUMULATE_128(acc3, pos + 48, secret + 48);
+		pos += STRIPE_LEN;
+		secret += SECRET_CONSUME_RATE;
+	}
+
+	acc_vec[0] = acc0;
+	acc_vec[1] = acc1;
+	acc_vec[2] = acc2;
+	acc_vec[3] = acc3;
+#else
+	for (size_t stripe = 0; stripe < stripes; stripe++) {
+		for (size_t ix = 0; ix < ACC_COUNT; ix++) {
+			uint64_t data = _read64(pos + 8 * ix);
+			uint64_t data_key = data ^ _read64(secret + 8 * ix);
+			acc[ix ^ 1] += data;
+			acc[ix] += (data_key & 0xffffffff) * (data_key >> 32);
+		}
+
+		pos += STRIPE_LEN;
+		secret += SECRET_CONSUME_RATE;
+	}
+#endif
+}
+
+void _scramble(uint64_t *restrict acc, const uint8_t *restrict secret) {
+#ifdef __SSE2__
+	__m128i *acc_vec = (__m128i *)acc;
+	const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+	for (size_t ix = 0; ix < ACC_COUNT / 2; ix++) {
+		__m128i value = acc_vec[ix];
+		value = _mm_xor_si128(value, _mm_srli_epi64(value, 47));
+		value = _mm_xor_si128(
+			value, _mm_loadu_si128((const __m128i *)secret + ix));
+
+		/* 64 by 32 bit multiplication out of two 32 by 32 bit ones */
+		__m128i value_hi = _mm_shuffle_epi32(value, _MM_SHUFFLE(0, 3, 0, 1));
+		__m128i product_lo = _mm_mul_epu32(value, prime);
+		__m128i product_hi = _mm_mul_epu32(value_hi, prime);
+		acc_vec[ix] =
+			_mm_add_epi64(product_lo, _mm_slli_epi64(product_hi, 32));
+	}
+#else
+	for (size_t ix = 0; ix < ACC_COUNT; ix++) {
+		uint64_t value = acc[ix];
+		value ^= value >> 47;
+		value ^= _read64(secret + 8 * ix);
+		acc[ix] = value * PRIME32_1;
+	}
+#endif
+}
+
+uint64_t _hash_long(const uint8_t *pos, size_t size, uint64_t seed) {
+	/* 16 byte alignment for the SSE2 versions */
+	_Alignas(16) uint64_t acc[ACC_COUNT] = {
+		PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+		PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1,
+	};
+
+	_Alignas(16) uint8_t seeded[SECRET_SIZE];
+	const uint8_t *secret = default_secret;
+	if (seed != 0) {
+		for (size_t ix = 0; ix < SECRET_SIZE; ix += 16) {
+			_write64(seeded + ix, _read64(default_secret + ix) + seed);
+			_write64(seeded + ix + 8, _read64(default_secret + ix + 8) - seed);
+		}
+		secret = seeded;
+	}
+
+	size_t blocks = (size - 1) / BLOCK_LEN;
+	for (size_t block = 0; block < blocks; block++) {
+		_accumulate(acc, pos + block * BLOCK_LEN, secret, STRIPES_PER_BLOCK);
+		_scramble(acc, secret + SECRET_SIZE - STRIPE_LEN);
+	}
+
+	size_t stripes = ((size - 1) - blocks * BLOCK_LEN) / STRIPE_LEN;
+	_accumulate(acc, pos + blocks * BLOCK_LEN, secret, stripes);
+
+	/* the last stripe may overlap the previous one */
+	_accumulate(
+		acc, pos + size - STRIPE_LEN, secret + SECRET_SIZE - STRIPE_LEN - 7,
+		1);
+
+	uint64_t hash = size * PRIME64_1;
+	for (size_t ix = 0; ix < ACC_COUNT / 2; ix++) {
+		hash += _mul128_fold64(
+			acc[2 * ix] ^ _read64(secret + 11 + 16 * ix),
+			acc[2 * ix + 1] ^ _read64(secret + 11 + 16 * ix + 8));
+	}
+
+	return _avalanche(hash);
+}
+
+uint64_t mb_hash64(const void *data, size_t size, uint64_t seed) {
+	const uint8_t *pos = data;
+
+	if (size <= 16) {
+		return _hash_0to16(pos, size, seed);
+	}
+
+	if (size <= 128) {
+		return _hash_17to128(pos, size, seed);
+	}
+
+	if (size <= MIDSIZE_MAX) {
+		return _hash_129to240(pos, size, seed);
+	}
+
+	return _hash_long(pos, size, seed);
+}
+
+uint64_t mb_hash_str(const char *str) {
+	return mb_hash64(str, strlen(str), 0);
+}
+
+bool mb_hash_file(const char *path, uint64_t *hash) {
+	MB_STAT_INC(STAT_OPEN_CALLS);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		*hash = mb_hash64(NULL, 0, 0);
+		return true;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	*hash = mb_hash64(data, st.st_size, 0);
+	munmap(data, st.st_size);
+
+	return true;
+}
@@ -0,0 +1,32 @@
+/* hash.h ; mariebuild hashing header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief 64-bit non-cryptographic hash of the given data, following the
+ * XXH3 algorithm. Inputs longer than 240 bytes are hashed 64 bytes at a
+ * time, with SSE2 where it is available.
+ */
+uint64_t mb_hash64(const void *data, size_t size, uint64_t seed);
+
+/**
+ * @brief mb_hash64 of a terminated string, without the terminator.
+ */
+uint64_t mb_hash_str(const char *str);
+
+/**
+ * @brief mb_hash64 of the contents of a file.
+ * @return Whether the file could be read.
+ */
+bool mb_hash_file(const char *path, uint64_t *hash);
+
+#endif /* #ifndef HASH_H */
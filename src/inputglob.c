@@ -0,0 +1,927 @@
+/* inputglob.c ; mariebuild input glob impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "buildlog.h"
+#include "inputglob.h"
+#include "logging.h"
+#include "workers.h"
+#include "xmem.h"
+
+#define GLOB_CACHE_MAGIC "MBGLOB\0"
+#define GLOB_CACHE_VERSION 2
+
+/* size of the buffer each directory is read into */
+#define WALK_BUFFER_SIZE (32 * 1024)
+
+/*
+ * The glob cache is a header followed by its entries. Each entry is a
+ * glob_cache_entry_t followed by the terminated pattern, the directories
+ * as a glob_cache_dir_t and their terminated path each and finally the
+ * matches, each as its size and the terminated path.
+ */
+
+typedef struct glob_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_count;
+} glob_cache_header_t;
+
+typedef struct glob_cache_entry {
+	int64_t walked_sec;
+	int64_t walked_nsec;
+	uint32_t pattern_size;
+	uint32_t dir_count;
+	uint32_t match_count;
+	uint32_t reserved;
+} glob_cache_entry_t;
+
+typedef struct glob_cache_dir {
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint32_t path_size;
+	uint32_t reserved;
+} glob_cache_dir_t;
+
+typedef struct glob_dir {
+	char *path;
+	/* zeroed if the directory could not be read */
+	struct timespec mtime;
+} glob_dir_t;
+
+typedef struct glob_entry {
+	char *pattern;
+
+	/* when the directories were read, CLOCK_REALTIME */
+	struct timespec walked;
+	/* every directory which was read for the expansion */
+	size_t dir_count;
+	glob_dir_t *dirs;
+	size_t match_count;
+	char **matches;
+
+	/* whether the entry was checked or expanded during this build, only
+	 * then the list is set up */
+	bool current;
+	mcfg_list_t list;
+	mcfg_field_t field;
+} glob_entry_t;
+
+typedef struct glob_segment {
+	char *text;
+	/* whether the segment is "**" */
+	bool recursive;
+} glob_segment_t;
+
+typedef struct glob_pattern {
+	/* the leading segments without wildcards, "" for the current
+	 * directory */
+	char *base;
+	/* the remaining segments, pointing into buffer */
+	size_t count;
+	glob_segment_t segments[GLOB_MAX_SEGMENTS];
+	char *buffer;
+} glob_pattern_t;
+
+/* a directory to be read, states has a bit set for each segment which its
+ * entries are matched against */
+typedef struct walk_dir {
+	char *path;
+	uint64_t states;
+} walk_dir_t;
+
+typedef struct walk_result {
+	struct timespec mtime;
+
+	size_t subdir_count;
+	size_t subdir_capacity;
+	walk_dir_t *subdirs;
+
+	size_t match_count;
+	size_t match_capacity;
+	char **matches;
+} walk_result_t;
+
+/* the directories at the same depth, read as one batch */
+struct walk_level {
+	const glob_pattern_t *pattern;
+	walk_dir_t *dirs;
+	walk_result_t *results;
+};
+
+static char *cache_path = NULL;
+/* whether an entry was expanded since the cache was loaded */
+static bool cache_dirty = false;
+
+/* pointers, since the fields handed out have to stay in place */
+static glob_entry_t **entries = NULL;
+static size_t entry_count = 0;
+static size_t entry_capacity = 0;
+
+char *_join_path(const char *dir, const char *name) {
+	size_t dir_length = strlen(dir);
+	size_t name_length = strlen(name);
+	bool separator = dir_length > 0 && dir[dir_length - 1] != '/';
+
+	char *path = XMALLOC(dir_length + separator + name_length + 1);
+	memcpy(path, dir, dir_length);
+	if (separator) {
+		path[dir_length] = '/';
+	}
+	memcpy(path + dir_length + separator, name, name_length + 1);
+
+	return path;
+}
+
+bool _has_wildcard(const char *segment, size_t length) {
+	for (size_t ix = 0; ix < length; ix++) {
+		if (segment[ix] == '*' || segment[ix] == '?' || segment[ix] == '[') {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void _free_pattern(glob_pattern_t *pattern) {
+	if (pattern->base != NULL) {
+		XFREE(pattern->base);
+	}
+	if (pattern->buffer != NULL) {
+		XFREE(pattern->buffer);
+	}
+}
+
+bool _compile_pattern(const char *pattern, glob_pattern_t *dest) {
+	*dest = (glob_pattern_t){0};
+
+	/* leading segments without wildcards are not matched but opened
+	 * directly, except for the last one which has to be a file */
+	const char *base_end = pattern[0] == '/' ? pattern + 1 : pattern;
+	const char *pos = base_end;
+	for (;;) {
+		while (*pos == '/') {
+			pos++;
+		}
+
+		const char *end = strchr(pos, '/');
+		if (end == NULL || _has_wildcard(pos, end - pos)) {
+			break;
+		}
+
+		const char *next = end;
+		while (*next == '/') {
+			next++;
+		}
+		if (*next == '\0') {
+			break;
+		}
+
+		base_end = end;
+		pos = end;
+	}
+
+	dest->base = strndup(pattern, base_end - pattern);
+	dest->buffer = strdup(base_end);
+
+	char *save = NULL;
+	for (char *segment = strtok_r(dest->buffer, "/", &save); segment != NULL;
+		 segment = strtok_r(NULL, "/", &save)) {
+		if (dest->count == GLOB_MAX_SEGMENTS) {
+			_free_pattern(dest);
+			return false;
+		}
+
+		dest->segments[dest->count++] = (glob_segment_t){
+			.text = segment,
+			.recursive = strcmp(segment, "**") == 0,
+		};
+	}
+
+	if (dest->count == 0) {
+		_free_pattern(dest);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Add the segments after each "**" of the states, since it may match
+ * no directories at all.
+ */
+uint64_t _close_states(const glob_pattern_t *pattern, uint64_t states) {
+	for (size_t ix = 0; ix + 1 < pattern->count; ix++) {
+		if ((states >> ix & 1) && pattern->segments[ix].recursive) {
+			states |= (uint64_t)1 << (ix + 1);
+		}
+	}
+
+	return states;
+}
+
+/**
+ * @brief Match an entry against the segments of the states of its
+ * directory.
+ * @param matched Set to whether the entry is a file matching the pattern.
+ * @return The states of the entry if it is a directory to descend into,
+ * otherwise 0.
+ */
+uint64_t _advance_states(
+	const glob_pattern_t *pattern,
+	uint64_t states,
+	const char *name,
+	bool is_dir,
+	bool *matched) {
+	uint64_t next = 0;
+	size_t last = pattern->count - 1;
+	*matched = false;
+
+	for (size_t ix = 0; ix < pattern->count; ix++) {
+		if (!(states >> ix & 1)) {
+			continue;
+		}
+
+		const glob_segment_t *segment = &pattern->segments[ix];
+		if (segment->recursive) {
+			if (name[0] == '.') {
+				continue;
+			}
+
+			if (is_dir) {
+				next |= (uint64_t)1 << ix;
+			} else if (ix == last) {
+				*matched = true;
+			}
+			continue;
+		}
+
+		if (fnmatch(segment->text, name, FNM_PERIOD) != 0) {
+			continue;
+		}
+
+		if (ix == last) {
+			*matched = *matched || !is_dir;
+		} else if (is_dir) {
+			next |= (uint64_t)1 << (ix + 1);
+		}
+	}
+
+	return _close_states(pattern, next);
+}
+
+void _walk_entry(
+	const struct walk_level *level,
+	const walk_dir_t *dir,
+	walk_result_t *result,
+	int fd,
+	const char *name,
+	unsigned char type) {
+	if (name[0] == '.' &&
+		(name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+		return;
+	}
+
+	bool is_dir = type == DT_DIR;
+	if (type == DT_UNKNOWN || type == DT_LNK) {
+		struct stat st;
+		if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+			return;
+		}
+
+		/* links match as what they point to, but are never descended */
+		if (S_ISLNK(st.st_mode) &&
+			(fstatat(fd, name, &st, 0) != 0 || S_ISDIR(st.st_mode))) {
+			return;
+		}
+
+		is_dir = S_ISDIR(st.st_mode);
+	}
+
+	bool matched;
+	uint64_t states =
+		_advance_states(level->pattern, dir->states, name, is_dir, &matched);
+
+	if (matched) {
+		if (result->match_count == result->match_capacity) {
+			result->match_capacity =
+				result->match_capacity == 0 ? 16 : result->match_capacity * 2;
+			result->matches = XREALLOC(
+				result->matches,
+				result->match_capacity * sizeof(*result->matches));
+		}
+
+		result->matches[result->match_count++] = _join_path(dir->path, name);
+	}
+
+	if (states != 0) {
+		if (result->subdir_count == result->subdir_capacity) {
+			result->subdir_capacity =
+				result->subdir_capacity == 0 ? 8 : result->subdir_capacity * 2;
+			result->subdirs = XREALLOC(
+				result->subdirs,
+				result->subdir_capacity * sizeof(*result->subdirs));
+		}
+
+		result->subdirs[result->subdir_count++] = (walk_dir_t){
+			.path = _join_path(dir->path, name),
+			.states = states,
+		};
+	}
+}
+
+#ifdef __linux__
+/* as returned by getdents64, which glibc only declares since 2.30 */
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+void _walk_entries(
+	const struct walk_level *level,
+	const walk_dir_t *dir,
+	walk_result_t *result,
+	int fd) {
+	/* aligned for the records */
+	uint64_t buffer[WALK_BUFFER_SIZE / sizeof(uint64_t)];
+
+	for (;;) {
+		long size = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+		if (size < 0 && errno == EINTR) {
+			continue;
+		}
+		if (size <= 0) {
+			break;
+		}
+
+		for (long pos = 0; pos < size;) {
+			struct linux_dirent64 *entry =
+				(struct linux_dirent64 *)((char *)buffer + pos);
+			_walk_entry(level, dir, result, fd, entry->d_name, entry->d_type);
+			pos += entry->d_reclen;
+		}
+	}
+}
+#else
+void _walk_entries(
+	const struct walk_level *level,
+	const walk_dir_t *dir,
+	walk_result_t *result,
+	int fd) {
+	int dir_fd = dup(fd);
+	DIR *stream = dir_fd < 0 ? NULL : fdopendir(dir_fd);
+	if (stream == NULL) {
+		if (dir_fd >= 0) {
+			close(dir_fd);
+		}
+		return;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(stream)) != NULL) {
+		_walk_entry(level, dir, result, fd, entry->d_name, entry->d_type);
+	}
+
+	closedir(stream);
+}
+#endif
+
+void _walk_dir(void *ctx, size_t item, size_t worker) {
+	(void)worker;
+	struct walk_level *level = ctx;
+	walk_dir_t *dir = &level->dirs[item];
+	walk_result_t *result = &level->results[item];
+
+	const char *path = dir->path[0] == '\0' ? "." : dir->path;
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+
+	/* taken before reading so that changes while reading are noticed by the
+	 * next build */
+	struct stat st;
+	if (fstat(fd, &st) == 0) {
+#ifdef __APPLE__
+		result->mtime = st.st_mtimespec;
+#else
+		result->mtime = st.st_mtim;
+#endif
+	}
+
+	_walk_entries(level, dir, result, fd);
+	close(fd);
+}
+
+void _entry_add_dir(glob_entry_t *entry, char *path, struct timespec mtime) {
+	/* directories are added one level at a time, grow in powers of two */
+	if ((entry->dir_count & (entry->dir_count - 1)) == 0) {
+		size_t capacity = entry->dir_count == 0 ? 1 : entry->dir_count * 2;
+		entry->dirs = XREALLOC(entry->dirs, capacity * sizeof(*entry->dirs));
+	}
+
+	entry->dirs[entry->dir_count++] = (glob_dir_t){
+		.path = path,
+		.mtime = mtime,
+	};
+}
+
+void _entry_add_matches(glob_entry_t *entry, char **matches, size_t count) {
+	if (count == 0) {
+		return;
+	}
+
+	entry->matches = XREALLOC(
+		entry->matches, (entry->match_count + count) * sizeof(*entry->matches));
+	memcpy(entry->matches + entry->match_count, matches,
+		   count * sizeof(*matches));
+	entry->match_count += count;
+}
+
+int _compare_paths(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * @brief Read the directories of a pattern level by level, each level as a
+ * batch on the worker threads.
+ */
+void _walk(const glob_pattern_t *pattern, glob_entry_t *entry) {
+	clock_gettime(CLOCK_REALTIME, &entry->walked);
+
+	size_t dir_count = 1;
+	walk_dir_t *dirs = XMALLOC(sizeof(*dirs));
+	dirs[0] = (walk_dir_t){
+		.path = strdup(pattern->base),
+		.states = _close_states(pattern, 1),
+	};
+
+	while (dir_count > 0) {
+		struct walk_level level = {
+			.pattern = pattern,
+			.dirs = dirs,
+			.results = XCALLOC(dir_count, sizeof(*level.results)),
+		};
+
+		work_batch_t batch;
+		mb_workers_start(&batch, _walk_dir, &level, dir_count);
+
+		size_t next_count = 0;
+		walk_dir_t *next = NULL;
+
+		for (size_t ix = 0; ix < dir_count; ix++) {
+			mb_workers_wait(&batch, ix);
+			walk_result_t *result = &level.results[ix];
+
+			_entry_add_dir(entry, dirs[ix].path, result->mtime);
+			_entry_add_matches(entry, result->matches, result->match_count);
+
+			if (result->subdir_count > 0) {
+				next = XREALLOC(
+					next, (next_count + result->subdir_count) * sizeof(*next));
+				memcpy(next + next_count, result->subdirs,
+					   result->subdir_count * sizeof(*next));
+				next_count += result->subdir_count;
+			}
+
+			if (result->matches != NULL) {
+				XFREE(result->matches);
+			}
+			if (result->subdirs != NULL) {
+				XFREE(result->subdirs);
+			}
+		}
+
+		mb_workers_finish(&batch);
+		mb_workers_free(&batch);
+		XFREE(level.results);
+		XFREE(dirs);
+
+		dirs = next;
+		dir_count = next_count;
+	}
+
+	if (dirs != NULL) {
+		XFREE(dirs);
+	}
+
+	qsort(entry->matches, entry->match_count, sizeof(*entry->matches),
+		  _compare_paths);
+}
+
+/**
+ * @brief Whether none of the directories read for an entry changed since.
+ * A directory modified around the time it was read may have been modified
+ * again within the same timestamp after it was read, so it is only trusted
+ * if it was modified before the walk began.
+ */
+bool _entry_unchanged(const glob_entry_t *entry) {
+	for (size_t ix = 0; ix < entry->dir_count; ix++) {
+		const glob_dir_t *dir = &entry->dirs[ix];
+		if (mb_mtime_racy(dir->mtime, entry->walked)) {
+			return false;
+		}
+
+		struct timespec mtime = {0};
+		mb_file_mtime(dir->path[0] == '\0' ? "." : dir->path, &mtime);
+
+		if (mtime.tv_sec != dir->mtime.tv_sec ||
+			mtime.tv_nsec != dir->mtime.tv_nsec) {
+			return false;
+		}
+	}
+
+	return entry->dir_count > 0;
+}
+
+void _clear_entry(glob_entry_t *entry) {
+	for (size_t ix = 0; ix < entry->dir_count; ix++) {
+		XFREE(entry->dirs[ix].path);
+	}
+	if (entry->dirs != NULL) {
+		XFREE(entry->dirs);
+	}
+
+	for (size_t ix = 0; ix < entry->match_count; ix++) {
+		XFREE(entry->matches[ix]);
+	}
+	if (entry->matches != NULL) {
+		XFREE(entry->matches);
+	}
+
+	if (entry->list.fields != NULL) {
+		XFREE(entry->list.fields);
+	}
+
+	char *pattern = entry->pattern;
+	*entry = (glob_entry_t){.pattern = pattern};
+}
+
+glob_entry_t *_find_entry(const char *pattern) {
+	for (size_t ix = 0; ix < entry_count; ix++) {
+		if (strcmp(entries[ix]->pattern, pattern) == 0) {
+			return entries[ix];
+		}
+	}
+
+	return NULL;
+}
+
+glob_entry_t *_add_entry(const char *pattern) {
+	if (entry_count == entry_capacity) {
+		entry_capacity = entry_capacity == 0 ? 8 : entry_capacity * 2;
+		entries = XREALLOC(entries, entry_capacity * sizeof(*entries));
+	}
+
+	glob_entry_t *entry = XCALLOC(1, sizeof(*entry));
+	entry->pattern = strdup(pattern);
+	entries[entry_count++] = entry;
+
+	return entry;
+}
+
+void _setup_list(glob_entry_t *entry) {
+	entry->list = (mcfg_list_t){
+		.type = TYPE_STRING,
+		.field_count = entry->match_count,
+		.fields = entry->match_count == 0
+					  ? NULL
+					  : XCALLOC(entry->match_count, sizeof(mcfg_field_t)),
+	};
+
+	for (size_t ix = 0; ix < entry->match_count; ix++) {
+		entry->list.fields[ix] = (mcfg_field_t){
+			.name = NULL,
+			.type = TYPE_STRING,
+			.data = entry->matches[ix],
+			.size = strlen(entry->matches[ix]) + 1,
+		};
+	}
+
+	entry->field = (mcfg_field_t){
+		.name = entry->pattern,
+		.type = TYPE_LIST,
+		.data = &entry->list,
+		.size = sizeof(entry->list),
+	};
+}
+
+mcfg_field_t *mb_glob_expand(const char *pattern) {
+	glob_entry_t *entry = _find_entry(pattern);
+	if (entry != NULL && entry->current) {
+		return &entry->field;
+	}
+
+	glob_pattern_t compiled;
+	if (!_compile_pattern(pattern, &compiled)) {
+		mb_logf(LOG_ERROR, "invalid glob \"%s\"!\n", pattern);
+		return NULL;
+	}
+
+	if (entry == NULL) {
+		entry = _add_entry(pattern);
+	}
+
+	if (_entry_unchanged(entry)) {
+		mb_logf(
+			LOG_DEBUG, "glob \"%s\": %zu matches, %zu directories unchanged\n",
+			pattern, entry->match_count, entry->dir_count);
+	} else {
+		_clear_entry(entry);
+		_walk(&compiled, entry);
+		cache_dirty = true;
+
+		mb_logf(
+			LOG_DEBUG, "glob \"%s\": %zu matches in %zu directories\n", pattern,
+			entry->match_count, entry->dir_count);
+	}
+
+	_free_pattern(&compiled);
+	_setup_list(entry);
+	entry->current = true;
+
+	return &entry->field;
+}
+
+struct glob_reader {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+};
+
+bool _read_data(struct glob_reader *reader, void *dest, size_t size) {
+	if (reader->size - reader->pos < size) {
+		return false;
+	}
+
+	memcpy(dest, reader->data + reader->pos, size);
+	reader->pos += size;
+	return true;
+}
+
+bool _read_string(struct glob_reader *reader, size_t size, char **dest) {
+	if (size == 0 || reader->size - reader->pos < size ||
+		reader->data[reader->pos + size - 1] != '\0') {
+		return false;
+	}
+
+	*dest = strdup((const char *)reader->data + reader->pos);
+	reader->pos += size;
+	return true;
+}
+
+bool _read_entry(struct glob_reader *reader) {
+	glob_cache_entry_t header;
+	char *pattern;
+	if (!_read_data(reader, &header, sizeof(header)) ||
+		!_read_string(reader, header.pattern_size, &pattern)) {
+		return false;
+	}
+
+	glob_entry_t *entry = _add_entry(pattern);
+	entry->walked = (struct timespec){
+		.tv_sec = header.walked_sec,
+		.tv_nsec = header.walked_nsec,
+	};
+	XFREE(pattern);
+
+	for (uint32_t ix = 0; ix < header.dir_count; ix++) {
+		glob_cache_dir_t dir;
+		char *path;
+		if (!_read_data(reader, &dir, sizeof(dir)) ||
+			!_read_string(reader, dir.path_size, &path)) {
+			return false;
+		}
+
+		_entry_add_dir(
+			entry, path,
+			(struct timespec){
+				.tv_sec = dir.mtime_sec,
+				.tv_nsec = dir.mtime_nsec,
+			});
+	}
+
+	/* each match takes at least its size and terminator */
+	if (header.match_count > (reader->size - reader->pos) / 5) {
+		return false;
+	}
+	if (header.match_count > 0) {
+		entry->matches = XCALLOC(header.match_count, sizeof(*entry->matches));
+	}
+	for (uint32_t ix = 0; ix < header.match_count; ix++) {
+		uint32_t size;
+		if (!_read_data(reader, &size, sizeof(size)) ||
+			!_read_string(reader, size, &entry->matches[ix])) {
+			return false;
+		}
+		entry->match_count++;
+	}
+
+	return true;
+}
+
+void _free_entries(void) {
+	for (size_t ix = 0; ix < entry_count; ix++) {
+		_clear_entry(entries[ix]);
+		XFREE(entries[ix]->pattern);
+		XFREE(entries[ix]);
+	}
+
+	if (entries != NULL) {
+		XFREE(entries);
+		entries = NULL;
+	}
+	entry_count = 0;
+	entry_capacity = 0;
+}
+
+/**
+ * @brief Read the whole file at a path.
+ * @return NULL if it could not be read.
+ */
+uint8_t *_read_file(const char *path, size_t *size) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	uint8_t *data = XMALLOC(st.st_size);
+	size_t pos = 0;
+	while (pos < (size_t)st.st_size) {
+		ssize_t res = read(fd, data + pos, st.st_size - pos);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			break;
+		}
+		pos += res;
+	}
+
+	close(fd);
+	*size = pos;
+	return data;
+}
+
+bool mb_glob_open(const char *path) {
+	mb_glob_close();
+	cache_path = strdup(path);
+
+	size_t size;
+	uint8_t *data = _read_file(path, &size);
+	if (data == NULL) {
+		return errno == ENOENT;
+	}
+
+	struct glob_reader reader = {.data = data, .size = size, .pos = 0};
+	glob_cache_header_t header;
+	bool ok = _read_data(&reader, &header, sizeof(header)) &&
+			  memcmp(header.magic, GLOB_CACHE_MAGIC, sizeof(header.magic)) ==
+				  0 &&
+			  header.version == GLOB_CACHE_VERSION;
+
+	for (uint32_t ix = 0; ok && ix < header.entry_count; ix++) {
+		ok = _read_entry(&reader);
+	}
+
+	XFREE(data);
+
+	if (!ok) {
+		mb_logf(LOG_DEBUG, "ignoring invalid glob cache \"%s\"\n", path);
+		_free_entries();
+		return false;
+	}
+
+	mb_logf(LOG_DEBUG, "loaded %zu globs from \"%s\"\n", entry_count, path);
+	return true;
+}
+
+bool _write_string(FILE *file, const char *str) {
+	uint32_t size = strlen(str) + 1;
+	return fwrite(&size, sizeof(size), 1, file) == 1 &&
+		   fwrite(str, size, 1, file) == 1;
+}
+
+bool _write_entry(FILE *file, const glob_entry_t *entry) {
+	glob_cache_entry_t header = {
+		.walked_sec = entry->walked.tv_sec,
+		.walked_nsec = entry->walked.tv_nsec,
+		.pattern_size = strlen(entry->pattern) + 1,
+		.dir_count = entry->dir_count,
+		.match_count = entry->match_count,
+		.reserved = 0,
+	};
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+		fwrite(entry->pattern, header.pattern_size, 1, file) != 1) {
+		return false;
+	}
+
+	for (size_t ix = 0; ix < entry->dir_count; ix++) {
+		const glob_dir_t *dir = &entry->dirs[ix];
+		glob_cache_dir_t cached = {
+			.mtime_sec = dir->mtime.tv_sec,
+			.mtime_nsec = dir->mtime.tv_nsec,
+			.path_size = strlen(dir->path) + 1,
+			.reserved = 0,
+		};
+
+		if (fwrite(&cached, sizeof(cached), 1, file) != 1 ||
+			fwrite(dir->path, cached.path_size, 1, file) != 1) {
+			return false;
+		}
+	}
+
+	for (size_t ix = 0; ix < entry->match_count; ix++) {
+		if (!_write_string(file, entry->matches[ix])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Overwrite the glob cache in place. Unlike replacing it, this does
+ * not change the modification time of its directory, which globs may have
+ * read. A partially written cache is ignored when it is loaded.
+ */
+bool _write_glob_cache(void) {
+	/* entries which were never expanded are not kept */
+	size_t count = 0;
+	for (size_t ix = 0; ix < entry_count; ix++) {
+		count += entries[ix]->dir_count > 0;
+	}
+
+	glob_cache_header_t header = {
+		.magic = GLOB_CACHE_MAGIC,
+		.version = GLOB_CACHE_VERSION,
+		.entry_count = count,
+	};
+
+	FILE *file = fopen(cache_path, "wb");
+	bool ok = file != NULL && fwrite(&header, sizeof(header), 1, file) == 1;
+
+	for (size_t ix = 0; ok && ix < entry_count; ix++) {
+		if (entries[ix]->dir_count > 0) {
+			ok = _write_entry(file, entries[ix]);
+		}
+	}
+
+	if (file != NULL) {
+		ok = fclose(file) == 0 && ok;
+	}
+
+	return ok;
+}
+
+void mb_glob_close(void) {
+	if (cache_path != NULL && cache_dirty && !_write_glob_cache()) {
+		mb_logf(
+			LOG_WARNING, "could not write glob cache \"%s\": %s\n", cache_path,
+			strerror(errno));
+	}
+
+	if (cache_path != NULL) {
+		XFREE(cache_path);
+		cache_path = NULL;
+	}
+	cache_dirty = false;
+
+	_free_entries();
+}
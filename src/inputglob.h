@@ -0,0 +1,52 @@
+/* inputglob.h ; mariebuild input glob header
+ *
+ * Expands the input_glob field of c_rules into an input list. The pattern
+ * is split at slashes, each segment may use the wildcards of fnmatch and a
+ * segment of just "**" matches any amount of directories. Wildcards do not
+ * match a leading dot and symbolic links to directories are not descended
+ * into.
+ *
+ * Directories are read level by level on the worker threads. Each
+ * expansion is remembered along with the modification times of the
+ * directories read for it, so that it is reused as long as none of them
+ * had entries added, removed or renamed. Directories which were modified
+ * around the time they were read are read again by the next build.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef INPUTGLOB_H
+#define INPUTGLOB_H
+
+#include <stdbool.h>
+
+#include "mcfg.h"
+
+#define GLOB_CACHE_DEFAULT_PATH ".mb_globs"
+
+/* pattern segments after the leading ones without wildcards */
+#define GLOB_MAX_SEGMENTS 64
+
+/**
+ * @brief Load the expansions remembered in the glob cache at the given
+ * path. Patterns are still expanded if this was not called.
+ */
+bool mb_glob_open(const char *path);
+
+/**
+ * @brief Write the glob cache if any pattern had to be expanded and free
+ * all expansions.
+ */
+void mb_glob_close(void);
+
+/**
+ * @brief Expand a pattern into a field holding a list of the matching
+ * files in lexicographic order. A pattern is only expanded once per build,
+ * the field is shared by every rule using the same pattern and stays valid
+ * until mb_glob_close.
+ * @return NULL if the pattern is invalid.
+ */
+mcfg_field_t *mb_glob_expand(const char *pattern);
+
+#endif /* #ifndef INPUTGLOB_H */
@@ -0,0 +1,52 @@
+/* ioutil.c ; mariebuild I/O utilities
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unistd.h>
+
+#include "ioutil.h"
+
+bool mb_write_all(int fd, const void *data, size_t size) {
+	const uint8_t *pos = data;
+
+	while (size > 0) {
+		ssize_t res = write(fd, pos, size);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+		if (res <= 0) {
+			return false;
+		}
+
+		pos += res;
+		size -= res;
+	}
+
+	return true;
+}
+
+void mb_write_json_string(FILE *file, const char *str) {
+	fputc('"', file);
+
+	for (const unsigned char *pos = (const unsigned char *)str; *pos != '\0';
+		 pos++) {
+		if (*pos == '"' || *pos == '\\') {
+			fputc('\\', file);
+			fputc(*pos, file);
+		} else if (*pos < 0x20) {
+			fprintf(file, "\\u%04x", *pos);
+		} else {
+			fputc(*pos, file);
+		}
+	}
+
+	fputc('"', file);
+}
@@ -0,0 +1,26 @@
+/* ioutil.h ; mariebuild I/O utilities header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef IOUTIL_H
+#define IOUTIL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @brief Write all of data to fd, retrying short and interrupted writes.
+ * Only calls write, so that it may be used from signal handlers.
+ * @return false if a write failed, errno is left as set by it.
+ */
+bool mb_write_all(int fd, const void *data, size_t size);
+
+/**
+ * @brief Write a string as a quoted and escaped JSON string.
+ */
+void mb_write_json_string(FILE *file, const char *str);
+
+#endif /* #ifndef IOUTIL_H */
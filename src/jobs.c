@@ -0,0 +1,347 @@
+/* jobs.c ; mariebuild global job pool impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "executor.h"
+#include "flight.h"
+#include "jobs.h"
+#include "logging.h"
+#include "probes.h"
+#include "timeutil.h"
+#include "trace.h"
+#include "xmem.h"
+
+static size_t max_jobs = 0;
+static job_output_t output_mode = JOB_OUTPUT_DIRECT;
+
+/* parallel arrays indexed by slot */
+static process_t *processes = NULL;
+static job_t **slots = NULL;
+static size_t running = 0;
+
+/* FIFO of jobs waiting for a slot */
+static job_t *queue_head = NULL;
+static job_t *queue_tail = NULL;
+
+size_t mb_jobs_default_count(void) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (size_t)cpus : 1;
+}
+
+void mb_jobs_init(size_t count, job_output_t output) {
+	max_jobs = count == 0 ? mb_jobs_default_count() : count;
+	output_mode = output == JOB_OUTPUT_BUFFERED && max_jobs == 1
+					  ? JOB_OUTPUT_DIRECT
+					  : output;
+	processes = XCALLOC(max_jobs, sizeof(*processes));
+	slots = XCALLOC(max_jobs, sizeof(*slots));
+	running = 0;
+
+	for (size_t ix = 0; mb_trace_enabled() && ix < max_jobs; ix++) {
+		char name[32];
+		snprintf(name, sizeof(name), "slot %zu", ix);
+		mb_trace_name_track(TRACE_TRACK_SLOTS + ix, name);
+	}
+
+	mb_logf(LOG_DEBUG, "job pool has %zu slots\n", max_jobs);
+}
+
+void mb_jobs_destroy(void) {
+	while (queue_head != NULL) {
+		job_t *next = queue_head->next;
+		XFREE(queue_head->script);
+		XFREE(queue_head);
+		queue_head = next;
+	}
+	queue_tail = NULL;
+
+	if (processes != NULL) {
+		XFREE(processes);
+		processes = NULL;
+	}
+
+	if (slots != NULL) {
+		XFREE(slots);
+		slots = NULL;
+	}
+}
+
+void mb_job_group_init(
+	job_group_t *group,
+	char *name,
+	size_t max_running,
+	bool ignore_failures) {
+	*group = (job_group_t){
+		.name = name,
+		.max_running = max_running,
+		.ignore_failures = ignore_failures,
+		.buffer_output = false,
+		.running = 0,
+		.outstanding = 0,
+		.status = 0,
+		.on_job_done = NULL,
+		.ctx = NULL,
+	};
+}
+
+bool _group_failed(job_group_t *group) {
+	return group->status != 0 && !group->ignore_failures;
+}
+
+/**
+ * @brief Print the captured output of a finished job in one go, so that it
+ * does not interleave with the output of other jobs. Its stdout and stderr
+ * are printed to mariebuild's own.
+ */
+void _replay_output(job_t *job, int status) {
+	if (output_mode == JOB_OUTPUT_QUIET) {
+		if (status == 0) {
+			return;
+		}
+
+		mb_logf(
+			LOG_ERROR, "job of \"%s\" failed with status %d:\n",
+			job->group->name, status);
+	}
+
+	if (job->output_fd >= 0) {
+		fflush(stdout);
+		mb_capture_replay(job->output_fd, STDOUT_FILENO);
+	}
+	if (job->error_fd >= 0) {
+		fflush(stderr);
+		mb_capture_replay(job->error_fd, STDERR_FILENO);
+	}
+}
+
+void _finish_job(job_t *job, int status) {
+	job_group_t *group = job->group;
+
+	if (status != 0) {
+		mb_logf(
+			LOG_DEBUG, "job of \"%s\" exited with status %d\n", group->name,
+			status);
+	}
+
+	if (job->output_fd >= 0 || job->error_fd >= 0) {
+		_replay_output(job, status);
+	}
+	if (job->output_fd >= 0) {
+		close(job->output_fd);
+	}
+	if (job->error_fd >= 0) {
+		close(job->error_fd);
+	}
+
+	group->status = group->status > status ? group->status : status;
+	group->outstanding--;
+
+	if (group->on_job_done != NULL) {
+		group->on_job_done(group, job, status, group->ctx);
+	}
+
+	mb_cleanup_process(&job->process);
+	XFREE(job->script);
+	XFREE(job);
+}
+
+void _start_job(job_t *job, size_t slot) {
+	launch_opts_t opts = LAUNCH_OPTS_DEFAULT;
+	if (output_mode == JOB_OUTPUT_QUIET ||
+		(output_mode == JOB_OUTPUT_BUFFERED && job->group->buffer_output)) {
+		job->output_fd = mb_capture_open(job->group->name);
+		job->error_fd = mb_capture_open(job->group->name);
+
+		opts.stdout_fd = job->output_fd;
+		opts.stderr_fd = job->error_fd;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &job->started);
+	clock_gettime(CLOCK_REALTIME, &job->started_wall);
+	job->process =
+		mb_exec_parallel_opts(job->script, job->group->name, &opts);
+	if (job->process.pid == 0) {
+		_finish_job(job, 1);
+		return;
+	}
+
+	MB_PROBE3(job__start, job->group->name, job->process.pid, slot);
+
+	flight_event_t event = FLIGHT_EVENT(FLIGHT_JOB_START, job->group->name);
+	event.slot = slot;
+	event.pid = job->process.pid;
+	event.element = job->element;
+	mb_flight_record(event);
+
+	job->group->running++;
+	processes[slot] = job->process;
+	slots[slot] = job;
+	running++;
+}
+
+/**
+ * @brief Start as many queued jobs as there are free slots. Jobs of a group
+ * which reached its limit are skipped, jobs of a failed group are dropped.
+ */
+void _dispatch(void) {
+	job_t *prev = NULL;
+	job_t *job = queue_head;
+	size_t slot = 0;
+
+	while (job != NULL && running < max_jobs) {
+		job_t *next = job->next;
+		job_group_t *group = job->group;
+
+		bool drop = _group_failed(group);
+		bool start = !drop && (group->max_running == 0 ||
+							   group->running < group->max_running);
+
+		if (!drop && !start) {
+			prev = job;
+			job = next;
+			continue;
+		}
+
+		if (prev == NULL) {
+			queue_head = next;
+		} else {
+			prev->next = next;
+		}
+		if (queue_tail == job) {
+			queue_tail = prev;
+		}
+
+		if (drop) {
+			group->outstanding--;
+			XFREE(job->script);
+			XFREE(job);
+		} else {
+			while (slots[slot] != NULL) {
+				slot++;
+			}
+			_start_job(job, slot);
+		}
+
+		job = next;
+	}
+}
+
+/**
+ * @brief Reap a single finished job.
+ * @param block Wait until a job finishes if none has yet.
+ * @return Whether a job was reaped.
+ */
+bool _reap(bool block) {
+	if (running == 0) {
+		return false;
+	}
+
+	size_t slot;
+	struct rusage usage;
+	int status = mb_wait_process(processes, max_jobs, &slot, block, &usage);
+	if (status < 0) {
+		return false;
+	}
+
+	job_t *job = slots[slot];
+	clock_gettime(CLOCK_MONOTONIC, &job->finished);
+	job->usage = usage;
+	slots[slot] = NULL;
+	processes[slot] = (process_t){.pid = 0, .location = NULL};
+	running--;
+
+	job->group->running--;
+
+	uint64_t started = mb_timespec_ns(job->started);
+	uint64_t finished = mb_timespec_ns(job->finished);
+
+	MB_PROBE4(
+		job__exit, job->group->name, job->process.pid, status,
+		finished - started);
+
+	flight_event_t event = FLIGHT_EVENT(FLIGHT_JOB_EXIT, job->group->name);
+	event.slot = slot;
+	event.pid = job->process.pid;
+	event.element = job->element;
+	event.status = status;
+	event.duration = finished - started;
+	mb_flight_record(event);
+
+	if (mb_trace_enabled()) {
+		trace_arg_t trace_args[] = {
+			TRACE_NUM("pid", job->process.pid),
+			TRACE_NUM("status", status),
+			TRACE_NUM("element", job->element),
+		};
+		mb_trace_span_on(
+			TRACE_TRACK_SLOTS + slot, "job", job->group->name,
+			started, finished, trace_args, 3);
+	}
+
+	_finish_job(job, status);
+
+	return true;
+}
+
+void mb_jobs_submit(job_group_t *group, char *script, ssize_t element) {
+	job_t *job = XMALLOC(sizeof(*job));
+	*job = (job_t){
+		.group = group,
+		.script = script,
+		.element = element,
+		.process = {.pid = 0, .location = NULL},
+		.output_fd = -1,
+		.error_fd = -1,
+		.started = {0},
+		.finished = {0},
+		.next = NULL,
+	};
+
+	group->outstanding++;
+
+	if (queue_tail == NULL) {
+		queue_head = job;
+	} else {
+		queue_tail->next = job;
+	}
+	queue_tail = job;
+
+	mb_jobs_pump();
+}
+
+void mb_jobs_pump(void) {
+	while (_reap(false)) {
+	}
+
+	_dispatch();
+}
+
+bool mb_jobs_wait_any(void) {
+	_dispatch();
+	return _reap(true);
+}
+
+void mb_jobs_cancel_queued(void) {
+	while (queue_head != NULL) {
+		job_t *next = queue_head->next;
+		queue_head->group->outstanding--;
+		XFREE(queue_head->script);
+		XFREE(queue_head);
+		queue_head = next;
+	}
+
+	queue_tail = NULL;
+}
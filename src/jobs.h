@@ -0,0 +1,128 @@
+/* jobs.h ; mariebuild global job pool header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "executor.h"
+
+struct job;
+
+typedef enum job_output {
+	/* jobs write to mariebuild's stdout and stderr directly */
+	JOB_OUTPUT_DIRECT = 0,
+	/* the output of each job of groups which buffer their output is
+	 * printed at once when it finished */
+	JOB_OUTPUT_BUFFERED,
+	/* like buffered, but only the output of failed jobs is printed */
+	JOB_OUTPUT_QUIET,
+} job_output_t;
+
+/**
+ * @brief A source of jobs, e.g. a c_rule or the exec field of a target.
+ * All groups share the slots of the global job pool.
+ */
+typedef struct job_group {
+	char *name;
+
+	/* maximum amount of jobs of this group running at once, 0 = no limit */
+	size_t max_running;
+	bool ignore_failures;
+	/* whether the output of this group's jobs is captured with
+	 * JOB_OUTPUT_BUFFERED, e.g. not for long running scripts whose
+	 * progress should be seen as it happens */
+	bool buffer_output;
+
+	size_t running;
+	/* jobs which were submitted but have not finished yet */
+	size_t outstanding;
+	/* highest exit status of all finished jobs */
+	int status;
+
+	/* Called for every job of this group which ran, after the group's
+	 * counters were updated. May be NULL.
+	 */
+	void (*on_job_done)(
+		struct job_group *group,
+		const struct job *job,
+		int status,
+		void *ctx);
+	void *ctx;
+} job_group_t;
+
+typedef struct job {
+	job_group_t *group;
+	char *script;
+	/* index of the element the job was rendered for, -1 if none */
+	ssize_t element;
+	process_t process;
+	/* captured stdout and stderr, -1 if the job writes directly */
+	int output_fd;
+	int error_fd;
+	/* CLOCK_MONOTONIC time at which the job was started */
+	struct timespec started;
+	/* the same as CLOCK_REALTIME, comparable to modification times */
+	struct timespec started_wall;
+	/* set once the job was reaped, usage covers the children it waited
+	 * for as well */
+	struct timespec finished;
+	struct rusage usage;
+
+	struct job *next;
+} job_t;
+
+/**
+ * @brief The default amount of job slots, which is the amount of online
+ * CPUs.
+ */
+size_t mb_jobs_default_count(void);
+
+/**
+ * @param output Buffered output is only used with more than one slot, a
+ * single job at a time can not interleave with others.
+ */
+void mb_jobs_init(size_t max_jobs, job_output_t output);
+
+void mb_jobs_destroy(void);
+
+void mb_job_group_init(
+	job_group_t *group,
+	char *name,
+	size_t max_running,
+	bool ignore_failures);
+
+/**
+ * @brief Queue a script for execution. The pool takes ownership of the
+ * script. Finished jobs are reaped and queued jobs are started without
+ * blocking.
+ * @param element Passed on to the group's on_job_done callback.
+ */
+void mb_jobs_submit(job_group_t *group, char *script, ssize_t element);
+
+/**
+ * @brief Reap finished jobs and start queued ones without blocking.
+ */
+void mb_jobs_pump(void);
+
+/**
+ * @brief Start queued jobs and block until one running job has finished.
+ * @return Whether a job was reaped, false if none was running.
+ */
+bool mb_jobs_wait_any(void);
+
+/**
+ * @brief Drop every job which has not been started yet.
+ */
+void mb_jobs_cancel_queued(void);
+
+#endif /* #ifndef JOBS_H */
@@ -4,6 +4,8 @@
  * Licensend under the BSD 3-Clause License.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -61,6 +63,9 @@ int mb_logf(log_level_t level, const char *format, ...) {
 			break;
 	}
 
+	/* workers log as well, keep their lines whole */
+	flockfile(stderr);
+
 	fprintf(stderr, "%s %s", level_prefix, ANSI_BOLD);
 
 	va_list arg;
@@ -72,6 +77,8 @@ int mb_logf(log_level_t level, const char *format, ...) {
 
 	fprintf(stderr, ANSI_RESET);
 
+	funlockfile(stderr);
+
 	return done;
 }
 
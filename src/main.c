@@ -14,11 +14,19 @@
 #include "logging.h"
 #include "mcfg.h"
 #include "signals.h"
+#include "summary.h"
+#include "trace.h"
 
 #define MARIEBUILD_COLORED_LOGO
 
 #define MARIEBUILD_VERSION "0.7.2 (develop)"
 
+/* keys of options without a short form */
+#define OPT_TRACE 0x100
+#define OPT_SUMMARY 0x101
+#define OPT_SUMMARY_JSON 0x102
+#define OPT_STATS 0x103
+
 /* clang-format off */
 /* clang-format fucks this macro definition up really badly somehow */
 #ifdef MARIEBUILD_COLORED_LOGO
@@ -51,6 +59,21 @@ static struct argp_option options[] = {
 	{"keep-going", 'k', 0, 0,
 	 "Ignore any failures (if possible) and keep on building", 0},
 	{"verbosity", 'v', "LEVEL", 0, "Set the verbosity level (0-3)", 0},
+	{"jobs", 'j', "N", 0,
+	 "Run up to N jobs at once (defaults to the amount of online CPUs)", 0},
+	{"quiet", 'q', 0, 0, "Only print the output of jobs which failed", 0},
+	{"trace", OPT_TRACE, "FILE", 0,
+	 "Write a Chrome trace of the build to FILE, e.g. for Perfetto", 0},
+	{"summary", OPT_SUMMARY, "N", OPTION_ARG_OPTIONAL,
+	 "Print the time spent per target and rule and the N slowest jobs "
+	 "(defaults to 10) once the build is done",
+	 0},
+	{"summary-json", OPT_SUMMARY_JSON, "FILE", 0,
+	 "Write the build summary to FILE as JSON", 0},
+	{"stats", OPT_STATS, 0, 0,
+	 "Print counters and timers of mariebuild's own overhead, if built with "
+	 "MB_STATS",
+	 0},
 	{0, 0, 0, 0, 0, 0}};
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
@@ -71,10 +94,45 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 		case 'k':
 			args->keep_going = true;
 			break;
+		case 'q':
+			args->quiet = true;
+			break;
 		case 'v':;
 			args->verbosity = str_to_loglvl(arg);
 			args->verbosity_overriden = true;
 			break;
+		case 'j': {
+			char *end;
+			long jobs = strtol(arg, &end, 10);
+			if (*end != 0 || jobs < 1) {
+				argp_error(state, "invalid job count \"%s\"", arg);
+			}
+			args->jobs = (size_t)jobs;
+			break;
+		}
+		case OPT_TRACE:
+			args->trace = arg;
+			break;
+		case OPT_SUMMARY: {
+			args->summary = true;
+			if (arg == NULL) {
+				break;
+			}
+
+			char *end;
+			long slowest = strtol(arg, &end, 10);
+			if (*end != 0 || slowest < 0) {
+				argp_error(state, "invalid number of slowest jobs \"%s\"", arg);
+			}
+			args->summary_slowest = (size_t)slowest;
+			break;
+		}
+		case OPT_SUMMARY_JSON:
+			args->summary_json = arg;
+			break;
+		case OPT_STATS:
+			args->stats = true;
+			break;
 		default:
 			return ARGP_ERR_UNKNOWN;
 	}
@@ -99,8 +157,15 @@ int main(int argc, char **argv) {
 	args.force = false;
 	args.no_splash = false;
 	args.keep_going = false;
+	args.jobs = 0;
 	args.verbosity = DEFAULT_LOG_LEVEL;
 	args.verbosity_overriden = false;
+	args.trace = NULL;
+	args.summary = false;
+	args.summary_slowest = SUMMARY_DEFAULT_SLOWEST;
+	args.summary_json = NULL;
+	args.stats = false;
+	args.quiet = false;
 
 	argp_parse(&argp, argc, argv, 0, 0, &args);
 
@@ -111,5 +176,9 @@ int main(int argc, char **argv) {
 	mb_log_level = args.verbosity;
 
 	mb_install_signal_handlers();
-	return mb_start(args);
+	mb_trace_open(args.trace);
+
+	int ret = mb_start(args);
+	mb_trace_close();
+	return ret;
 }
@@ -0,0 +1,49 @@
+/* probes.h ; mariebuild static tracepoints
+ *
+ * USDT probes of the "mariebuild" provider, which perf and bpftrace can
+ * attach to in a running build, e.g. for a histogram of job durations:
+ *
+ *   bpftrace -e 'usdt:./mb:mariebuild:job__exit { @ = hist(arg3); }'
+ *
+ * A probe which nothing is attached to is a single nop. They need the
+ * systemtap sys/sdt.h header, without it or with MB_NO_PROBES defined
+ * every MB_PROBE* macro expands to nothing.
+ *
+ * target__start(name)                   target__end(name, status)
+ * rule__start(name)                     rule__end(name, status)
+ * job__start(group, pid, slot)          job__exit(group, pid, status, ns)
+ * newer__check(file, other, newer)      element__check(rule, input, outdated)
+ * format__start(site)                   format__end(site, err)
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if defined(__linux__) && !defined(MB_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define MB_HAVE_PROBES
+#endif
+#endif
+
+#ifdef MB_HAVE_PROBES
+
+#include <sys/sdt.h>
+
+#define MB_PROBE1(name, a) STAP_PROBE1(mariebuild, name, a)
+#define MB_PROBE2(name, a, b) STAP_PROBE2(mariebuild, name, a, b)
+#define MB_PROBE3(name, a, b, c) STAP_PROBE3(mariebuild, name, a, b, c)
+#define MB_PROBE4(name, a, b, c, d) STAP_PROBE4(mariebuild, name, a, b, c, d)
+
+#else
+
+#define MB_PROBE1(name, a) ((void)0)
+#define MB_PROBE2(name, a, b) ((void)0)
+#define MB_PROBE3(name, a, b, c) ((void)0)
+#define MB_PROBE4(name, a, b, c, d) ((void)0)
+
+#endif /* #ifdef MB_HAVE_PROBES */
+
+#endif /* #ifndef PROBES_H */
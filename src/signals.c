@@ -7,12 +7,17 @@
 #define _XOPEN_SOURCE 700
 #define _POSIX_C_SOURCE 2
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "cptrlist.h"
+#include "flight.h"
 #include "logging.h"
 #include "signals.h"
 #include "stringutil.h"
@@ -29,8 +34,12 @@
 CPtrList tmp_files;
 bool initialised = false;
 
+/* self-pipe which receives a byte for every SIGCHLD */
+static int sigchld_pipe[2] = {-1, -1};
+
 void mb_signal_generic_handler(int signal) {
 	mb_logf(LOG_ERROR, "signal %d received, quitting...\n", signal);
+	mb_flight_dump_signal(signal);
 	for (size_t ix = 0; ix < tmp_files.size; ix++) {
 		char *item = tmp_files.items[ix];
 		if (item == NULL) {
@@ -43,16 +52,73 @@ void mb_signal_generic_handler(int signal) {
 	exit(-1);
 }
 
+void mb_sigchld_handler(int signal) {
+	(void)signal;
+
+	int saved_errno = errno;
+	char byte = 0;
+	if (write(sigchld_pipe[1], &byte, 1) < 0) {
+		/* pipe is full, the reader will wake up regardless */
+	}
+	errno = saved_errno;
+}
+
+bool _install_sigchld_handler(void) {
+	if (pipe(sigchld_pipe) != 0) {
+		mb_logf(
+			LOG_WARNING, "failed to create SIGCHLD pipe: OS Error %d (%s)\n",
+			errno, strerror(errno));
+		return false;
+	}
+
+	for (size_t ix = 0; ix < 2; ix++) {
+		fcntl(sigchld_pipe[ix], F_SETFL, O_NONBLOCK);
+		fcntl(sigchld_pipe[ix], F_SETFD, FD_CLOEXEC);
+	}
+
+	struct sigaction action = {0};
+	action.sa_handler = &mb_sigchld_handler;
+	action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&action.sa_mask);
+
+	if (sigaction(SIGCHLD, &action, NULL) != 0) {
+		mb_log(LOG_WARNING, "failed to install handle for SIGCHLD\n");
+		close(sigchld_pipe[0]);
+		close(sigchld_pipe[1]);
+		sigchld_pipe[0] = -1;
+		sigchld_pipe[1] = -1;
+		return false;
+	}
+
+	return true;
+}
+
 void mb_install_signal_handlers(void) {
 	SIGNAL_CHECKED(SIGHUP, &mb_signal_generic_handler);
 	SIGNAL_CHECKED(SIGINT, &mb_signal_generic_handler);
 	SIGNAL_CHECKED(SIGQUIT, &mb_signal_generic_handler);
 	SIGNAL_CHECKED(SIGTERM, &mb_signal_generic_handler);
 
+	_install_sigchld_handler();
+
 	cptrlist_init(&tmp_files, 16, 8);
 	initialised = true;
 }
 
+int mb_sigchld_fd(void) {
+	return sigchld_pipe[0];
+}
+
+void mb_drain_sigchld_fd(void) {
+	if (sigchld_pipe[0] < 0) {
+		return;
+	}
+
+	char buf[64];
+	while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0) {
+	}
+}
+
 void mb_register_tmp_file(char *path) {
 	if (!initialised) {
 		return;
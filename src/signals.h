@@ -13,6 +13,18 @@ void mb_signal_generic_handler(int signal);
 
 void mb_install_signal_handlers(void);
 
+/**
+ * @brief The read end of the SIGCHLD self-pipe, which becomes readable
+ * whenever a child process changed its state.
+ * @return The file descriptor or -1 if the handler could not be installed.
+ */
+int mb_sigchld_fd(void);
+
+/**
+ * @brief Discard all pending notifications on the SIGCHLD self-pipe.
+ */
+void mb_drain_sigchld_fd(void);
+
 void mb_register_tmp_file(char *path);
 
 void mb_unregister_tmp_file(char *path);
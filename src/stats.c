@@ -0,0 +1,88 @@
+/* stats.c ; mariebuild internal statistics impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include "logging.h"
+#include "stats.h"
+
+#ifdef MB_STATS
+
+_Atomic uint64_t mb_stat_counters[STAT_COUNT];
+
+uint64_t _stat(stat_counter_t counter) {
+	return atomic_load_explicit(
+		&mb_stat_counters[counter], memory_order_relaxed);
+}
+
+double _stat_ms(stat_counter_t counter) {
+	return (double)_stat(counter) / 1e6;
+}
+
+/**
+ * @return Average duration in microseconds of a timer over count calls.
+ */
+double _stat_avg_us(stat_counter_t timer, stat_counter_t count) {
+	uint64_t calls = _stat(count);
+	return calls == 0 ? 0.0 : (double)_stat(timer) / 1e3 / calls;
+}
+
+void mb_stats_print(void) {
+	mb_log(LOG_INFO, "internal stats:\n");
+	mb_logf_noprefix(
+		LOG_INFO,
+		"    format     %8" PRIu64 " calls %10" PRIu64
+		" bytes %10.3fms (%.1fus each)\n",
+		_stat(STAT_FORMAT_CALLS), _stat(STAT_FORMAT_BYTES),
+		_stat_ms(STAT_FORMAT_NS),
+		_stat_avg_us(STAT_FORMAT_NS, STAT_FORMAT_CALLS));
+	mb_logf_noprefix(
+		LOG_INFO,
+		"    render     %8" PRIu64 " calls %10" PRIu64
+		" bytes %10.3fms (%.1fus each)\n",
+		_stat(STAT_RENDER_CALLS), _stat(STAT_RENDER_BYTES),
+		_stat_ms(STAT_RENDER_NS),
+		_stat_avg_us(STAT_RENDER_NS, STAT_RENDER_CALLS));
+	mb_logf_noprefix(
+		LOG_INFO,
+		"    files      %8" PRIu64 " newer checks, %" PRIu64 " stat, %" PRIu64
+		" open\n",
+		_stat(STAT_NEWER_CHECKS), _stat(STAT_STAT_CALLS),
+		_stat(STAT_OPEN_CALLS));
+	mb_logf_noprefix(
+		LOG_INFO,
+		"    scripts    %8" PRIu64 " writes %9" PRIu64
+		" bytes %10.3fms (%.1fus each)\n",
+		_stat(STAT_SCRIPT_WRITES), _stat(STAT_SCRIPT_BYTES),
+		_stat_ms(STAT_SCRIPT_NS),
+		_stat_avg_us(STAT_SCRIPT_NS, STAT_SCRIPT_WRITES));
+	mb_logf_noprefix(
+		LOG_INFO,
+		"    spawn      %8" PRIu64 " calls %27.3fms (%.1fus each)\n",
+		_stat(STAT_SPAWNS), _stat_ms(STAT_SPAWN_NS),
+		_stat_avg_us(STAT_SPAWN_NS, STAT_SPAWNS));
+	mb_logf_noprefix(
+		LOG_INFO, "    wait       %8" PRIu64 " rounds, %" PRIu64 " wait4\n",
+		_stat(STAT_WAIT_ROUNDS), _stat(STAT_WAIT_CALLS));
+	mb_logf_noprefix(
+		LOG_INFO,
+		"    dynfields  %8" PRIu64 " linked, %" PRIu64 " unlinked\n",
+		_stat(STAT_DYNFIELD_LINKS), _stat(STAT_DYNFIELD_UNLINKS));
+}
+
+#else
+
+void mb_stats_print(void) {
+	mb_log(
+		LOG_WARNING,
+		"mariebuild was built without MB_STATS, no stats were collected\n");
+}
+
+#endif /* #ifdef MB_STATS */
@@ -0,0 +1,99 @@
+/* stats.h ; mariebuild internal statistics header
+ *
+ * Counters and timers for mariebuild's own hot paths, to tell its overhead
+ * apart from the time spent in child processes. They are only compiled in
+ * if MB_STATS is defined, otherwise every MB_STAT_* macro expands to
+ * nothing and its arguments are not evaluated.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+typedef enum stat_counter {
+	/* mcfg_format_field_embeds* calls, the bytes they produced and their
+	 * duration in ns */
+	STAT_FORMAT_CALLS,
+	STAT_FORMAT_BYTES,
+	STAT_FORMAT_NS,
+	/* the same for precompiled templates, which only fall back to the
+	 * formatter for values with embeds */
+	STAT_RENDER_CALLS,
+	STAT_RENDER_BYTES,
+	STAT_RENDER_NS,
+
+	STAT_NEWER_CHECKS,
+	STAT_STAT_CALLS,
+	STAT_OPEN_CALLS,
+
+	/* scripts written to a memfd or temporary file */
+	STAT_SCRIPT_WRITES,
+	STAT_SCRIPT_BYTES,
+	STAT_SCRIPT_NS,
+
+	STAT_SPAWNS,
+	STAT_SPAWN_NS,
+
+	/* iterations of mb_wait_process and the wait4 calls they made */
+	STAT_WAIT_ROUNDS,
+	STAT_WAIT_CALLS,
+
+	STAT_DYNFIELD_LINKS,
+	STAT_DYNFIELD_UNLINKS,
+
+	STAT_COUNT
+} stat_counter_t;
+
+#ifdef MB_STATS
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "timeutil.h"
+
+extern _Atomic uint64_t mb_stat_counters[STAT_COUNT];
+
+#define MB_STAT_ADD(counter, amount)                      \
+	atomic_fetch_add_explicit(                            \
+		&mb_stat_counters[(counter)], (uint64_t)(amount), \
+		memory_order_relaxed)
+
+#define MB_STAT_INC(counter) MB_STAT_ADD(counter, 1)
+
+/* declares a timer which is started right away */
+#define MB_STAT_TIMER(name) uint64_t name = mb_monotonic_ns()
+
+#define MB_STAT_ELAPSED(counter, name) \
+	MB_STAT_ADD(counter, mb_monotonic_ns() - (name))
+
+/* counts a call of the formatter which was timed by timer */
+#define MB_STAT_FORMATTED(timer, fmt_res)                                \
+	do {                                                                 \
+		MB_STAT_ELAPSED(STAT_FORMAT_NS, timer);                          \
+		MB_STAT_INC(STAT_FORMAT_CALLS);                                  \
+		if ((fmt_res).err == MCFG_FMT_OK) {                              \
+			MB_STAT_ADD(STAT_FORMAT_BYTES, strlen((fmt_res).formatted)); \
+		}                                                                \
+	} while (0)
+
+#else
+
+#define MB_STAT_ADD(counter, amount) ((void)0)
+#define MB_STAT_INC(counter) ((void)0)
+#define MB_STAT_TIMER(name) ((void)0)
+#define MB_STAT_ELAPSED(counter, name) ((void)0)
+#define MB_STAT_FORMATTED(timer, fmt_res) ((void)0)
+
+#endif /* #ifdef MB_STATS */
+
+/**
+ * @brief Print the collected statistics, or a warning if they were not
+ * compiled in.
+ */
+void mb_stats_print(void);
+
+#endif /* #ifndef STATS_H */
@@ -0,0 +1,444 @@
+/* summary.c ; mariebuild build summary impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/resource.h>
+
+#include "ioutil.h"
+#include "logging.h"
+#include "summary.h"
+#include "timeutil.h"
+#include "xmem.h"
+
+typedef struct summary_node {
+	/* NULL if the node did not run */
+	const char *kind;
+	const char *name;
+	int status;
+
+	uint64_t started;
+	uint64_t finished;
+
+	size_t jobs;
+	size_t failed;
+	size_t skipped;
+	size_t cached;
+
+	uint64_t job_total;
+	uint64_t job_max;
+	uint64_t user;
+	uint64_t sys;
+	/* KiB */
+	uint64_t max_rss;
+} summary_node_t;
+
+typedef struct summary_job {
+	size_t node;
+	/* NULL if the job has no element */
+	char *element;
+	int status;
+
+	uint64_t started;
+	uint64_t finished;
+	uint64_t user;
+	uint64_t sys;
+	uint64_t max_rss;
+} summary_job_t;
+
+static bool enabled = false;
+static bool print_summary = false;
+static const char *json_path = NULL;
+static size_t slowest_count = SUMMARY_DEFAULT_SLOWEST;
+static uint64_t build_started = 0;
+
+static summary_node_t *nodes = NULL;
+static size_t node_capacity = 0;
+
+static summary_job_t *jobs = NULL;
+static size_t job_count = 0;
+static size_t job_capacity = 0;
+
+uint64_t _timeval_ns(struct timeval tv) {
+	return (uint64_t)tv.tv_sec * 1000000000ULL + (uint64_t)tv.tv_usec * 1000;
+}
+
+/**
+ * @return ru_maxrss in KiB.
+ */
+uint64_t _max_rss(const struct rusage *usage) {
+	/* ru_maxrss is in bytes on macOS */
+#ifdef __APPLE__
+	return (uint64_t)usage->ru_maxrss / 1024;
+#else
+	return (uint64_t)usage->ru_maxrss;
+#endif
+}
+
+double _seconds(uint64_t ns) {
+	return (double)ns / 1e9;
+}
+
+void mb_summary_init(bool print, const char *path, size_t slowest) {
+	enabled = print || path != NULL;
+	print_summary = print;
+	json_path = path;
+	slowest_count = slowest;
+	build_started = mb_monotonic_ns();
+}
+
+bool mb_summary_enabled(void) {
+	return enabled;
+}
+
+summary_node_t *_summary_node(size_t node) {
+	if (node >= node_capacity) {
+		size_t capacity = node_capacity == 0 ? 64 : node_capacity * 2;
+		while (capacity <= node) {
+			capacity *= 2;
+		}
+
+		nodes = XREALLOC(nodes, capacity * sizeof(*nodes));
+		memset(
+			nodes + node_capacity, 0,
+			(capacity - node_capacity) * sizeof(*nodes));
+		node_capacity = capacity;
+	}
+
+	return &nodes[node];
+}
+
+void mb_summary_node_started(size_t node, const char *kind, const char *name) {
+	if (!enabled) {
+		return;
+	}
+
+	summary_node_t *entry = _summary_node(node);
+	entry->kind = kind;
+	entry->name = name;
+	entry->started = mb_monotonic_ns();
+}
+
+void mb_summary_node_done(
+	size_t node,
+	int status,
+	size_t skipped,
+	size_t cached) {
+	if (!enabled) {
+		return;
+	}
+
+	summary_node_t *entry = _summary_node(node);
+	entry->status = status;
+	entry->skipped = skipped;
+	entry->cached = cached;
+	entry->finished = mb_monotonic_ns();
+}
+
+void mb_summary_job(size_t node, const job_t *job, int status, char *element) {
+	if (!enabled) {
+		if (element != NULL) {
+			XFREE(element);
+		}
+		return;
+	}
+
+	if (job_count == job_capacity) {
+		job_capacity = job_capacity == 0 ? 256 : job_capacity * 2;
+		jobs = XREALLOC(jobs, job_capacity * sizeof(*jobs));
+	}
+
+	summary_job_t *entry = &jobs[job_count++];
+	*entry = (summary_job_t){
+		.node = node,
+		.element = element,
+		.status = status,
+		.started = mb_timespec_ns(job->started),
+		.finished = mb_timespec_ns(job->finished),
+		.user = _timeval_ns(job->usage.ru_utime),
+		.sys = _timeval_ns(job->usage.ru_stime),
+		.max_rss = _max_rss(&job->usage),
+	};
+
+	uint64_t duration = entry->finished - entry->started;
+
+	summary_node_t *owner = _summary_node(node);
+	owner->jobs++;
+	owner->failed += status != 0;
+	owner->job_total += duration;
+	owner->job_max = owner->job_max > duration ? owner->job_max : duration;
+	owner->user += entry->user;
+	owner->sys += entry->sys;
+	owner->max_rss =
+		owner->max_rss > entry->max_rss ? owner->max_rss : entry->max_rss;
+}
+
+struct summary_totals {
+	uint64_t wall;
+	size_t jobs;
+	size_t failed;
+	size_t skipped;
+	size_t cached;
+	uint64_t job_total;
+	uint64_t user;
+	uint64_t sys;
+	/* most jobs which were running at once */
+	size_t peak_jobs;
+	/* of mariebuild itself */
+	uint64_t max_rss;
+};
+
+struct job_edge {
+	uint64_t time;
+	/* 1 when a job started, -1 when it finished */
+	int delta;
+};
+
+int _compare_edges(const void *a, const void *b) {
+	const struct job_edge *edge_a = a;
+	const struct job_edge *edge_b = b;
+
+	if (edge_a->time != edge_b->time) {
+		return edge_a->time < edge_b->time ? -1 : 1;
+	}
+
+	/* a job finishing as another one starts does not overlap it */
+	return edge_a->delta - edge_b->delta;
+}
+
+size_t _peak_jobs(void) {
+	if (job_count == 0) {
+		return 0;
+	}
+
+	struct job_edge *edges = XMALLOC(job_count * 2 * sizeof(*edges));
+	for (size_t ix = 0; ix < job_count; ix++) {
+		edges[ix * 2] = (struct job_edge){jobs[ix].started, 1};
+		edges[ix * 2 + 1] = (struct job_edge){jobs[ix].finished, -1};
+	}
+	qsort(edges, job_count * 2, sizeof(*edges), _compare_edges);
+
+	size_t running = 0;
+	size_t peak = 0;
+	for (size_t ix = 0; ix < job_count * 2; ix++) {
+		running += edges[ix].delta;
+		peak = running > peak ? running : peak;
+	}
+
+	XFREE(edges);
+	return peak;
+}
+
+struct summary_totals _totals(void) {
+	struct summary_totals totals = {
+		.wall = mb_monotonic_ns() - build_started,
+		.peak_jobs = _peak_jobs(),
+	};
+
+	struct rusage self;
+	if (getrusage(RUSAGE_SELF, &self) == 0) {
+		totals.max_rss = _max_rss(&self);
+	}
+
+	for (size_t ix = 0; ix < node_capacity; ix++) {
+		summary_node_t *node = &nodes[ix];
+		totals.jobs += node->jobs;
+		totals.failed += node->failed;
+		totals.skipped += node->skipped;
+		totals.cached += node->cached;
+		totals.job_total += node->job_total;
+		totals.user += node->user;
+		totals.sys += node->sys;
+	}
+
+	return totals;
+}
+
+int _compare_durations(const void *a, const void *b) {
+	const summary_job_t *job_a = a;
+	const summary_job_t *job_b = b;
+	uint64_t duration_a = job_a->finished - job_a->started;
+	uint64_t duration_b = job_b->finished - job_b->started;
+
+	if (duration_a == duration_b) {
+		return 0;
+	}
+	return duration_a > duration_b ? -1 : 1;
+}
+
+void _print_summary(const struct summary_totals *totals) {
+	mb_logf(
+		LOG_INFO,
+		"build summary: %.3fs, %zu jobs ran (%zu failed), %zu up to date, "
+		"%zu restored from cache\n",
+		_seconds(totals->wall), totals->jobs, totals->failed, totals->skipped,
+		totals->cached);
+	mb_logf_noprefix(
+		LOG_INFO,
+		"    parallelism %.2f on average, %zu at peak; CPU %.3fs user, "
+		"%.3fs sys; mariebuild peak rss %.1fM\n\n",
+		totals->wall == 0 ? 0.0 : (double)totals->job_total / totals->wall,
+		totals->peak_jobs, _seconds(totals->user), _seconds(totals->sys),
+		(double)totals->max_rss / 1024);
+
+	mb_logf_noprefix(
+		LOG_INFO, "    %-6s %-24s %9s %5s %6s %9s %9s %9s %9s %8s\n", "kind",
+		"name", "wall", "jobs", "skip", "job total", "job max", "user", "sys",
+		"peak rss");
+
+	for (size_t ix = 0; ix < node_capacity; ix++) {
+		summary_node_t *node = &nodes[ix];
+		if (node->kind == NULL) {
+			continue;
+		}
+
+		mb_logf_noprefix(
+			LOG_INFO,
+			"    %-6s %-24s %8.3fs %5zu %6zu %8.3fs %8.3fs %8.3fs %8.3fs "
+			"%7.1fM\n",
+			node->kind, node->name, _seconds(node->finished - node->started),
+			node->jobs, node->skipped, _seconds(node->job_total),
+			_seconds(node->job_max), _seconds(node->user),
+			_seconds(node->sys), (double)node->max_rss / 1024);
+	}
+
+	size_t slowest = job_count < slowest_count ? job_count : slowest_count;
+	if (slowest == 0) {
+		return;
+	}
+
+	mb_logf_noprefix(LOG_INFO, "\n    slowest jobs:\n");
+	for (size_t ix = 0; ix < slowest; ix++) {
+		summary_job_t *job = &jobs[ix];
+		mb_logf_noprefix(
+			LOG_INFO, "    %8.3fs %8.3fs %8.3fs %7.1fM  %s%s%s%s\n",
+			_seconds(job->finished - job->started), _seconds(job->user),
+			_seconds(job->sys), (double)job->max_rss / 1024,
+			nodes[job->node].name, job->element != NULL ? " (" : "",
+			job->element != NULL ? job->element : "",
+			job->element != NULL ? ")" : "");
+	}
+}
+
+bool _write_json(const struct summary_totals *totals, int status) {
+	FILE *file = fopen(json_path, "w");
+	if (file == NULL) {
+		return false;
+	}
+
+	/* durations are given in seconds, sizes in KiB */
+	fprintf(
+		file,
+		"{\n  \"status\": %d,\n  \"wall\": %.6f,\n  \"jobs\": %zu,\n"
+		"  \"failed\": %zu,\n  \"skipped\": %zu,\n  \"cached\": %zu,\n"
+		"  \"job_total\": %.6f,\n  \"user\": %.6f,\n  \"sys\": %.6f,\n"
+		"  \"parallelism\": %.3f,\n  \"peak_jobs\": %zu,\n"
+		"  \"self_max_rss\": %" PRIu64 ",\n  \"nodes\": [",
+		status, _seconds(totals->wall), totals->jobs, totals->failed,
+		totals->skipped, totals->cached, _seconds(totals->job_total),
+		_seconds(totals->user), _seconds(totals->sys),
+		totals->wall == 0 ? 0.0 : (double)totals->job_total / totals->wall,
+		totals->peak_jobs, totals->max_rss);
+
+	bool first = true;
+	for (size_t ix = 0; ix < node_capacity; ix++) {
+		summary_node_t *node = &nodes[ix];
+		if (node->kind == NULL) {
+			continue;
+		}
+
+		fprintf(file, "%s\n    {\"kind\": ", first ? "" : ",");
+		mb_write_json_string(file, node->kind);
+		fputs(", \"name\": ", file);
+		mb_write_json_string(file, node->name);
+		fprintf(
+			file,
+			", \"status\": %d, \"wall\": %.6f, \"jobs\": %zu, "
+			"\"failed\": %zu, \"skipped\": %zu, \"cached\": %zu, "
+			"\"job_total\": %.6f, \"job_max\": %.6f, \"user\": %.6f, "
+			"\"sys\": %.6f, \"max_rss\": %" PRIu64 "}",
+			node->status, _seconds(node->finished - node->started),
+			node->jobs, node->failed, node->skipped, node->cached,
+			_seconds(node->job_total), _seconds(node->job_max),
+			_seconds(node->user), _seconds(node->sys), node->max_rss);
+		first = false;
+	}
+
+	fputs("\n  ],\n  \"slowest\": [", file);
+
+	size_t slowest = job_count < slowest_count ? job_count : slowest_count;
+	for (size_t ix = 0; ix < slowest; ix++) {
+		summary_job_t *job = &jobs[ix];
+
+		fprintf(file, "%s\n    {\"node\": ", ix == 0 ? "" : ",");
+		mb_write_json_string(file, nodes[job->node].name);
+		fputs(", \"element\": ", file);
+		if (job->element != NULL) {
+			mb_write_json_string(file, job->element);
+		} else {
+			fputs("null", file);
+		}
+		fprintf(
+			file,
+			", \"status\": %d, \"wall\": %.6f, \"user\": %.6f, "
+			"\"sys\": %.6f, \"max_rss\": %" PRIu64 "}",
+			job->status, _seconds(job->finished - job->started),
+			_seconds(job->user), _seconds(job->sys), job->max_rss);
+	}
+
+	fputs("\n  ]\n}\n", file);
+	return fclose(file) == 0;
+}
+
+void mb_summary_finish(int status) {
+	if (!enabled) {
+		return;
+	}
+
+	struct summary_totals totals = _totals();
+	qsort(jobs, job_count, sizeof(*jobs), _compare_durations);
+
+	if (print_summary) {
+		_print_summary(&totals);
+	}
+
+	if (json_path != NULL && !_write_json(&totals, status)) {
+		mb_logf(
+			LOG_WARNING, "could not write summary \"%s\": %s\n", json_path,
+			strerror(errno));
+	}
+
+	for (size_t ix = 0; ix < job_count; ix++) {
+		if (jobs[ix].element != NULL) {
+			XFREE(jobs[ix].element);
+		}
+	}
+	if (jobs != NULL) {
+		XFREE(jobs);
+		jobs = NULL;
+	}
+	job_count = 0;
+	job_capacity = 0;
+
+	if (nodes != NULL) {
+		XFREE(nodes);
+		nodes = NULL;
+	}
+	node_capacity = 0;
+
+	json_path = NULL;
+	enabled = false;
+}
@@ -0,0 +1,61 @@
+/* summary.h ; mariebuild build summary header
+ *
+ * Collects the wall time of every target and c_rule and the duration and
+ * resource usage of every job if a summary was asked for. It is printed
+ * once the build is done and can be written as JSON for CI to keep track
+ * of.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "jobs.h"
+
+/* amount of the slowest jobs listed unless told otherwise */
+#define SUMMARY_DEFAULT_SLOWEST 10
+
+/**
+ * @brief Start collecting, nothing is collected unless either print is set
+ * or a JSON path is given. The path has to outlive the summary.
+ * @param slowest Amount of the slowest jobs to list.
+ */
+void mb_summary_init(bool print, const char *json_path, size_t slowest);
+
+bool mb_summary_enabled(void);
+
+/**
+ * @brief Print and write the summary and free everything collected.
+ * @param status Exit status of the build.
+ */
+void mb_summary_finish(int status);
+
+/**
+ * @param node Index of the node in the build graph.
+ * @param kind Either "target" or "c_rule", has to outlive the summary.
+ */
+void mb_summary_node_started(size_t node, const char *kind, const char *name);
+
+/**
+ * @param skipped Jobs which did not run since their outputs were up to date.
+ * @param cached Jobs whose outputs were restored from the artifact cache.
+ */
+void mb_summary_node_done(
+	size_t node,
+	int status,
+	size_t skipped,
+	size_t cached);
+
+/**
+ * @brief Record a job of a node which was reaped.
+ * @param element Name of the job's element, NULL if it has none. Taken
+ * ownership of.
+ */
+void mb_summary_job(size_t node, const job_t *job, int status, char *element);
+
+#endif /* #ifndef SUMMARY_H */
@@ -9,42 +9,21 @@
 
 #include <string.h>
 
-#include "c_rule.h"
 #include "cptrlist.h"
-#include "executor.h"
+#include "fileindex.h"
+#include "jobs.h"
 #include "logging.h"
 #include "mcfg.h"
 #include "mcfg_format.h"
 #include "mcfg_util.h"
+#include "probes.h"
 #include "stringutil.h"
+#include "stats.h"
 #include "target.h"
+#include "trace.h"
 #include "types.h"
 #include "xmem.h"
 
-bool remove_dynfield(mcfg_file_t *file, char *name) {
-	ssize_t field_ix = -1;
-
-	for (size_t ix = 0; ix < file->dynfield_count; ix++) {
-		if (strcmp(file->dynfields[ix].name, name) == 0) {
-			field_ix = ix;
-			break;
-		}
-	}
-
-	if (field_ix == -1) {
-		mb_logf(LOG_DEBUG, "could not find field \"%s\" to remove!\n", name);
-		return false;
-	}
-
-	file->dynfield_count--;
-
-	for (size_t ix = field_ix; ix < file->dynfield_count; ix++) {
-		file->dynfields[ix] = file->dynfields[ix + 1];
-	}
-
-	return true;
-}
-
 CPtrList link_target_fields(mcfg_file_t *file, mcfg_section_t *target) {
 	const char *prefix = "target_";
 
@@ -57,8 +36,7 @@ CPtrList link_target_fields(mcfg_file_t *file, mcfg_section_t *target) {
 			continue;
 		}
 
-		mcfg_err_t err = mcfg_add_dynfield(
-			file, field->type, field->name, field->data, field->size);
+		mcfg_err_t err = mb_dynfield_push(file, *field);
 
 		if (err == MCFG_DUPLICATE_DYNFIELD) {
 			mb_logf(
@@ -71,7 +49,7 @@ CPtrList link_target_fields(mcfg_file_t *file, mcfg_section_t *target) {
 			char *errstr = mcfg_err_string(err);
 			mb_logf(
 				LOG_ERROR,
-				"failed to link target dependant field (mcfg_add_dynfield): "
+				"failed to link target dependant field (mb_dynfield_push): "
 				"%s (%d)\n",
 				errstr, err);
 			XFREE(errstr);
@@ -86,166 +64,61 @@ CPtrList link_target_fields(mcfg_file_t *file, mcfg_section_t *target) {
 }
 
 void unlink_target_fields(mcfg_file_t *file, CPtrList fields) {
-	for (size_t ix = 0; ix < fields.size; ix++) {
-		remove_dynfield(file, fields.items[ix]);
-		mb_logf(LOG_DEBUG, "unlinked fields \"%s\"\n", fields.items[ix]);
-	}
-}
-
-int run_required_targets(
-	mcfg_file_t *file,
-	mcfg_section_t *target,
-	CPtrList *target_history,
-	const config_t cfg) {
-	mcfg_field_t *field_required_targets =
-		mcfg_get_field(target, "required_targets");
-	if (field_required_targets == NULL) {
-		return 0;
-	}
-
-	mcfg_list_t *required_targets = mcfg_data_as_list(*field_required_targets);
-	mcfg_sector_t *targets = mcfg_get_sector(file, "targets");
-
-	int ret = 0;
-
-	for (size_t ix = 0; ix < required_targets->field_count; ix++) {
-		char *curr_target_name =
-			mcfg_data_to_string(required_targets->fields[ix]);
-		if (curr_target_name == NULL) {
+	/* in reverse, so that every field is popped off the end */
+	for (size_t ix = fields.size; ix > 0; ix--) {
+		char *name = fields.items[ix - 1];
+		if (!mb_dynfield_remove(file, name)) {
 			mb_logf(
-				LOG_WARNING, "%s/%s:%d: curr_target_name is NULL!\n", __FILE__,
-				__FUNCTION__, __LINE__);
+				LOG_DEBUG, "could not find field \"%s\" to remove!\n", name);
 			continue;
 		}
-
-		mcfg_section_t *curr_target =
-			mcfg_get_section(targets, curr_target_name);
-		if (curr_target == NULL) {
-			mb_logf(
-				LOG_ERROR,
-				"target \"%s\" required by target \"%s\" does not exist.\n",
-				curr_target_name, target->name);
-			XFREE(curr_target_name);
-
-			ret = 1;
-
-			if (cfg.ignore_failures) {
-				continue;
-			}
-
-			return ret;
-		}
-
-		int ret = mb_run_target(file, curr_target, target_history, cfg);
-		XFREE(curr_target_name);
-
-		if (ret != 0 && !cfg.ignore_failures) {
-			return ret;
-		}
+		mb_logf(LOG_DEBUG, "unlinked fields \"%s\"\n", name);
 	}
-
-	return ret;
 }
 
-int mb_run_target(
+int mb_target_submit(
 	mcfg_file_t *file,
 	mcfg_section_t *target,
-	CPtrList *target_history,
-	const config_t cfg) {
-	if (target_history == NULL) {
-		mb_log(
-			LOG_ERROR,
-			"internal: mb_run_target was passed a NULL target_history!\n");
-		return 1;
-	}
-
-	if (cptrlist_find(target_history, target->name, &string_cptrlist_search) !=
-		-1) {
-		mb_logf(
-			LOG_ERROR, "circular target dependency for target \"%s\"\n",
-			target->name);
-		mb_log(LOG_ERROR, "target history:\n");
-		for (size_t ix = 0; ix < target_history->size; ix++) {
-			mb_logf(LOG_ERROR, "  %s\n", target_history->items[ix]);
-		}
-		return 1;
-	}
-
-	cptrlist_append(target_history, strdup(target->name));
-
-	/* "Link" fields with target_ prefix to dynfields with the same name */
-	CPtrList linked_fields = link_target_fields(file, target);
-
-	mb_logf(LOG_INFO, "building target \"%s\"\n", target->name);
-
-	/* Target Execution Order
-	 * 1. required targets
-	 * 2. compilation rules
-	 * 3. "exec" field
-	 */
+	const config_t cfg,
+	job_group_t *group) {
+	mb_job_group_init(group, target->name, 1, cfg.ignore_failures);
 
-	int ret = 0;
-	ret = run_required_targets(file, target, target_history, cfg);
-	if (ret != 0 && !cfg.ignore_failures) {
-		goto exit;
-	}
-
-	int tmp_ret = mb_run_c_rules(
-		file, mcfg_get_field(target, "c_rules"), TARGET, target->name, cfg);
-	ret = ret > tmp_ret ? ret : tmp_ret;
-	if (ret != 0 && !cfg.ignore_failures) {
-		goto exit;
+	mcfg_field_t *field_exec = mb_get_field(target, "exec");
+	if (field_exec == NULL) {
+		return 0;
 	}
 
-	mcfg_field_t *field_exec = mcfg_get_field(target, "exec");
-	char *exec = NULL;
-	if (field_exec != NULL) {
-		char *raw_exec = mcfg_data_to_string(*field_exec);
-		mcfg_path_t pathrel = {
-			.absolute = true,
-			.dynfield_path = false,
-
-			.sector = "targets",
-			.section = target->name,
-			.field = ""};
-
-		mcfg_fmt_res_t fmt_res =
-			mcfg_format_field_embeds_str(raw_exec, *file, pathrel);
-		if (fmt_res.err != MCFG_FMT_OK) {
-			mb_logf(
-				LOG_ERROR,
-				"[target:exec_format] mcfg_format_field_embeds failed: %d\n",
-				fmt_res.err);
-		}
-
-		exec = fmt_res.formatted;
+	uint64_t format_start = mb_trace_now();
+	char *raw_exec = mcfg_data_to_string(*field_exec);
+	mcfg_path_t pathrel = {
+		.absolute = true,
+		.dynfield_path = false,
 
-		XFREE(raw_exec);
-	}
+		.sector = "targets",
+		.section = target->name,
+		.field = ""};
 
-	if (exec != NULL) {
-		tmp_ret = mb_exec(exec, target->name);
-		ret = ret > tmp_ret ? ret : tmp_ret;
-		XFREE(exec);
-		if (ret != 0 && !cfg.ignore_failures) {
-			goto exit;
-		}
-	}
+	MB_STAT_TIMER(exec_start);
+	MB_PROBE1(format__start, "target_exec_format");
+	mcfg_fmt_res_t fmt_res =
+		mcfg_format_field_embeds_str(raw_exec, *file, pathrel);
+	MB_PROBE2(format__end, "target_exec_format", fmt_res.err);
+	MB_STAT_FORMATTED(exec_start, fmt_res);
+	XFREE(raw_exec);
 
-	if (ret == 0) {
-		mb_logf(LOG_INFO, "built target \"%s\"!\n", target->name);
-	}
+	trace_arg_t trace_args[] = {TRACE_STR("target", target->name)};
+	mb_trace_span("target", "format", format_start, trace_args, 1);
 
-exit:;
-	int ix =
-		cptrlist_find(target_history, target->name, &string_cptrlist_search);
-	if (ix > -1) {
-		XFREE(target_history->items[ix]);
+	if (fmt_res.err != MCFG_FMT_OK) {
+		mb_logf(
+			LOG_ERROR,
+			"[target:exec_format] mcfg_format_field_embeds failed: %d\n",
+			fmt_res.err);
+		return fmt_res.err;
 	}
 
-	unlink_target_fields(file, linked_fields);
-	cptrlist_destroy(&linked_fields);
+	/* the job pool takes ownership of the script */
+	mb_jobs_submit(group, fmt_res.formatted, -1);
 
-	target_history->size--;
-	return ret;
+	return 0;
 }
@@ -8,13 +8,30 @@
 #define TARGET_H
 
 #include "cptrlist.h"
+#include "jobs.h"
 #include "mcfg.h"
 #include "types.h"
 
-int mb_run_target(
+/**
+ * @brief "Link" the fields of a target which are prefixed with target_ to
+ * dynfields with the same name. Fields which are already linked (e.g. by a
+ * target which required this one) are skipped.
+ * @return A list of the names of the linked fields.
+ */
+CPtrList link_target_fields(mcfg_file_t *file, mcfg_section_t *target);
+
+void unlink_target_fields(mcfg_file_t *file, CPtrList fields);
+
+/**
+ * @brief Render the exec field of a target, if present, and submit it to the
+ * job pool as a member of the given group. Required targets and c_rules of
+ * the target are nodes of their own within the build graph.
+ * @return 0 if the exec field could be rendered and submitted.
+ */
+int mb_target_submit(
 	mcfg_file_t *file,
 	mcfg_section_t *target,
-	CPtrList *target_history,
-	const config_t cfg);
+	const config_t cfg,
+	job_group_t *group);
 
 #endif /* #ifndef TARGET_H */
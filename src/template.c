@@ -0,0 +1,296 @@
+/* template.c ; mariebuild precompiled format template impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "fileindex.h"
+#include "logging.h"
+#include "probes.h"
+#include "stats.h"
+#include "template.h"
+#include "xmem.h"
+
+/* fields embedding each other in a loop would otherwise never finish */
+#define TEMPLATE_MAX_DEPTH 64
+
+static const char *slot_paths[TEMPLATE_SLOT_COUNT] = {
+	[TEMPLATE_SLOT_ELEMENT] = "%element%",
+	[TEMPLATE_SLOT_INPUT] = "%input%",
+	[TEMPLATE_SLOT_OUTPUT] = "%output%",
+};
+
+void _add_chunk(template_t *template, template_chunk_t chunk) {
+	if (template->chunk_count == template->chunk_capacity) {
+		template->chunk_capacity =
+			template->chunk_capacity == 0 ? 8 : template->chunk_capacity * 2;
+		template->chunks = XREALLOC(
+			template->chunks,
+			template->chunk_capacity * sizeof(*template->chunks));
+	}
+
+	template->chunks[template->chunk_count++] = chunk;
+}
+
+void _add_literal(template_t *template, const char *text, size_t length) {
+	if (length == 0) {
+		return;
+	}
+
+	while (template->literals_length + length > template->literals_capacity) {
+		template->literals_capacity = template->literals_capacity == 0
+										  ? 64
+										  : template->literals_capacity * 2;
+		template->literals =
+			XREALLOC(template->literals, template->literals_capacity);
+	}
+
+	memcpy(template->literals + template->literals_length, text, length);
+
+	/* extend the previous chunk if it is the literal text just before */
+	template_chunk_t *last = template->chunk_count > 0
+								 ? &template->chunks[template->chunk_count - 1]
+								 : NULL;
+	if (last != NULL && last->slot == TEMPLATE_SLOT_COUNT &&
+		last->offset + last->length == template->literals_length) {
+		last->length += length;
+	} else {
+		_add_chunk(
+			template, (template_chunk_t){
+						  .slot = TEMPLATE_SLOT_COUNT,
+						  .offset = template->literals_length,
+						  .length = length,
+					  });
+	}
+
+	template->literals_length += length;
+}
+
+/**
+ * @brief Look up the field an embed refers to, completing relative paths
+ * the way mcfg does.
+ */
+mcfg_field_t *_resolve_embed(template_t *template, char *path_str) {
+	mcfg_path_t path = mcfg_parse_path(path_str);
+	mcfg_field_t *field;
+
+	if (path.absolute || path.dynfield_path) {
+		field = mb_get_field_by_path(template->file, path);
+	} else {
+		mcfg_path_t full = template->pathrel;
+		full.field = path.field;
+		field = mb_get_field_by_path(template->file, full);
+	}
+
+	mcfg_free_path(path);
+	return field;
+}
+
+mcfg_fmt_err_t _compile(template_t *template, const char *src, size_t depth) {
+	if (depth > TEMPLATE_MAX_DEPTH) {
+		mb_log(LOG_ERROR, "embeds are nested too deeply\n");
+		return MCFG_FMT_INVALID_TYPE;
+	}
+
+	const char *literal = src;
+	const char *pos = src;
+
+	while (*pos != '\0') {
+		if (pos[0] == '\\' && pos[1] == '$') {
+			_add_literal(template, literal, pos - literal);
+			_add_literal(template, "$", 1);
+			pos += 2;
+			literal = pos;
+			continue;
+		}
+
+		const char *end = NULL;
+		if (pos[0] == '$' && pos[1] == '(') {
+			end = strchr(pos + 2, ')');
+		}
+
+		if (end == NULL) {
+			pos++;
+			continue;
+		}
+
+		_add_literal(template, literal, pos - literal);
+
+		char *path = strndup(pos + 2, end - (pos + 2));
+		pos = end + 1;
+		literal = pos;
+
+		template_slot_t slot = 0;
+		while (slot < TEMPLATE_SLOT_COUNT &&
+			   strcmp(path, slot_paths[slot]) != 0) {
+			slot++;
+		}
+
+		if (slot < TEMPLATE_SLOT_COUNT) {
+			_add_chunk(template, (template_chunk_t){.slot = slot});
+			XFREE(path);
+			continue;
+		}
+
+		mcfg_field_t *field = _resolve_embed(template, path);
+		if (field == NULL) {
+			mb_logf(LOG_ERROR, "embedded field \"%s\" does not exist\n", path);
+			XFREE(path);
+			return MCFG_FMT_NOT_FOUND;
+		}
+
+		XFREE(path);
+
+		char *value = mcfg_data_to_string(*field);
+		mcfg_fmt_err_t err = _compile(template, value, depth + 1);
+		XFREE(value);
+
+		if (err != MCFG_FMT_OK) {
+			return err;
+		}
+	}
+
+	_add_literal(template, literal, pos - literal);
+	return MCFG_FMT_OK;
+}
+
+mcfg_fmt_err_t mb_template_compile(
+	template_t *template,
+	const char *src,
+	mcfg_file_t *file,
+	mcfg_path_t pathrel) {
+	*template = (template_t){
+		.file = file,
+		.pathrel = pathrel,
+	};
+
+	if (src == NULL) {
+		return MCFG_FMT_NULLPTR;
+	}
+
+	return _compile(template, src, 0);
+}
+
+void _append_rendered(
+	char **buffer,
+	size_t *capacity,
+	size_t *length,
+	const char *text,
+	size_t text_length) {
+	/* room for the terminator as well */
+	while (*length + text_length + 1 > *capacity) {
+		*capacity = *capacity == 0 ? 256 : *capacity * 2;
+		*buffer = XREALLOC(*buffer, *capacity);
+	}
+
+	memcpy(*buffer + *length, text, text_length);
+	*length += text_length;
+}
+
+/**
+ * @param fallback Whether values with embeds are formatted through mcfg,
+ * otherwise they fail the render with MCFG_FMT_INVALID_TYPE.
+ */
+mcfg_fmt_err_t _render_chunks(
+	const template_t *template,
+	const char *const *values,
+	bool fallback,
+	char **buffer,
+	size_t *capacity) {
+	MB_STAT_TIMER(render_start);
+	size_t length = 0;
+	_append_rendered(buffer, capacity, &length, "", 0);
+
+	for (size_t ix = 0; ix < template->chunk_count; ix++) {
+		template_chunk_t *chunk = &template->chunks[ix];
+
+		if (chunk->slot == TEMPLATE_SLOT_COUNT) {
+			_append_rendered(
+				buffer, capacity, &length,
+				template->literals + chunk->offset, chunk->length);
+			continue;
+		}
+
+		const char *value = values[chunk->slot];
+		if (value == NULL) {
+			return MCFG_FMT_NULLPTR;
+		}
+
+		/* rare enough to not be worth compiling */
+		if (strstr(value, "$(") == NULL && strstr(value, "\\$") == NULL) {
+			_append_rendered(buffer, capacity, &length, value, strlen(value));
+			continue;
+		}
+
+		if (!fallback) {
+			return MCFG_FMT_INVALID_TYPE;
+		}
+
+		MB_STAT_TIMER(format_start);
+		MB_PROBE1(format__start, "template_value");
+		mcfg_fmt_res_t fmt_res = mcfg_format_field_embeds_str(
+			(char *)value, *template->file, template->pathrel);
+		MB_PROBE2(format__end, "template_value", fmt_res.err);
+		MB_STAT_FORMATTED(format_start, fmt_res);
+		if (fmt_res.err != MCFG_FMT_OK) {
+			return fmt_res.err;
+		}
+
+		_append_rendered(
+			buffer, capacity, &length, fmt_res.formatted,
+			strlen(fmt_res.formatted));
+		XFREE(fmt_res.formatted);
+	}
+
+	(*buffer)[length] = '\0';
+
+	MB_STAT_ELAPSED(STAT_RENDER_NS, render_start);
+	MB_STAT_INC(STAT_RENDER_CALLS);
+	MB_STAT_ADD(STAT_RENDER_BYTES, length);
+	return MCFG_FMT_OK;
+}
+
+mcfg_fmt_err_t mb_template_render(
+	template_t *template,
+	const char *const *values,
+	char **rendered) {
+	mcfg_fmt_err_t err = _render_chunks(
+		template, values, true, &template->buffer,
+		&template->buffer_capacity);
+	if (err != MCFG_FMT_OK) {
+		return err;
+	}
+
+	*rendered = template->buffer;
+	return MCFG_FMT_OK;
+}
+
+bool mb_template_render_plain(
+	const template_t *template,
+	const char *const *values,
+	char **buffer,
+	size_t *capacity) {
+	return _render_chunks(template, values, false, buffer, capacity) ==
+		   MCFG_FMT_OK;
+}
+
+void mb_template_free(template_t *template) {
+	if (template->chunks != NULL) {
+		XFREE(template->chunks);
+	}
+	if (template->literals != NULL) {
+		XFREE(template->literals);
+	}
+	if (template->buffer != NULL) {
+		XFREE(template->buffer);
+	}
+
+	*template = (template_t){0};
+}
@@ -0,0 +1,94 @@
+/* template.h ; mariebuild precompiled format template header
+ *
+ * A template is a string with mcfg embeds which is compiled once into
+ * literal chunks and slots for the dynfields which change with every
+ * element. Embeds of all other fields are resolved while compiling,
+ * including the embeds within their values.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mcfg.h"
+#include "mcfg_format.h"
+#include "mcfg_util.h"
+
+typedef enum template_slot {
+	TEMPLATE_SLOT_ELEMENT = 0,
+	TEMPLATE_SLOT_INPUT,
+	TEMPLATE_SLOT_OUTPUT,
+	TEMPLATE_SLOT_COUNT,
+} template_slot_t;
+
+typedef struct template_chunk {
+	/* TEMPLATE_SLOT_COUNT for literal text */
+	template_slot_t slot;
+	/* position of literal text within the template's literals */
+	size_t offset;
+	size_t length;
+} template_chunk_t;
+
+typedef struct template {
+	mcfg_file_t *file;
+	mcfg_path_t pathrel;
+
+	template_chunk_t *chunks;
+	size_t chunk_count;
+	size_t chunk_capacity;
+
+	char *literals;
+	size_t literals_length;
+	size_t literals_capacity;
+
+	/* the last rendered string, reused by every render */
+	char *buffer;
+	size_t buffer_capacity;
+} template_t;
+
+/**
+ * @brief Compile a string with embeds. The values of the fields it embeds,
+ * apart from the element, input and output dynfields, are taken as they
+ * are now.
+ * @param pathrel Completes relative paths, as for mcfg_format_field_embeds.
+ */
+mcfg_fmt_err_t mb_template_compile(
+	template_t *template,
+	const char *src,
+	mcfg_file_t *file,
+	mcfg_path_t pathrel);
+
+/**
+ * @brief Render a template with the given slot values. Values which contain
+ * embeds themselves are formatted through mcfg.
+ * @param values Indexed by template_slot_t, unused slots may be NULL.
+ * @param rendered Set to the rendered string, which is owned by the
+ * template and stays valid until it is rendered again or freed.
+ */
+mcfg_fmt_err_t mb_template_render(
+	template_t *template,
+	const char *const *values,
+	char **rendered);
+
+/**
+ * @brief Render a template into a buffer owned by the caller. The template
+ * is only read and values are never formatted through mcfg, so this may be
+ * called from any thread.
+ * @param buffer Grown as needed, may point to NULL initially.
+ * @return false if a value is NULL or contains embeds, in which case the
+ * template has to be rendered with mb_template_render.
+ */
+bool mb_template_render_plain(
+	const template_t *template,
+	const char *const *values,
+	char **buffer,
+	size_t *capacity);
+
+void mb_template_free(template_t *template);
+
+#endif /* #ifndef TEMPLATE_H */
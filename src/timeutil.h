@@ -0,0 +1,23 @@
+/* timeutil.h ; mariebuild clock utilities header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef TIMEUTIL_H
+#define TIMEUTIL_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @return A time as nanoseconds since the epoch of its clock.
+ */
+uint64_t mb_timespec_ns(struct timespec ts);
+
+/**
+ * @return CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t mb_monotonic_ns(void);
+
+#endif /* #ifndef TIMEUTIL_H */
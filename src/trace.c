@@ -0,0 +1,217 @@
+/* trace.c ; mariebuild build trace impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ioutil.h"
+#include "logging.h"
+#include "timeutil.h"
+#include "trace.h"
+
+/* events are written from the worker threads as well */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FILE *trace_file = NULL;
+static uint64_t trace_start = 0;
+static int trace_pid = 0;
+
+static _Thread_local size_t thread_track = TRACE_TRACK_MAIN;
+
+/**
+ * @brief Write the fields every event starts with, the caller holds the
+ * lock and finishes the event.
+ */
+void _begin_event(
+	const char *phase,
+	const char *category,
+	const char *name,
+	size_t track,
+	uint64_t ts) {
+	uint64_t relative = ts > trace_start ? ts - trace_start : 0;
+
+	fprintf(trace_file, ",\n{\"ph\":\"%s\",\"cat\":", phase);
+	mb_write_json_string(trace_file, category);
+	fputs(",\"name\":", trace_file);
+	mb_write_json_string(trace_file, name);
+	fprintf(
+		trace_file,
+		",\"pid\":%d,\"tid\":%zu,\"ts\":%" PRIu64 ".%03" PRIu64, trace_pid,
+		track, relative / 1000, relative % 1000);
+}
+
+void _write_args(const trace_arg_t *args, size_t arg_count) {
+	if (arg_count == 0) {
+		return;
+	}
+
+	fputs(",\"args\":{", trace_file);
+	for (size_t ix = 0; ix < arg_count; ix++) {
+		if (ix > 0) {
+			fputc(',', trace_file);
+		}
+
+		mb_write_json_string(trace_file, args[ix].key);
+		fputc(':', trace_file);
+		if (args[ix].str != NULL) {
+			mb_write_json_string(trace_file, args[ix].str);
+		} else {
+			fprintf(trace_file, "%" PRId64, args[ix].num);
+		}
+	}
+	fputc('}', trace_file);
+}
+
+bool mb_trace_open(const char *path) {
+	if (path == NULL) {
+		return true;
+	}
+
+	trace_file = fopen(path, "w");
+	if (trace_file == NULL) {
+		mb_logf(
+			LOG_WARNING, "could not open trace \"%s\": %s\n", path,
+			strerror(errno));
+		return false;
+	}
+
+	trace_start = mb_monotonic_ns();
+	trace_pid = getpid();
+
+	/* every event is preceded by a comma, this one takes the first */
+	fprintf(
+		trace_file,
+		"[{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,"
+		"\"args\":{\"name\":\"mariebuild\"}}",
+		trace_pid);
+	mb_trace_name_track(TRACE_TRACK_MAIN, "main");
+
+	return true;
+}
+
+void mb_trace_close(void) {
+	if (trace_file == NULL) {
+		return;
+	}
+
+	fputs("\n]\n", trace_file);
+	fclose(trace_file);
+	trace_file = NULL;
+}
+
+bool mb_trace_enabled(void) {
+	return trace_file != NULL;
+}
+
+uint64_t mb_trace_now(void) {
+	return trace_file == NULL ? 0 : mb_monotonic_ns();
+}
+
+void mb_trace_name_track(size_t track, const char *name) {
+	if (trace_file == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	fprintf(
+		trace_file,
+		",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%zu,"
+		"\"args\":{\"name\":",
+		trace_pid, track);
+	mb_write_json_string(trace_file, name);
+	fputs("}}", trace_file);
+
+	/* keep the tracks in their numeric order */
+	fprintf(
+		trace_file,
+		",\n{\"ph\":\"M\",\"name\":\"thread_sort_index\",\"pid\":%d,"
+		"\"tid\":%zu,\"args\":{\"sort_index\":%zu}}",
+		trace_pid, track, track);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void mb_trace_set_thread_track(size_t track) {
+	thread_track = track;
+}
+
+void mb_trace_span(
+	const char *category,
+	const char *name,
+	uint64_t start,
+	const trace_arg_t *args,
+	size_t arg_count) {
+	if (trace_file == NULL) {
+		return;
+	}
+
+	mb_trace_span_on(
+		thread_track, category, name, start, mb_monotonic_ns(), args,
+		arg_count);
+}
+
+void mb_trace_span_on(
+	size_t track,
+	const char *category,
+	const char *name,
+	uint64_t start,
+	uint64_t end,
+	const trace_arg_t *args,
+	size_t arg_count) {
+	if (trace_file == NULL) {
+		return;
+	}
+
+	uint64_t duration = end > start ? end - start : 0;
+
+	pthread_mutex_lock(&trace_lock);
+	_begin_event("X", category, name, track, start);
+	fprintf(
+		trace_file, ",\"dur\":%" PRIu64 ".%03" PRIu64, duration / 1000,
+		duration % 1000);
+	_write_args(args, arg_count);
+	fputc('}', trace_file);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void mb_trace_begin_async(const char *category, const char *name, size_t id) {
+	if (trace_file == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	_begin_event("b", category, name, thread_track, mb_monotonic_ns());
+	fprintf(trace_file, ",\"id\":%zu}", id);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void mb_trace_end_async(
+	const char *category,
+	const char *name,
+	size_t id,
+	const trace_arg_t *args,
+	size_t arg_count) {
+	if (trace_file == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	_begin_event("e", category, name, thread_track, mb_monotonic_ns());
+	fprintf(trace_file, ",\"id\":%zu", id);
+	_write_args(args, arg_count);
+	fputc('}', trace_file);
+	pthread_mutex_unlock(&trace_lock);
+}
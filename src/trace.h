@@ -0,0 +1,96 @@
+/* trace.h ; mariebuild build trace header
+ *
+ * Writes a timeline of the build as Chrome trace event JSON, which can be
+ * loaded into Perfetto or chrome://tracing. The trace is written in the
+ * array format, so that a trace of a build which was interrupted still
+ * loads.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* tracks of the timeline, the main thread, each job slot and each worker */
+#define TRACE_TRACK_MAIN 0
+#define TRACE_TRACK_SLOTS 1000
+#define TRACE_TRACK_WORKERS 2000
+
+typedef struct trace_arg {
+	const char *key;
+	/* the value is num if str is NULL */
+	const char *str;
+	int64_t num;
+} trace_arg_t;
+
+#define TRACE_STR(k, v) ((trace_arg_t){.key = (k), .str = (v), .num = 0})
+#define TRACE_NUM(k, v) ((trace_arg_t){.key = (k), .str = NULL, .num = (v)})
+
+/**
+ * @brief Start writing a trace to the given path, NULL to not trace. Has to
+ * be called before any other threads are started.
+ */
+bool mb_trace_open(const char *path);
+
+void mb_trace_close(void);
+
+bool mb_trace_enabled(void);
+
+/**
+ * @return CLOCK_MONOTONIC time in nanoseconds, 0 if nothing is traced.
+ */
+uint64_t mb_trace_now(void);
+
+/**
+ * @brief Name a track of the timeline.
+ */
+void mb_trace_name_track(size_t track, const char *name);
+
+/**
+ * @brief Set the track the calling thread's spans are put on, which is
+ * TRACE_TRACK_MAIN unless set.
+ */
+void mb_trace_set_thread_track(size_t track);
+
+/**
+ * @brief Trace a span from start until now on the calling thread's track.
+ * Spans on a track have to be nested.
+ */
+void mb_trace_span(
+	const char *category,
+	const char *name,
+	uint64_t start,
+	const trace_arg_t *args,
+	size_t arg_count);
+
+/**
+ * @brief Trace a span on the given track.
+ */
+void mb_trace_span_on(
+	size_t track,
+	const char *category,
+	const char *name,
+	uint64_t start,
+	uint64_t end,
+	const trace_arg_t *args,
+	size_t arg_count);
+
+/**
+ * @brief Begin a span which may overlap others, e.g. a c_rule running next
+ * to another one. It is identified by its category and id.
+ */
+void mb_trace_begin_async(const char *category, const char *name, size_t id);
+
+void mb_trace_end_async(
+	const char *category,
+	const char *name,
+	size_t id,
+	const trace_arg_t *args,
+	size_t arg_count);
+
+#endif /* #ifndef TRACE_H */
@@ -16,9 +16,11 @@ struct build_type_id {
 
 struct build_type_id build_type_lookup[] = {
 	{.name = "incremental", .value = BUILD_TYPE_INCREMENTAL},
-	{.name = "full", .value = BUILD_TYPE_FULL}};
+	{.name = "full", .value = BUILD_TYPE_FULL},
+	{.name = "hashed", .value = BUILD_TYPE_HASHED}};
 
-const size_t BUILD_TYPE_LOOKUP_SIZE = sizeof(build_type_lookup);
+const size_t BUILD_TYPE_LOOKUP_SIZE =
+	sizeof(build_type_lookup) / sizeof(build_type_lookup[0]);
 
 build_type_t str_to_build_type(char *src, build_type_t fallback) {
 	if (src == NULL) {
@@ -43,7 +45,8 @@ struct exec_mode_id exec_mode_lookup[] = {
 	{.name = "singular", .value = EXEC_MODE_SINGULAR},
 	{.name = "unify", .value = EXEC_MODE_UNIFY}};
 
-const size_t EXEC_MODE_LOOKUP_SIZE = sizeof(exec_mode_lookup);
+const size_t EXEC_MODE_LOOKUP_SIZE =
+	sizeof(exec_mode_lookup) / sizeof(exec_mode_lookup[0]);
 
 exec_mode_t str_to_exec_mode(char *src, exec_mode_t fallback) {
 	if (src == NULL) {
@@ -8,13 +8,17 @@
 #define TYPES_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "cptrlist.h"
 
 typedef enum build_type {
 	BUILD_TYPE_FULL = 0,
 	BUILD_TYPE_INCREMENTAL = 1,
-	//  BUILD_TYPE_DIFFERENTIAL = 2, // no, just no (maybe yes)
+	/* like incremental, but inputs whose metadata changed are compared by
+	 * their contents */
+	BUILD_TYPE_HASHED = 2,
+	//  BUILD_TYPE_DIFFERENTIAL = 3, // no, just no (maybe yes)
 } build_type_t;
 
 typedef struct config {
@@ -24,6 +28,18 @@ typedef struct config {
 	CPtrList public_targets;
 	bool always_force;
 	bool ignore_failures;
+	/* path of the build log, NULL if it is disabled */
+	char *build_log;
+	/* directory of the artifact cache, NULL if it is disabled */
+	char *cache_dir;
+	/* size in bytes the artifact cache is trimmed to */
+	uint64_t cache_size;
+	/* path of the glob cache, NULL if it is disabled */
+	char *glob_cache;
+	/* path the flight recorder is dumped to, NULL if it is disabled */
+	char *flight_log;
+	/* whether the parsed build file is cached next to it */
+	bool file_cache;
 } config_t;
 
 typedef enum exec_mode {
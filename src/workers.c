@@ -0,0 +1,237 @@
+/* workers.c ; mariebuild worker thread pool impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "jobs.h"
+#include "logging.h"
+#include "trace.h"
+#include "workers.h"
+#include "xmem.h"
+
+static pthread_t *threads = NULL;
+static size_t thread_count = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* signalled when a batch is queued or the workers are stopped */
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+/* signalled when an item was processed or a worker left a batch */
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+/* FIFO of batches with unclaimed items */
+static work_batch_t *batches_head = NULL;
+static work_batch_t *batches_tail = NULL;
+static bool stopping = false;
+
+void _unqueue_batch(work_batch_t *batch) {
+	work_batch_t *prev = NULL;
+	work_batch_t *curr = batches_head;
+
+	while (curr != NULL && curr != batch) {
+		prev = curr;
+		curr = curr->next_batch;
+	}
+
+	if (curr == NULL) {
+		return;
+	}
+
+	if (prev == NULL) {
+		batches_head = batch->next_batch;
+	} else {
+		prev->next_batch = batch->next_batch;
+	}
+	if (batches_tail == batch) {
+		batches_tail = prev;
+	}
+
+	batch->next_batch = NULL;
+}
+
+/**
+ * @brief Claim and process the next item of a batch.
+ * @return Whether there was an item left.
+ */
+bool _process_next(work_batch_t *batch, size_t worker) {
+	size_t item = atomic_fetch_add(&batch->next, 1);
+	if (item >= batch->count) {
+		return false;
+	}
+
+	batch->fn(batch->ctx, item, worker);
+	atomic_store(&batch->done[item], true);
+
+	pthread_mutex_lock(&lock);
+	pthread_cond_broadcast(&done_cond);
+	pthread_mutex_unlock(&lock);
+
+	return true;
+}
+
+void *_worker_main(void *arg) {
+	size_t worker = (size_t)(uintptr_t)arg;
+	mb_trace_set_thread_track(TRACE_TRACK_WORKERS + worker);
+
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (!stopping && batches_head == NULL) {
+			pthread_cond_wait(&work_cond, &lock);
+		}
+
+		if (stopping) {
+			break;
+		}
+
+		work_batch_t *batch = batches_head;
+		batch->active++;
+		pthread_mutex_unlock(&lock);
+
+		while (_process_next(batch, worker)) {
+		}
+
+		pthread_mutex_lock(&lock);
+		batch->active--;
+		_unqueue_batch(batch);
+		pthread_cond_broadcast(&done_cond);
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+void mb_workers_init(size_t count) {
+	threads = count == 0 ? NULL : XCALLOC(count, sizeof(*threads));
+	thread_count = 0;
+	stopping = false;
+
+	for (size_t ix = 0; ix < count; ix++) {
+		if (mb_trace_enabled()) {
+			char name[32];
+			snprintf(name, sizeof(name), "worker %zu", ix);
+			mb_trace_name_track(TRACE_TRACK_WORKERS + ix, name);
+		}
+
+		if (pthread_create(
+				&threads[ix], NULL, _worker_main, (void *)(uintptr_t)ix) !=
+			0) {
+			mb_logf(
+				LOG_WARNING, "could only start %zu of %zu workers\n", ix,
+				count);
+			break;
+		}
+		thread_count++;
+	}
+
+	mb_logf(LOG_DEBUG, "started %zu workers\n", thread_count);
+}
+
+void mb_workers_destroy(void) {
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&lock);
+
+	for (size_t ix = 0; ix < thread_count; ix++) {
+		pthread_join(threads[ix], NULL);
+	}
+
+	if (threads != NULL) {
+		XFREE(threads);
+		threads = NULL;
+	}
+	thread_count = 0;
+}
+
+size_t mb_workers_count(void) {
+	return thread_count;
+}
+
+size_t mb_workers_default_count(void) {
+	size_t count = mb_jobs_default_count() - 1;
+	return count > WORKERS_MAX ? WORKERS_MAX : count;
+}
+
+void mb_workers_start(
+	work_batch_t *batch,
+	work_fn_t fn,
+	void *ctx,
+	size_t count) {
+	*batch = (work_batch_t){
+		.fn = fn,
+		.ctx = ctx,
+		.count = count,
+		.done = XCALLOC(count + 1, sizeof(*batch->done)),
+		.active = 0,
+		.next_batch = NULL,
+	};
+	atomic_init(&batch->next, 0);
+
+	if (thread_count == 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	if (batches_tail == NULL) {
+		batches_head = batch;
+	} else {
+		batches_tail->next_batch = batch;
+	}
+	batches_tail = batch;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&lock);
+}
+
+void mb_workers_wait(work_batch_t *batch, size_t item) {
+	while (!atomic_load(&batch->done[item])) {
+		if (_process_next(batch, thread_count)) {
+			continue;
+		}
+
+		/* the item is being processed by a worker */
+		pthread_mutex_lock(&lock);
+		while (!atomic_load(&batch->done[item])) {
+			pthread_cond_wait(&done_cond, &lock);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+bool mb_workers_done(work_batch_t *batch, size_t item) {
+	return atomic_load(&batch->done[item]);
+}
+
+void mb_workers_finish(work_batch_t *batch) {
+	if (batch->done == NULL) {
+		return;
+	}
+
+	atomic_store(&batch->next, batch->count);
+
+	pthread_mutex_lock(&lock);
+	_unqueue_batch(batch);
+	while (batch->active > 0) {
+		pthread_cond_wait(&done_cond, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void mb_workers_free(work_batch_t *batch) {
+	if (batch->done != NULL) {
+		XFREE(batch->done);
+	}
+
+	*batch = (work_batch_t){0};
+}
@@ -0,0 +1,92 @@
+/* workers.h ; mariebuild worker thread pool header
+ *
+ * Threads which process the items of batches in the background, e.g. to
+ * render and check the elements of a c_rule while the first of their jobs
+ * already run. Batches are only started, waited for and finished by the
+ * main thread, which also processes items itself while it waits.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* rendering is mostly bound by stat'ing files, more threads do not help */
+#define WORKERS_MAX 8
+
+/**
+ * @param item Index of the item within its batch.
+ * @param worker Index of the calling thread, below mb_workers_count() for
+ * workers and equal to it for the main thread.
+ */
+typedef void (*work_fn_t)(void *ctx, size_t item, size_t worker);
+
+typedef struct work_batch {
+	work_fn_t fn;
+	void *ctx;
+	size_t count;
+
+	/* the next item to be claimed, items are claimed in order */
+	atomic_size_t next;
+	/* whether each item was processed */
+	atomic_bool *done;
+	/* workers which are processing items of this batch */
+	size_t active;
+
+	struct work_batch *next_batch;
+} work_batch_t;
+
+/**
+ * @brief Start the worker threads.
+ * @param count 0 to process every item on the main thread once it is
+ * waited for.
+ */
+void mb_workers_init(size_t count);
+
+void mb_workers_destroy(void);
+
+size_t mb_workers_count(void);
+
+/**
+ * @brief The amount of workers used by default, one less than there are
+ * online CPUs since the main thread helps out.
+ */
+size_t mb_workers_default_count(void);
+
+/**
+ * @brief Queue a batch of items to be processed in the background. The
+ * batch has to stay in place until it is finished.
+ */
+void mb_workers_start(
+	work_batch_t *batch,
+	work_fn_t fn,
+	void *ctx,
+	size_t count);
+
+/**
+ * @brief Wait until an item was processed, processing unclaimed items on
+ * the calling thread in the meantime.
+ */
+void mb_workers_wait(work_batch_t *batch, size_t item);
+
+/**
+ * @brief Whether an item was processed, which stays false for items left
+ * over when the batch was finished.
+ */
+bool mb_workers_done(work_batch_t *batch, size_t item);
+
+/**
+ * @brief Stop a batch from being processed any further and wait for the
+ * items in progress. mb_workers_done may still be called until the batch is
+ * freed.
+ */
+void mb_workers_finish(work_batch_t *batch);
+
+void mb_workers_free(work_batch_t *batch);
+
+#endif /* #ifndef WORKERS_H */
@@ -0,0 +1,94 @@
+/* xmem.c ; mariebuild memory helpers impl.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "xmem.h"
+
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+size_t _arena_align(size_t size) {
+	return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+void *mb_arena_alloc(arena_t *arena, size_t size) {
+	size = _arena_align(size);
+
+	arena_block_t *block = arena->head;
+	if (block == NULL || block->size - block->used < size) {
+		size_t block_size = block == NULL ? ARENA_BLOCK_SIZE : block->size * 2;
+		while (block_size < size) {
+			block_size *= 2;
+		}
+
+		arena_block_t *new_block = XMALLOC(sizeof(*new_block) + block_size);
+		*new_block = (arena_block_t){
+			.prev = block,
+			.size = block_size,
+			.used = 0,
+		};
+
+		arena->head = block = new_block;
+	}
+
+	void *ret = (char *)block->data + block->used;
+	block->used += size;
+	arena->last = ret;
+
+	return ret;
+}
+
+void *mb_arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t size) {
+	if (ptr == NULL) {
+		return mb_arena_alloc(arena, size);
+	}
+
+	if (ptr == arena->last) {
+		arena_block_t *block = arena->head;
+		size_t offset = (char *)ptr - (char *)block->data;
+
+		if (_arena_align(size) <= block->size - offset) {
+			block->used = offset + _arena_align(size);
+			return ptr;
+		}
+	}
+
+	void *ret = mb_arena_alloc(arena, size);
+	memcpy(ret, ptr, old_size < size ? old_size : size);
+	return ret;
+}
+
+char *mb_arena_strdup(arena_t *arena, const char *str) {
+	size_t size = strlen(str) + 1;
+	char *ret = mb_arena_alloc(arena, size);
+	memcpy(ret, str, size);
+	return ret;
+}
+
+void _arena_free_blocks(arena_block_t *block) {
+	while (block != NULL) {
+		arena_block_t *prev = block->prev;
+		XFREE(block);
+		block = prev;
+	}
+}
+
+void mb_arena_reset(arena_t *arena) {
+	if (arena->head == NULL) {
+		return;
+	}
+
+	_arena_free_blocks(arena->head->prev);
+	arena->head->prev = NULL;
+	arena->head->used = 0;
+	arena->last = NULL;
+}
+
+void mb_arena_free(arena_t *arena) {
+	_arena_free_blocks(arena->head);
+	*arena = (arena_t){0};
+}
@@ -7,6 +7,7 @@
 #ifndef XMEM_H
 #define XMEM_H
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -62,4 +63,50 @@
 		}                                                             \
 	} while (0)
 
+/* the smallest block an arena allocates */
+#define ARENA_BLOCK_SIZE 4096
+
+typedef struct arena_block {
+	struct arena_block *prev;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+} arena_block_t;
+
+/**
+ * @brief Bump allocator whose allocations are only ever freed all at once,
+ * for strings which live as long as an element or a rule. Blocks double in
+ * size, a reset keeps the newest and largest one.
+ */
+typedef struct arena {
+	/* the block allocations are taken from, NULL if there is none */
+	arena_block_t *head;
+	/* the last allocation, which may grow in place */
+	void *last;
+} arena_t;
+
+/**
+ * @brief Allocate from an arena, aligned like malloc.
+ */
+void *mb_arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Resize an allocation of the arena. The last allocation grows in
+ * place while its block has room, others are copied.
+ * @param ptr May be NULL, in which case this is mb_arena_alloc.
+ */
+void *mb_arena_grow(arena_t *arena, void *ptr, size_t old_size, size_t size);
+
+char *mb_arena_strdup(arena_t *arena, const char *str);
+
+/**
+ * @brief Free every allocation of the arena, keeping its largest block.
+ */
+void mb_arena_reset(arena_t *arena);
+
+/**
+ * @brief Free every allocation and block of the arena.
+ */
+void mb_arena_free(arena_t *arena);
+
 #endif /* #ifndef XMEM_H */
@@ -0,0 +1,121 @@
+#!/bin/bash
+
+# mariebuild build graph tests.
+# Each case is a small project whose c_rules leave marker files behind and
+# fail if a rule they have to wait for did not leave its marker yet. The
+# projects are built with several jobs, so that a missing edge in the graph
+# lets a rule start too early.
+
+export LC_ALL=C
+
+FAILED=0
+
+function usage() {
+	echo "usage: $0 MB_BINARY"
+	exit 1
+}
+
+# a unify c_rule which waits, then checks the markers of the given rules
+# and leaves its own
+function rule() {
+	local name=$1
+	local delay=$2
+	local requires=$3
+	shift 3
+
+	local checks=""
+	for after in "$@"; do
+		checks+="test -f $after.done || exit 1"$'\n		'
+	done
+
+	echo "	section $name"
+	if [ -n "$requires" ]; then
+		echo "		list str c_rules $requires"
+	fi
+	cat <<EOF
+		str exec_mode 'unify'
+		str input_src '/config/files/inputs'
+		str input_format '\$(%element%)'
+		str output_format '$name.done'
+		str exec '#!/bin/sh
+		sleep $delay
+		${checks}touch \$(%output%)
+		'
+	end
+
+EOF
+}
+
+# runs a project generated from the given c_rules list and rules
+function check() {
+	local name=$1
+	local c_rules=$2
+	local rules=$3
+
+	local dir="$WORKDIR/$name"
+	mkdir -p "$dir"
+	touch "$dir/input"
+
+	cat > "$dir/build.mb" <<EOF
+sector config
+	section files
+		list str inputs 'input'
+	end
+
+	section mariebuild
+		str build_type 'full'
+		list str targets 'all'
+		str default 'all'
+	end
+end
+
+sector targets
+	section all
+		list str c_rules $c_rules
+	end
+end
+
+sector c_rules
+$rules
+end
+EOF
+
+	if (cd "$dir" && "$MB" -n -j 4 > output.log 2>&1); then
+		echo "==> $name: ok" >&2
+	else
+		echo "==> $name: failed, see $dir/output.log" >&2
+		FAILED=1
+	fi
+}
+
+if [ -z "$1" ]; then
+	usage
+fi
+
+MB=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+if [ ! -x "$MB" ]; then
+	echo "==> \"$1\" is not executable" >&2
+	exit 1
+fi
+
+WORKDIR=$(mktemp -d "${TMPDIR:-/tmp}/mb_test.XXXXXX") || exit
+
+# a rule listed again after it was required by an earlier rule still keeps
+# the rules listed after it waiting for everything listed before
+check diamond "'objects', 'headers', 'link'" \
+	"$(rule headers 0.2 '')
+$(rule objects 0.5 "'headers'" headers)
+$(rule link 0 '' objects headers)"
+
+# a rule listed after a rule which requires it cannot wait for that rule,
+# the rules listed after both still have to wait for each of them
+check reused "'link', 'objects', 'after'" \
+	"$(rule objects 0.2 '')
+$(rule link 0.2 "'objects'" objects)
+$(rule after 0 '' link objects)"
+
+if (( FAILED == 0 )); then
+	rm -rf "$WORKDIR"
+fi
+
+exit $FAILED